@@ -0,0 +1,74 @@
+/*
+ * lathist.c - Log-bucketed latency histograms for mdriver -H
+ */
+#include <string.h>
+
+#include "lathist.h"
+
+#define OVERHEAD_SAMPLES 100000  /* back-to-back timer reads in lathist_overhead */
+
+/*
+ * lathist_reset - Empty h
+ */
+void lathist_reset(lathist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/*
+ * bucket_high - The largest value recorded in bucket idx
+ */
+static uint64_t bucket_high(int idx)
+{
+    int e;
+
+    if (idx < 2 * LH_SUB)
+        return idx;
+    e = idx / LH_SUB - 1;
+    return ((uint64_t)(idx % LH_SUB + LH_SUB + 1) << e) - 1;
+}
+
+/*
+ * lathist_percentile - The value below which a fraction p of the
+ *     values in h lie, as the top of the bucket it falls in (but no
+ *     more than the largest value recorded), or 0 if h is empty
+ */
+uint64_t lathist_percentile(const lathist_t *h, double p)
+{
+    uint64_t target, seen = 0, high;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+    target = (uint64_t)(p * h->count);
+    if (target < p * h->count)
+        target++;
+    if (target == 0)
+        target = 1;
+    for (i = 0; i < LH_NBUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen >= target)
+            break;
+    }
+    high = bucket_high(i);
+    return high < h->max ? high : h->max;
+}
+
+/*
+ * lathist_overhead - The cost of timing nothing: the least difference
+ *     between two back-to-back lathist_now calls, which callers
+ *     subtract from each timed value
+ */
+uint64_t lathist_overhead(void)
+{
+    uint64_t t0, t1, least = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < OVERHEAD_SAMPLES; i++) {
+        t0 = lathist_now();
+        t1 = lathist_now();
+        if (t1 - t0 < least)
+            least = t1 - t0;
+    }
+    return least;
+}
@@ -0,0 +1,65 @@
+/*
+ * lathist.h - Log-bucketed latency histograms for mdriver -H
+ *
+ * Values below 2^LH_SUB_BITS each get their own bucket; above that,
+ * every power of two is split into 2^LH_SUB_BITS buckets, as HDR
+ * histograms do, so any 64-bit value is recorded to within about 6%
+ * in a fixed LH_NBUCKETS counters, and adding one costs a few
+ * instructions. Latencies are in cycles of the time stamp counter on
+ * x86 and in nanoseconds elsewhere (LH_UNIT).
+ */
+#ifndef __LATHIST_H_
+#define __LATHIST_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define LH_SUB_BITS 4
+#define LH_SUB      (1 << LH_SUB_BITS)
+#define LH_NBUCKETS ((64 - LH_SUB_BITS + 1) * LH_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t bucket[LH_NBUCKETS];
+} lathist_t;
+
+#if defined(__i386__) || defined(__x86_64__)
+#define LH_UNIT "cycles"
+/* The current time, read as cheaply as the CPU allows */
+static inline uint64_t lathist_now(void)
+{
+    return __builtin_ia32_rdtsc();
+}
+#else
+#define LH_UNIT "ns"
+static inline uint64_t lathist_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+/* Record one value v in h */
+static inline void lathist_add(lathist_t *h, uint64_t v)
+{
+    int msb = 63 - __builtin_clzll(v | 1);
+    int idx;
+
+    if (msb < LH_SUB_BITS)
+        idx = (int)v;
+    else
+        idx = (msb - LH_SUB_BITS + 1) * LH_SUB + (int)(v >> (msb - LH_SUB_BITS)) - LH_SUB;
+    h->bucket[idx]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+void lathist_reset(lathist_t *h);
+uint64_t lathist_percentile(const lathist_t *h, double p);
+uint64_t lathist_overhead(void);
+
+#endif /* __LATHIST_H_ */
@@ -15,11 +15,25 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+#include <getopt.h>
+#include <math.h>
 
 #include "mm.h"
+#include "mm_inline.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "mmtrace.h"
+#include "mmbtrace.h"
+#include "pattern.h"
+#include "lathist.h"
+#include "perfctr.h"
 
 /**********************
  * Constants and macros
@@ -30,6 +44,32 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Streamed traces */
+#define STREAM_CHUNK 16384 /* ops the decoder thread hands over at a time */
+#define STREAM_NBUF      4 /* decoded chunks it may run ahead of the replay */
+#define STREAM_INBUF 65536 /* bytes of encoded ops it reads at a time */
+
+/* Machine-readable results and baselines (--json, --csv, --baseline) */
+#define REPORT_RUNS      5 /* timed runs of each trace, for its noise */
+#define BASE_MIN_TOL  0.03 /* least throughput drop taken as a regression */
+#define BASE_SIGMAS      3 /* or this many times the combined noise, if more */
+#define BASE_UTIL_TOL 0.005 /* least utilization drop taken as a regression */
+enum {OPT_JSON = 256, OPT_CSV, OPT_BASELINE};
+
+/* Utilization timelines (-U) */
+#define TIMELINE_INTERVAL 100 /* default ops between samples (-u) */
+#define TIMELINE_FREE    0.25 /* a sample is fragmented when this much of the heap is free... */
+#define TIMELINE_FRAG    0.50 /* ... and this much of the free space lies outside its largest block */
+
+/* Per-op latency percentiles (-H) */
+#define LAT_OPS   3 /* request types: ALLOC, FREE and REALLOC */
+#define LAT_BANDS 5 /* payload size bands, see lat_band */
+#define LAT_NPCT  4 /* percentiles reported, see lat_pcts */
+
+/* The range shadow */
+#define SHADOW_BITS (MAX_HEAP / ALIGNMENT)         /* one per ALIGNMENT bytes of heap */
+#define WORD_BITS   (8 * sizeof(unsigned long))
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -37,19 +77,23 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
-typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+/*
+ * Records the extent of each block's payload: a shadow of the heap with
+ * one bit for every ALIGNMENT bytes, set where a payload lies
+ */
+typedef struct {
+    unsigned long *bits;   /* SHADOW_BITS bits, for mem_heap_lo() on */
+    unsigned long used;    /* words of bits that may be set */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+/* 
+ * Characterizes a single trace operation (allocator request): its type,
+ * the index for free() to use later and the byte size of an alloc/realloc
+ * request. It is the mmbt_op_t of a binary trace, so those are replayed
+ * straight from the mapped file.
+ */
+enum {ALLOC = MMBT_ALLOC, FREE = MMBT_FREE, REALLOC = MMBT_REALLOC};
+typedef mmbt_op_t traceop_t;
 
 /* Holds the information for one trace file*/
 typedef struct {
@@ -58,10 +102,42 @@ typedef struct {
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    char *map;           /* mapping of a binary trace that ops points into, or NULL */
+    size_t map_len;      /* its length */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
 } trace_t;
 
+/*
+ * A streamed trace (mmbtrace.h), replayed in constant memory: a decoder
+ * thread decodes the file into a ring of STREAM_NBUF chunks that the
+ * replay works through, and blocks are kept per slot rather than per id.
+ */
+typedef struct {
+    FILE *file;
+    char *path;
+    mmbs_hdr_t hdr;
+    char **blocks;       /* block of each slot... */
+    size_t *block_sizes; /* ... and its payload size */
+
+    /* Decoder state, under lock */
+    pthread_t decoder;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    traceop_t *chunk[STREAM_NBUF]; /* the ring of decoded chunks */
+    int chunk_ops[STREAM_NBUF];    /* ops in each */
+    long decoded;        /* chunks decoded so far */
+    long replayed;       /* chunks the replay has given back */
+    int taken;           /* the replay holds chunk[replayed % STREAM_NBUF] */
+    int done;            /* decoded to the end (1) or to a bad op (-1) */
+    int stop;            /* the replay has stopped early */
+    char error[128];     /* what the bad op was, once done is -1 */
+
+    /* Decoder's own state */
+    unsigned long *live; /* bit per slot: allocated by the ops decoded so far */
+    unsigned char in[STREAM_INBUF];
+} stream_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -78,6 +154,7 @@ typedef struct {
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double noise;    /* relative std deviation of secs over its timed runs */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
@@ -85,11 +162,72 @@ typedef struct {
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Sent by a -j worker to mdriver for each trace it has checked */
+typedef struct {
+    int tracenum;
+    int errors;      /* errors found on it */
+    stats_t stats;   /* ops, valid and util */
+    mm_stats_t check; /* mm.c's counters after the check (-V) */
+} check_msg_t;
+
+/* Summarizes mm.c's lifetime predictor on some trace (-L) */
+typedef struct {
+    double util_cold; /* space utilization with a predictor that has not seen the trace */
+    double util_warm; /* space utilization once it has learned from one run of the trace */
+    double secs;      /* number of secs needed to run the trace with the predictor on */
+} lt_stats_t;
+
+/* A trace's utilization timeline being written (-U) */
+typedef struct {
+    FILE *file;          /* NULL if there is no timeline to write */
+    int tracenum;
+    long last;           /* op of the last sample */
+    long phase_start;    /* op that began the current fragmented phase, or -1 */
+    double phase_worst;  /* highest fragmentation in it */
+} timeline_t;
+
+/* A trace's results in a stored run (--baseline) */
+typedef struct {
+    char file[MAXLINE];
+    int valid;
+    double kops;     /* throughput */
+    double noise;    /* relative std deviation of its run time */
+    double util;
+} base_t;
+
+/* Hardware event counts of one run of mm malloc on some trace (-E) */
+typedef struct {
+    double counts[PC_NEVENTS]; /* each perfctr.h event, -1 if not counted */
+} hw_stats_t;
+
+/* Latency percentiles of one request type in one size band (-H) */
+typedef struct {
+    unsigned long count; /* requests timed */
+    uint64_t pct[LAT_NPCT]; /* at each of lat_pcts, in LH_UNIT */
+    uint64_t max;
+} lat_row_t;
+
+/* Summarizes the per-request latencies of mm malloc on some trace (-H) */
+typedef struct {
+    uint64_t overhead;   /* timer overhead subtracted from each request */
+    lat_row_t row[LAT_OPS][LAT_BANDS + 1]; /* all sizes, then each band */
+} lat_stats_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
+static int check_interval = 0; /* run mm_check every this many ops (-c), 0 = never */
+static int use_inline = 0; /* call mm_inline.h's fast path instead of mm_malloc and mm_free (-I) */
+static char *snapshot_prefix = NULL; /* write peak heap snapshots to <prefix>.<tracenum> (-S) */
+static char *timeline_prefix = NULL; /* write utilization timelines to <prefix>.<tracenum> (-U) */
+static int timeline_interval = TIMELINE_INTERVAL; /* ops between their samples (-u) */
+static char *fit_names[] = { "adaptive", "first", "next", "best" }; /* MM_FIT_xxx (-F) */
+static char *lat_op_names[] = { "malloc", "free", "realloc" }; /* by request type (-H) */
+static char *lat_band_names[] = { "all", "1-64", "65-512", "513-4K", "4K-64K", ">64K" };
+static double lat_pcts[] = { 0.5, 0.9, 0.99, 0.999 };
 static int errors = 0;  /* number of errs found when running student malloc */
+static mm_stats_t check_stats; /* mm.c's counters after check_trace's utilization run (-V) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -105,16 +243,25 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate the range shadow */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
-static void remove_range(range_t **ranges, char *lo);
+static void remove_range(range_t **ranges, char *lo, int size);
 static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void map_trace(trace_t *trace, FILE *tracefile, char *path);
 static void free_trace(trace_t *trace);
 
+/* These functions open and decode streamed traces */
+static stream_t *open_stream(char *tracedir, char *filename);
+static void start_stream(stream_t *s);
+static int next_chunk(stream_t *s, traceop_t **ops);
+static void stop_stream(stream_t *s);
+static void close_stream(stream_t *s);
+static void *decode_stream(void *arg);
+
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
@@ -122,11 +269,36 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static int peak_op(trace_t *trace);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, timeline_t *tl);
 static void eval_mm_speed(void *ptr);
+static int eval_stream_valid(stream_t *s, int tracenum, range_t **ranges, double *util,
+			     timeline_t *tl);
+static void timeline_start(timeline_t *tl, int tracenum);
+static void timeline_sample(timeline_t *tl, long op, long live);
+static void timeline_end(timeline_t *tl, long op, long live);
+static void check_trace(trace_t *trace, stream_t *stream, int tracenum,
+			range_t **ranges, stats_t *stats);
+static void check_parallel(int jobs, char **tracefiles, int num_tracefiles,
+			   stats_t *stats, mm_stats_t *checks,
+			   int shared, int fit_policy, int maint);
+static void check_worker(int worker, int jobs, char **tracefiles, int num_tracefiles,
+			 int fd, int shared, int fit_policy, int maint);
+static void init_mm(int shared, int fit_policy, int maint);
+static double time_runs(fsecs_test_funct f, void *argp, int runs, double *noise);
+static void eval_stream_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, stream_t *stream, lat_stats_t *lat);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printcheckstats(mm_stats_t *st);
+static void printlifetime(int n, stats_t *stats, lt_stats_t *lt_stats);
+static void printlatency(int n, stats_t *stats, lat_stats_t *lat_stats);
+static void printevents(int n, stats_t *stats, hw_stats_t *hw_stats);
+static void writeresults(char *path, int json, int n, char **tracefiles, stats_t *stats,
+			 double perfindex, int argc, char **argv);
+static int readbaseline(char *path, base_t **base);
+static int checkbaseline(char *path, int n, char **tracefiles, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -137,19 +309,41 @@ static void app_error(char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
-    char c;
+    int i, c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
+    stream_t *stream = NULL;   /* or streams it, if it is a streamed trace */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    lt_stats_t *lt_stats = NULL; /* lifetime predictor stats for each trace (-L) */
+    lat_stats_t *lat_stats = NULL; /* per-op latencies for each trace (-H) */
+    hw_stats_t *hw_stats = NULL; /* hardware event counts for each trace (-E) */
+    mm_stats_t *check_all = NULL; /* mm.c's counters from each -j worker's check (-V) */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    char *trace_dump = NULL; /* If set, dump mm.c event rings here (-T) */
+    int maint = 0;       /* If set, run mm.c's maintenance thread (-m) */
+    int lifetime = 0;    /* If set, evaluate mm.c's lifetime predictor (-L) */
+    int latency = 0;     /* If set, time each request of a timed replay (-H) */
+    int hwcount = 0;     /* If set, count hardware events over a timed replay (-E) */
+    int shared = 0;      /* If set, run mm.c on a shared memory heap (-P) */
+    int fit_policy = MM_FIT_ADAPTIVE; /* mm.c fit policy (-F) */
+    int jobs = 1;        /* Processes checking traces in parallel (-j) */
+    char *json_file = NULL; /* If set, write the results as JSON here (--json) */
+    char *csv_file = NULL;  /* If set, write the results as CSV here (--csv) */
+    char *baseline = NULL;  /* If set, compare the results with this run (--baseline) */
+    int runs = 1;        /* Timed runs of each trace */
+    static struct option long_opts[] = {
+	{ "json", required_argument, NULL, OPT_JSON },
+	{ "csv", required_argument, NULL, OPT_CSV },
+	{ "baseline", required_argument, NULL, OPT_BASELINE },
+	{ NULL, 0, NULL, 0 }
+    };
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +352,8 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt_long(argc, argv, "f:t:T:c:S:F:j:U:u:hvVgalmEHLPI",
+			    long_opts, NULL)) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,9 +373,66 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'c': /* Run the heap checker every N ops in eval_mm_valid */
+            check_interval = atoi(optarg);
+            if (check_interval < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'F': /* Pin mm.c's fit policy */
+            for (fit_policy = MM_FIT_BEST; fit_policy >= 0; fit_policy--)
+                if (!strcmp(optarg, fit_names[fit_policy]))
+                    break;
+            if (fit_policy < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'j': /* Check the traces in this many worker processes */
+            jobs = atoi(optarg);
+            if (jobs < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'S': /* Snapshot the heap at each trace's peak live payload */
+            snapshot_prefix = strdup(optarg);
+            break;
+        case 'U': /* Write each trace's utilization timeline */
+            timeline_prefix = strdup(optarg);
+            break;
+        case 'u': /* Sample the timelines every N ops */
+            timeline_interval = atoi(optarg);
+            if (timeline_interval < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'T': /* Dump the allocator's event rings (MM_TRACE=1 builds) */
+            trace_dump = strdup(optarg);
+            break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+        case 'm': /* Run the allocator's background maintenance thread */
+            maint = 1;
+            break;
+        case 'E': /* Count hardware events over one more replay */
+            hwcount = 1;
+            break;
+        case 'H': /* Histogram the latency of each request in one more replay */
+            latency = 1;
+            break;
+        case 'L': /* Compare mm.c with and without its lifetime predictor */
+            lifetime = 1;
+            break;
+        case 'P': /* Back mm.c's heap with shared memory and process-safe locking */
+            shared = 1;
+            break;
+        case 'I': /* Allocate through the inlined thread cache of mm_inline.h */
+            use_inline = 1;
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
@@ -190,6 +442,18 @@ int main(int argc, char **argv)
         case 'V': /* Be more verbose than -v */
             verbose = 2;
             break;
+        case OPT_JSON: /* Write the results as JSON */
+            json_file = strdup(optarg);
+            runs = REPORT_RUNS;
+            break;
+        case OPT_CSV: /* Write the results as CSV */
+            csv_file = strdup(optarg);
+            runs = REPORT_RUNS;
+            break;
+        case OPT_BASELINE: /* Compare the results with a stored --json or --csv run */
+            baseline = strdup(optarg);
+            runs = REPORT_RUNS;
+            break;
         case 'h': /* Print this message */
 	    usage();
             exit(0);
@@ -238,6 +502,11 @@ int main(int argc, char **argv)
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Pick the payload fill and check kernels for this CPU */
+    pattern_init();
+    if (verbose > 1)
+	printf("Checking payloads with %s kernels.\n", pattern_kernel());
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -252,6 +521,10 @@ int main(int argc, char **argv)
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
+	    if ((stream = open_stream(tracedir, tracefiles[i])) != NULL) {
+		close_stream(stream); /* mm malloc only */
+		continue;
+	    }
 	    trace = read_trace(tracedir, tracefiles[i]);
 	    libc_stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
@@ -283,36 +556,113 @@ int main(int argc, char **argv)
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
+    if (lifetime && (lt_stats = (lt_stats_t *)calloc(num_tracefiles, sizeof(lt_stats_t))) == NULL)
+	unix_error("lt_stats calloc in main failed");
+    if (latency && (lat_stats = (lat_stats_t *)calloc(num_tracefiles, sizeof(lat_stats_t))) == NULL)
+	unix_error("lat_stats calloc in main failed");
+    if (jobs > 1 && (check_all = (mm_stats_t *)calloc(num_tracefiles, sizeof(mm_stats_t))) == NULL)
+	unix_error("check_all calloc in main failed");
+    if (hwcount && perfctr_open() == 0) {
+	printf("Not counting hardware events (%s).\n", perfctr_error());
+	hwcount = 0;
+    }
+    if (hwcount && (hw_stats = (hw_stats_t *)calloc(num_tracefiles, sizeof(hw_stats_t))) == NULL)
+	unix_error("hw_stats calloc in main failed");
     
+    /* With -j, check all the traces in worker processes first */
+    if (jobs > 1)
+	check_parallel(jobs, tracefiles, num_tracefiles, mm_stats, check_all,
+		       shared, fit_policy, maint);
+
     /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
+    init_mm(shared, fit_policy, maint);
 
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
+	/* A streamed trace gets one checking pass and the timed runs */
+	if ((stream = open_stream(tracedir, tracefiles[i])) != NULL) {
+	    if (jobs <= 1)
+		check_trace(NULL, stream, i, &ranges, &mm_stats[i]);
+	    if (mm_stats[i].valid) {
+		if (verbose > 1)
+		    printf(jobs > 1 ? "Timing mm_malloc.\n" : "and performance.\n");
+		mm_stats[i].secs = time_runs(eval_stream_speed, stream, runs,
+					     &mm_stats[i].noise);
+		if (latency)
+		    eval_mm_latency(NULL, stream, &lat_stats[i]);
+		if (hwcount) {
+		    perfctr_start();
+		    eval_stream_speed(stream);
+		    perfctr_stop(hw_stats[i].counts);
+		}
+	    }
+	    close_stream(stream);
+	    continue;
+	}
 	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	if (jobs <= 1)
+	    check_trace(trace, NULL, i, &ranges, &mm_stats[i]);
 	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+		printf(jobs > 1 ? "Timing mm_malloc.\n" : "and performance.\n");
+	    if (verbose > 1)
+		printcheckstats(jobs > 1 ? &check_all[i] : &check_stats);
+	    mm_stats[i].secs = time_runs(eval_mm_speed, &speed_params, runs,
+					 &mm_stats[i].noise);
+	    if (latency)
+		eval_mm_latency(trace, NULL, &lat_stats[i]);
+	    if (hwcount) {
+		perfctr_start();
+		eval_mm_speed(&speed_params);
+		perfctr_stop(hw_stats[i].counts);
+	    }
+
+	    /* Rerun with the predictor: checked, then cold, then warm from that run */
+	    if (lifetime) {
+		mm_set_lifetime(1);
+		if (verbose > 1)
+		    printf("Checking mm_malloc with the lifetime predictor.\n");
+		if (!eval_mm_valid(trace, i, &ranges))
+		    mm_stats[i].valid = 0;
+		else {
+		    mm_reset_lifetime(); /* forget what the check taught it */
+		    lt_stats[i].util_cold = eval_mm_util(trace, i, &ranges, NULL);
+		    lt_stats[i].util_warm = eval_mm_util(trace, i, &ranges, NULL);
+		    lt_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+		}
+		mm_set_lifetime(0);
+	    }
 	}
 	free_trace(trace);
     }
 
+    if (maint)
+	mm_maint_stop();
+
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (lifetime) {
+	printf("Lifetime predictor:\n");
+	printlifetime(num_tracefiles, mm_stats, lt_stats);
+	printf("\n");
+    }
+    if (latency) {
+	printf("Request latency (%s):\n", LH_UNIT);
+	printlatency(num_tracefiles, mm_stats, lat_stats);
+	printf("\n");
+    }
+    if (hwcount) {
+	perfctr_close();
+	printf("Hardware events per request:\n");
+	printevents(num_tracefiles, mm_stats, hw_stats);
+	printf("\n");
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -362,27 +712,86 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    if (trace_dump != NULL) {
+	if (!MM_TRACE)
+	    printf("Warning: mm.c was built without MM_TRACE=1, no events recorded\n");
+	if (mm_trace_dump(trace_dump) < 0)
+	    unix_error("mm_trace_dump failed");
+    }
+
+    if (json_file != NULL)
+	writeresults(json_file, 1, num_tracefiles, tracefiles, mm_stats,
+		     perfindex, argc, argv);
+    if (csv_file != NULL)
+	writeresults(csv_file, 0, num_tracefiles, tracefiles, mm_stats,
+		     perfindex, argc, argv);
+    if (baseline != NULL && checkbaseline(baseline, num_tracefiles, tracefiles, mm_stats) > 0)
+	exit(2);
+
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range shadow, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * shadow to detect any overlapping allocated blocks.
  ****************************************************************/
 
+/*
+ * shadow_find - Return the first set bit of bits in [first, last],
+ *     or -1 if there is none
+ */
+static long shadow_find(unsigned long *bits, unsigned long first, unsigned long last)
+{
+    unsigned long w, word, mask;
+
+    for (w = first / WORD_BITS; w <= last / WORD_BITS; w++) {
+	mask = ~0UL;
+	if (w == first / WORD_BITS)
+	    mask &= ~0UL << (first % WORD_BITS);
+	if (w == last / WORD_BITS && last % WORD_BITS != WORD_BITS - 1)
+	    mask &= (1UL << (last % WORD_BITS + 1)) - 1;
+	if ((word = bits[w] & mask) != 0)
+	    return w * WORD_BITS + __builtin_ctzl(word);
+    }
+    return -1;
+}
+
+/*
+ * shadow_fill - Set (on) or clear the bits of bits in [first, last]
+ */
+static void shadow_fill(unsigned long *bits, unsigned long first, unsigned long last, int on)
+{
+    unsigned long w, mask;
+
+    for (w = first / WORD_BITS; w <= last / WORD_BITS; w++) {
+	mask = ~0UL;
+	if (w == first / WORD_BITS)
+	    mask &= ~0UL << (first % WORD_BITS);
+	if (w == last / WORD_BITS && last % WORD_BITS != WORD_BITS - 1)
+	    mask &= (1UL << (last % WORD_BITS + 1)) - 1;
+	if (on)
+	    bits[w] |= mask;
+	else
+	    bits[w] &= ~mask;
+    }
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we set its bits in the shadow. Payloads start ALIGNMENT-aligned,
+ *     so two of them overlap exactly when they share a shadow bit.
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *r = *ranges;
+    unsigned long first, last;
+    long hit;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -405,62 +814,52 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    first = (lo - (char *)mem_heap_lo()) / ALIGNMENT;
+    last = (hi - (char *)mem_heap_lo()) / ALIGNMENT;
+    if ((hit = shadow_find(r->bits, first, last)) >= 0) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload at %p\n",
+		lo, hi, (char *)mem_heap_lo() + hit * ALIGNMENT);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
-    /* 
-     * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
-     */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
-    p->lo = lo;
-    p->hi = hi;
-    *ranges = p;
+    /* Everything looks OK, so remember the extent of this block */
+    shadow_fill(r->bits, first, last, 1);
+    if (last / WORD_BITS >= r->used)
+	r->used = last / WORD_BITS + 1;
     return 1;
 }
 
 /* 
- * remove_range - Free the range record of block whose payload starts at lo 
+ * remove_range - Clear the shadow of the size-byte payload at lo 
  */
-static void remove_range(range_t **ranges, char *lo)
+static void remove_range(range_t **ranges, char *lo, int size)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    int size;
+    unsigned long first = (lo - (char *)mem_heap_lo()) / ALIGNMENT;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    if (size > 0)
+	shadow_fill((*ranges)->bits, first, first + (size - 1) / ALIGNMENT, 0);
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - clear the shadow for a new trace, mapping it on first
+ *     use. Its pages are only touched where payloads have been.
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    range_t *r = *ranges;
+
+    if (r == NULL) {
+	if ((r = (range_t *)calloc(1, sizeof(range_t))) == NULL)
+	    unix_error("calloc error in clear_ranges");
+	r->bits = (unsigned long *)mmap(NULL, SHADOW_BITS / 8, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r->bits == MAP_FAILED)
+	    unix_error("mmap error in clear_ranges");
+	*ranges = r;
     }
-    *ranges = NULL;
+    memset(r->bits, 0, r->used * sizeof(unsigned long));
+    r->used = 0;
 }
 
 
@@ -469,7 +868,9 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. Either a .rep
+ *              text file or a binary trace (mmbtrace.h), told apart by
+ *              the binary magic number.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -480,6 +881,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
+    uint32_t magic;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -495,15 +897,23 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+
+    /* A binary trace is mapped and replayed in place, not parsed */
+    if (fread(&magic, sizeof(magic), 1, tracefile) == 1 && magic == MMBT_MAGIC)
+	map_trace(trace, tracefile, path);
+    else {
+	rewind(tracefile);
+	trace->map = NULL;
+	fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+	fscanf(tracefile, "%d", &(trace->num_ids));     
+	fscanf(tracefile, "%d", &(trace->num_ops));     
+	fscanf(tracefile, "%d", &(trace->weight));        /* not used */
     
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
+	/* We'll store each request line in the trace in this array */
+	if ((trace->ops = 
+	     (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc 2 failed in read_trace");
+    }
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks = 
@@ -514,6 +924,11 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+
+    if (trace->map != NULL) {
+	fclose(tracefile);
+	return trace;
+    }
     
     /* read every request line in the trace file */
     index = 0;
@@ -538,6 +953,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = 0;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
@@ -554,18 +970,286 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * map_trace - mmap the binary trace open as tracefile, check its header
+ *             and ops and point the trace's ops at the op array in the
+ *             mapping
+ */
+static void map_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    struct stat st;
+    mmbt_hdr_t *hdr;
+    traceop_t *op;
+    int i;
+
+    if (fstat(fileno(tracefile), &st) < 0) {
+	sprintf(msg, "Could not stat %s in read_trace", path);
+	unix_error(msg);
+    }
+    if ((size_t)st.st_size < sizeof(mmbt_hdr_t)) {
+	sprintf(msg, "%s is too short to be a binary trace", path);
+	app_error(msg);
+    }
+    trace->map_len = st.st_size;
+    if ((trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE,
+			   fileno(tracefile), 0)) == MAP_FAILED) {
+	sprintf(msg, "Could not mmap %s in read_trace", path);
+	unix_error(msg);
+    }
+    madvise(trace->map, trace->map_len, MADV_WILLNEED);
+
+    hdr = (mmbt_hdr_t *)trace->map;
+    if (hdr->version != MMBT_VERSION || hdr->op_size != sizeof(traceop_t) ||
+	hdr->hdr_size < sizeof(mmbt_hdr_t) || hdr->hdr_size % sizeof(int32_t) != 0 ||
+	hdr->hdr_size > trace->map_len || hdr->num_ids < 0 || hdr->num_ops < 0) {
+	sprintf(msg, "%s is not a version %d binary trace", path, MMBT_VERSION);
+	app_error(msg);
+    }
+    if ((size_t)hdr->num_ops > (trace->map_len - hdr->hdr_size) / sizeof(traceop_t)) {
+	sprintf(msg, "%s is truncated: %d ops in the header", path, hdr->num_ops);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(trace->map + hdr->hdr_size);
+
+    /* The ops index the block tables directly, so check every one */
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	if (op->index < 0 || op->index >= trace->num_ids || op->size < 0 ||
+	    (op->type != ALLOC && op->type != FREE && op->type != REALLOC)) {
+	    sprintf(msg, "%s: op %d (type %d, id %d, size %d) is not valid with %d ids",
+		    path, i, op->type, op->index, op->size, trace->num_ids);
+	    app_error(msg);
+	}
+    }
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(), or
+ *              unmap the ops of a binary trace.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)
+	munmap(trace->map, trace->map_len);
+    else
+	free(trace->ops);     /* free the three arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
 }
 
+/*
+ * open_stream - open a trace file if it is a streamed trace, with the
+ *               block tables for its slots. Returns NULL if it is not
+ *               one, and it is read with read_trace() instead.
+ */
+static stream_t *open_stream(char *tracedir, char *filename)
+{
+    stream_t *s;
+    FILE *file;
+    uint32_t magic;
+    int i;
+
+    if ((s = (stream_t *)calloc(1, sizeof(stream_t))) == NULL)
+	unix_error("calloc failed in open_stream");
+    if ((s->path = (char *)malloc(strlen(tracedir) + strlen(filename) + 1)) == NULL)
+	unix_error("malloc failed in open_stream");
+    strcpy(s->path, tracedir);
+    strcat(s->path, filename);
+    if ((file = fopen(s->path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in open_stream", s->path);
+	unix_error(msg);
+    }
+    if (fread(&magic, sizeof(magic), 1, file) != 1 || magic != MMBS_MAGIC) {
+	fclose(file);
+	free(s->path);
+	free(s);
+	return NULL;
+    }
+    rewind(file);
+    s->file = file;
+    if (fread(&s->hdr, sizeof(s->hdr), 1, file) != 1 ||
+	s->hdr.version != MMBS_VERSION || s->hdr.hdr_size < sizeof(s->hdr)) {
+	sprintf(msg, "%s is not a version %d streamed trace", s->path, MMBS_VERSION);
+	app_error(msg);
+    }
+    if (verbose > 1)
+	printf("Streaming tracefile: %s\n", filename);
+
+    if ((s->blocks = (char **)calloc(s->hdr.num_slots, sizeof(char *))) == NULL ||
+	(s->block_sizes = (size_t *)calloc(s->hdr.num_slots, sizeof(size_t))) == NULL ||
+	(s->live = (unsigned long *)calloc(s->hdr.num_slots / WORD_BITS + 1,
+					   sizeof(unsigned long))) == NULL)
+	unix_error("calloc failed in open_stream");
+    for (i = 0; i < STREAM_NBUF; i++)
+	if ((s->chunk[i] = (traceop_t *)malloc(STREAM_CHUNK * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc failed in open_stream");
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    return s;
+}
+
+/*
+ * start_stream - rewind a streamed trace and start a decoder thread on it
+ */
+static void start_stream(stream_t *s)
+{
+    if (fseek(s->file, s->hdr.hdr_size, SEEK_SET) != 0) {
+	sprintf(msg, "Could not seek in %s", s->path);
+	unix_error(msg);
+    }
+    s->decoded = s->replayed = 0;
+    s->taken = s->done = s->stop = 0;
+    memset(s->live, 0, (s->hdr.num_slots / WORD_BITS + 1) * sizeof(unsigned long));
+    if (pthread_create(&s->decoder, NULL, decode_stream, s) != 0)
+	unix_error("pthread_create failed in start_stream");
+}
+
+/*
+ * next_chunk - give back the chunk the replay last took and take the
+ *              next one, waiting for the decoder if need be. Returns its
+ *              number of ops, or 0 at the end of the trace.
+ */
+static int next_chunk(stream_t *s, traceop_t **ops)
+{
+    int n = 0, done;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->taken) {
+	s->replayed++;
+	s->taken = 0;
+	pthread_cond_broadcast(&s->cond);
+    }
+    while (s->replayed == s->decoded && !s->done)
+	pthread_cond_wait(&s->cond, &s->lock);
+    if (s->replayed < s->decoded) {
+	*ops = s->chunk[s->replayed % STREAM_NBUF];
+	n = s->chunk_ops[s->replayed % STREAM_NBUF];
+	s->taken = 1;
+    }
+    done = s->done;
+    pthread_mutex_unlock(&s->lock);
+
+    if (n == 0 && done < 0) {
+	sprintf(msg, "%.800s: %s", s->path, s->error);
+	app_error(msg);
+    }
+    return n;
+}
+
+/*
+ * stop_stream - stop the decoder thread, whether or not it is done
+ */
+static void stop_stream(stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->decoder, NULL);
+}
+
+/*
+ * close_stream - close a streamed trace and free what open_stream()
+ *                allocated
+ */
+static void close_stream(stream_t *s)
+{
+    int i;
+
+    fclose(s->file);
+    for (i = 0; i < STREAM_NBUF; i++)
+	free(s->chunk[i]);
+    free(s->blocks);
+    free(s->block_sizes);
+    free(s->live);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s->path);
+    free(s);
+}
+
+/*
+ * decode_stream - body of the decoder thread: decode chunks of ops
+ *                 into the free slots of the ring until the end of the
+ *                 trace, checking each op's slot and the op count, and
+ *                 that ops free and reallocate only allocated slots and
+ *                 allocate only free ones, so the replay can index its
+ *                 block table without checks of its own
+ */
+static void *decode_stream(void *arg)
+{
+    stream_t *s = (stream_t *)arg;
+    size_t pos = 0, len = 0;
+    uint64_t total = 0;
+    int32_t prev = 0;
+    traceop_t *ops;
+    unsigned long *word, bit;
+    int n, k, stop, done = 0;
+    char error[128] = "truncated or corrupt";
+
+    while (!done) {
+	pthread_mutex_lock(&s->lock);
+	while (s->decoded - s->replayed == STREAM_NBUF && !s->stop)
+	    pthread_cond_wait(&s->cond, &s->lock);
+	stop = s->stop;
+	pthread_mutex_unlock(&s->lock);
+	if (stop)
+	    break;
+
+	/* The ring slot is ours until we hand it over */
+	ops = s->chunk[s->decoded % STREAM_NBUF];
+	for (n = 0; n < STREAM_CHUNK; n++) {
+	    if (len - pos < MMBS_OP_MAX) {
+		memmove(s->in, s->in + pos, len - pos);
+		len -= pos;
+		pos = 0;
+		len += fread(s->in + len, 1, STREAM_INBUF - len, s->file);
+	    }
+	    if (pos == len) {
+		done = total == s->hdr.num_ops ? 1 : -1;
+		break;
+	    }
+	    k = mmbs_decode(s->in + pos, s->in + len, &ops[n], &prev);
+	    if (k == 0 || (uint32_t)ops[n].index >= s->hdr.num_slots ||
+		++total > s->hdr.num_ops) {
+		done = -1;
+		break;
+	    }
+	    word = &s->live[ops[n].index / WORD_BITS];
+	    bit = 1UL << (ops[n].index % WORD_BITS);
+	    if ((ops[n].type == ALLOC) == ((*word & bit) != 0)) {
+		sprintf(error, "op %llu %s slot %d, which is %s",
+			(unsigned long long)total - 1,
+			ops[n].type == ALLOC ? "allocates" :
+			ops[n].type == FREE ? "frees" : "reallocates",
+			ops[n].index, *word & bit ? "allocated" : "not allocated");
+		done = -1;
+		break;
+	    }
+	    *word ^= ops[n].type == REALLOC ? 0 : bit;
+	    pos += k;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	if (n > 0) {
+	    s->chunk_ops[s->decoded % STREAM_NBUF] = n;
+	    s->decoded++;
+	}
+	if (done < 0)
+	    strcpy(s->error, error);
+	s->done = done;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
@@ -576,15 +1260,17 @@ void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i, j;
+    int i;
+    long bad;
     int index;
     int size;
     int oldsize;
     char *newp;
     char *oldp;
     char *p;
+    int snap_op = -1;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and clear the range shadow */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -594,6 +1280,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	return 0;
     }
 
+    /* With -S, snapshot the heap right after the op that peaks live payload */
+    if (snapshot_prefix != NULL)
+	snap_op = peak_op(trace);
+
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
 	index = trace->ops[i].index;
@@ -604,25 +1294,26 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    p = use_inline ? mm_malloc_inline(size) : mm_malloc(size);
+	    if (p == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range shadow if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
+	     * fill range with the pattern of index.  This will be used later
 	     * if we realloc the block and wish to make sure that the old
 	     * data was copied to the new block
 	     */
-	    memset(p, index & 0xFF, size);
+	    pattern_fill(p, index, 0, size);
 
 	    /* Remember region */
 	    trace->blocks[index] = p;
@@ -638,28 +1329,27 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
-	    remove_range(ranges, oldp);
+	    /* Remove the old region from the range shadow */
+	    remove_range(ranges, oldp, trace->block_sizes[index]);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range shadow */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
 	     * Make sure that the new block contains the data from the old 
-	     * block and then fill in the new block with the low order byte
-	     * of the new index
+	     * block and then fill in the rest of the new block with the
+	     * pattern of the index
 	     */
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
-	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
-		malloc_error(tracenum, i, "mm_realloc did not preserve the "
-			     "data from old block");
+	    if ((bad = pattern_check(newp, index, oldsize)) >= 0) {
+		sprintf(msg, "mm_realloc did not preserve the data from old "
+			"block (byte %ld)", bad);
+		malloc_error(tracenum, i, msg);
 		return 0;
-	      }
 	    }
-	    memset(newp, index & 0xFF, size);
+	    pattern_fill(newp, index, oldsize, size);
 
 	    /* Remember region */
 	    trace->blocks[index] = newp;
@@ -668,22 +1358,70 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case FREE: /* mm_free */
 	    
-	    /* Remove region from list and call student's free function */
+	    /* Remove region from shadow and call student's free function */
 	    p = trace->blocks[index];
-	    remove_range(ranges, p);
-	    mm_free(p);
+	    remove_range(ranges, p, trace->block_sizes[index]);
+	    if (use_inline)
+		mm_free_inline(p, trace->block_sizes[index]);
+	    else
+		mm_free(p);
 	    break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Optionally check heap consistency (-c) */
+	if (check_interval > 0 && 
+	    ((i+1) % check_interval == 0 || i == trace->num_ops - 1) &&
+	    mm_check() < 0) {
+	    malloc_error(tracenum, i, "mm_check found an inconsistent heap");
+	    return 0;
+	}
+
+	if (i == snap_op) {
+	    char path[MAXLINE];
+	    sprintf(path, "%s.%d", snapshot_prefix, tracenum);
+	    if (mm_snapshot(path) < 0)
+		unix_error("mm_snapshot failed");
+	}
     }
 
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
 
+/*
+ * peak_op - Return the index of the first op after which the total
+ *     payload of the live blocks in the trace is at its maximum
+ */
+static int peak_op(trace_t *trace)
+{
+    int i, peak = 0;
+    long total = 0, max_total = -1;
+    int *sizes;
+
+    if ((sizes = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("calloc failed in peak_op");
+    for (i = 0;  i < trace->num_ops;  i++) {
+	int index = trace->ops[i].index;
+	if (trace->ops[i].type == FREE) {
+	    total -= sizes[index];
+	    sizes[index] = 0;
+	}
+	else {
+	    total += trace->ops[i].size - sizes[index];
+	    sizes[index] = trace->ops[i].size;
+	}
+	if (total > max_total) {
+	    max_total = total;
+	    peak = i;
+	}
+    }
+    free(sizes);
+    return peak;
+}
+
 /* 
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for 
@@ -695,7 +1433,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   is always the high water mark of the heap. 
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, timeline_t *tl)
 {   
     int i;
     int index;
@@ -717,7 +1455,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    p = use_inline ? mm_malloc_inline(size) : mm_malloc(size);
+	    if (p == NULL)
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -760,7 +1499,10 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    if (use_inline)
+		mm_free_inline(p, size);
+	    else
+		mm_free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -772,7 +1514,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	/* Optionally sample the utilization timeline (-U) */
+	if (tl != NULL && (i+1) % timeline_interval == 0)
+	    timeline_sample(tl, i+1, total_size);
     }
+    if (tl != NULL)
+	timeline_end(tl, trace->num_ops, total_size);
 
     return ((double)max_total_size / (double)mem_heapsize());
 }
@@ -800,9 +1548,11 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            p = use_inline ? mm_malloc_inline(size) : mm_malloc(size);
+            if (p == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
             break;
 
 	case REALLOC: /* mm_realloc */
@@ -812,12 +1562,16 @@ static void eval_mm_speed(void *ptr)
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
             break;
 
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            if (use_inline)
+                mm_free_inline(block, trace->block_sizes[index]);
+            else
+                mm_free(block);
             break;
 
 	default:
@@ -825,6 +1579,511 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_stream_valid - Check the mm malloc package for correctness on a
+ *    streamed trace, as eval_mm_valid does, and measure its space
+ *    utilization, as eval_mm_util does, in the same single pass.
+ */
+static int eval_stream_valid(stream_t *s, int tracenum, range_t **ranges, double *util,
+			     timeline_t *tl)
+{
+    traceop_t *ops;
+    long i = 0, bad;
+    int n, k;
+    int index, size, oldsize;
+    long total_size = 0, max_total_size = 0;
+    char *p, *newp, *oldp;
+
+    /* Reset the heap and clear the range shadow */
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+
+    start_stream(s);
+    while ((n = next_chunk(s, &ops)) > 0) {
+	for (k = 0; k < n; k++, i++) {
+	    index = ops[k].index;
+	    size = ops[k].size;
+
+	    switch (ops[k].type) {
+
+	    case ALLOC: /* mm_malloc */
+		p = use_inline ? mm_malloc_inline(size) : mm_malloc(size);
+		if (p == NULL) {
+		    malloc_error(tracenum, i, "mm_malloc failed.");
+		    goto failed;
+		}
+		if (add_range(ranges, p, size, tracenum, i) == 0)
+		    goto failed;
+		pattern_fill(p, index, 0, size);
+		s->blocks[index] = p;
+		s->block_sizes[index] = size;
+		total_size += size;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		oldp = s->blocks[index];
+		if ((newp = mm_realloc(oldp, size)) == NULL) {
+		    malloc_error(tracenum, i, "mm_realloc failed.");
+		    goto failed;
+		}
+		remove_range(ranges, oldp, s->block_sizes[index]);
+		if (add_range(ranges, newp, size, tracenum, i) == 0)
+		    goto failed;
+		oldsize = s->block_sizes[index];
+		total_size += size - oldsize;
+		if (size < oldsize) oldsize = size;
+		if ((bad = pattern_check(newp, index, oldsize)) >= 0) {
+		    sprintf(msg, "mm_realloc did not preserve the data from old "
+			    "block (byte %ld)", bad);
+		    malloc_error(tracenum, i, msg);
+		    goto failed;
+		}
+		pattern_fill(newp, index, oldsize, size);
+		s->blocks[index] = newp;
+		s->block_sizes[index] = size;
+		break;
+
+	    case FREE: /* mm_free */
+		p = s->blocks[index];
+		remove_range(ranges, p, s->block_sizes[index]);
+		if (use_inline)
+		    mm_free_inline(p, s->block_sizes[index]);
+		else
+		    mm_free(p);
+		total_size -= s->block_sizes[index];
+		break;
+	    }
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+
+	    /* Optionally sample the utilization timeline (-U) */
+	    if (tl != NULL && (i+1) % timeline_interval == 0)
+		timeline_sample(tl, i+1, total_size);
+
+	    /* Optionally check heap consistency (-c) */
+	    if (check_interval > 0 && (i+1) % check_interval == 0 && mm_check() < 0) {
+		malloc_error(tracenum, i, "mm_check found an inconsistent heap");
+		goto failed;
+	    }
+	}
+    }
+    stop_stream(s);
+
+    if (check_interval > 0 && mm_check() < 0) {
+	malloc_error(tracenum, i, "mm_check found an inconsistent heap");
+	return 0;
+    }
+    if (tl != NULL)
+	timeline_end(tl, i, total_size);
+    *util = (double)max_total_size / (double)mem_heapsize();
+    return 1;
+
+ failed:
+    stop_stream(s);
+    return 0;
+}
+
+/*
+ * eval_stream_speed - The eval_mm_speed of a streamed trace, timed by
+ *    fcyc with the decoding running alongside on its own thread.
+ */
+static void eval_stream_speed(void *ptr)
+{
+    stream_t *s = (stream_t *)ptr;
+    traceop_t *ops;
+    int n, k, index, size;
+    char *p;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_stream_speed");
+
+    start_stream(s);
+    while ((n = next_chunk(s, &ops)) > 0)
+	for (k = 0; k < n; k++) {
+	    index = ops[k].index;
+	    size = ops[k].size;
+	    switch (ops[k].type) {
+	    case ALLOC: /* mm_malloc */
+		p = use_inline ? mm_malloc_inline(size) : mm_malloc(size);
+		if (p == NULL)
+		    app_error("mm_malloc error in eval_stream_speed");
+		s->blocks[index] = p;
+		s->block_sizes[index] = size;
+		break;
+	    case REALLOC: /* mm_realloc */
+		if ((p = mm_realloc(s->blocks[index], size)) == NULL)
+		    app_error("mm_realloc error in eval_stream_speed");
+		s->blocks[index] = p;
+		s->block_sizes[index] = size;
+		break;
+	    case FREE: /* mm_free */
+		if (use_inline)
+		    mm_free_inline(s->blocks[index], s->block_sizes[index]);
+		else
+		    mm_free(s->blocks[index]);
+		break;
+	    }
+	}
+    stop_stream(s);
+}
+
+/*
+ * lat_band - The size band of a request for size payload bytes
+ */
+static int lat_band(size_t size)
+{
+    if (size <= 64)
+	return 1;
+    if (size <= 512)
+	return 2;
+    if (size <= 4096)
+	return 3;
+    return size <= 65536 ? 4 : 5;
+}
+
+/*
+ * latency_ops - Replay n ops against blocks and block_sizes, timing each
+ *    request on its own and adding its latency less overhead to the
+ *    histogram of its type, both for all sizes and for its size band
+ */
+static void latency_ops(traceop_t *ops, int n, char **blocks, size_t *block_sizes,
+			lathist_t hist[LAT_OPS][LAT_BANDS + 1], uint64_t overhead)
+{
+    int k, index, size;
+    uint64_t t0, t1;
+    char *p;
+
+    for (k = 0; k < n; k++) {
+	index = ops[k].index;
+	size = ops[k].size;
+	switch (ops[k].type) {
+	case ALLOC: /* mm_malloc */
+	    t0 = lathist_now();
+	    p = use_inline ? mm_malloc_inline(size) : mm_malloc(size);
+	    t1 = lathist_now();
+	    if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+	    blocks[index] = p;
+	    block_sizes[index] = size;
+	    break;
+	case REALLOC: /* mm_realloc */
+	    t0 = lathist_now();
+	    p = mm_realloc(blocks[index], size);
+	    t1 = lathist_now();
+	    if (p == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+	    blocks[index] = p;
+	    block_sizes[index] = size;
+	    break;
+	case FREE: /* mm_free */
+	    size = block_sizes[index];
+	    t0 = lathist_now();
+	    if (use_inline)
+		mm_free_inline(blocks[index], size);
+	    else
+		mm_free(blocks[index]);
+	    t1 = lathist_now();
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	}
+	t1 = t1 - t0 > overhead ? t1 - t0 - overhead : 0;
+	lathist_add(&hist[ops[k].type][0], t1);
+	lathist_add(&hist[ops[k].type][lat_band(size)], t1);
+    }
+}
+
+/*
+ * eval_mm_latency - Replay a trace, or a streamed trace, once more with
+ *    each request timed by the cycle counter, after measuring what the
+ *    counter costs to read, and summarize the latencies into lat
+ */
+static void eval_mm_latency(trace_t *trace, stream_t *stream, lat_stats_t *lat)
+{
+    static lathist_t hist[LAT_OPS][LAT_BANDS + 1];
+    traceop_t *ops;
+    int n, op, band, k;
+
+    for (op = 0; op < LAT_OPS; op++)
+	for (band = 0; band <= LAT_BANDS; band++)
+	    lathist_reset(&hist[op][band]);
+    lat->overhead = lathist_overhead();
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_latency");
+    if (stream) {
+	start_stream(stream);
+	while ((n = next_chunk(stream, &ops)) > 0)
+	    latency_ops(ops, n, stream->blocks, stream->block_sizes, hist, lat->overhead);
+	stop_stream(stream);
+    }
+    else
+	latency_ops(trace->ops, trace->num_ops, trace->blocks, trace->block_sizes,
+		    hist, lat->overhead);
+
+    for (op = 0; op < LAT_OPS; op++)
+	for (band = 0; band <= LAT_BANDS; band++) {
+	    lat->row[op][band].count = hist[op][band].count;
+	    for (k = 0; k < LAT_NPCT; k++)
+		lat->row[op][band].pct[k] = lathist_percentile(&hist[op][band], lat_pcts[k]);
+	    lat->row[op][band].max = hist[op][band].max;
+	}
+}
+
+/*
+ * check_trace - Run the correctness and space utilization passes of
+ *    the mm malloc package on a trace, or a streamed trace, into stats
+ */
+static void check_trace(trace_t *trace, stream_t *stream, int tracenum,
+			range_t **ranges, stats_t *stats)
+{
+    timeline_t tl;
+
+    if (stream != NULL) {
+	stats->ops = stream->hdr.num_ops;
+	if (verbose > 1)
+	    printf("Checking mm_malloc for correctness and efficiency, ");
+	timeline_start(&tl, tracenum);
+	stats->valid = eval_stream_valid(stream, tracenum, ranges, &stats->util,
+					 tl.file ? &tl : NULL);
+	if (tl.file != NULL)
+	    fclose(tl.file);
+	return;
+    }
+
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	timeline_start(&tl, tracenum);
+	stats->util = eval_mm_util(trace, tracenum, ranges, tl.file ? &tl : NULL);
+	if (verbose > 1)
+	    mm_get_stats(&check_stats);
+    }
+}
+
+/*
+ * timeline_start - Open trace tracenum's utilization timeline at
+ *    <prefix>.<tracenum> if there is a -U prefix, and write its header
+ */
+static void timeline_start(timeline_t *tl, int tracenum)
+{
+    char path[MAXLINE];
+
+    tl->file = NULL;
+    tl->tracenum = tracenum;
+    tl->last = 0;
+    tl->phase_start = -1;
+    if (timeline_prefix == NULL)
+	return;
+    snprintf(path, sizeof(path), "%s.%d", timeline_prefix, tracenum);
+    if ((tl->file = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open timeline %.900s", path);
+	unix_error(msg);
+    }
+    fprintf(tl->file, "op,live,heap,free,largest_free,class_cached,util,frag,fit,fit_switches,fragmented\n");
+}
+
+/*
+ * timeline_sample - Write one sample after op ops, with live bytes of
+ *    payload: the heap size, its free bytes and largest free block,
+ *    utilization, fragmentation (the share of the free bytes outside
+ *    the largest free block) and the fit policy mm.c is using. Samples
+ *    that leave much of the heap free and scattered are marked
+ *    fragmented; a run of them is reported as a phase.
+ */
+static void timeline_sample(timeline_t *tl, long op, long live)
+{
+    mm_free_stats_t fs;
+    mm_stats_t st;
+    size_t heap = mem_heapsize();
+    double frag;
+    int fragmented;
+
+    mm_get_free_stats(&fs);
+    mm_get_stats(&st);
+    frag = fs.free_bytes ? 1.0 - (double)fs.largest_free / fs.free_bytes : 0;
+    fragmented = fs.free_bytes > TIMELINE_FREE * heap && frag > TIMELINE_FRAG;
+    fprintf(tl->file, "%ld,%ld,%lu,%lu,%lu,%lu,%.4f,%.4f,%s,%lu,%d\n",
+	    op, live, (unsigned long)heap, (unsigned long)fs.free_bytes,
+	    (unsigned long)fs.largest_free, (unsigned long)fs.class_bytes,
+	    heap ? (double)live / heap : 0, frag, fit_names[st.fit_policy],
+	    st.fit_switches, fragmented);
+    tl->last = op;
+
+    if (fragmented && tl->phase_start < 0) {
+	tl->phase_start = op;
+	tl->phase_worst = frag;
+    }
+    else if (fragmented && frag > tl->phase_worst)
+	tl->phase_worst = frag;
+    else if (!fragmented && tl->phase_start >= 0) {
+	printf("Trace %d fragmented over ops %ld-%ld (up to %.0f%% of free space scattered)\n",
+	       tl->tracenum, tl->phase_start, op, tl->phase_worst*100.0);
+	tl->phase_start = -1;
+    }
+}
+
+/*
+ * timeline_end - Sample the end of the trace, report a fragmented phase
+ *    it ends in and close the timeline
+ */
+static void timeline_end(timeline_t *tl, long op, long live)
+{
+    if (op > tl->last)
+	timeline_sample(tl, op, live);
+    if (tl->phase_start >= 0)
+	printf("Trace %d fragmented from op %ld to the end (up to %.0f%% of free space scattered)\n",
+	       tl->tracenum, tl->phase_start, tl->phase_worst*100.0);
+    fclose(tl->file);
+    tl->file = NULL;
+}
+
+/*
+ * check_parallel - Fork jobs workers, each with a heap of its own, to
+ *    check the traces round robin with check_trace, and collect their
+ *    stats, and mm.c's counters for -V in checks, from a pipe. The
+ *    timing runs are left to the caller, which makes them one at a
+ *    time once the workers have exited. A trace
+ *    whose worker dies before reporting it (say, a crash in mm.c)
+ *    counts as an error.
+ */
+static void check_parallel(int jobs, char **tracefiles, int num_tracefiles,
+			   stats_t *stats, mm_stats_t *checks,
+			   int shared, int fit_policy, int maint)
+{
+    int fds[2], w, i;
+    pid_t pid;
+    check_msg_t m;
+    char *checked;
+
+    if ((checked = (char *)calloc(num_tracefiles, 1)) == NULL)
+	unix_error("calloc failed in check_parallel");
+    fflush(stdout);
+    if (pipe(fds) < 0)
+	unix_error("pipe failed in check_parallel");
+    for (w = 0; w < jobs && w < num_tracefiles; w++) {
+	if ((pid = fork()) < 0)
+	    unix_error("fork failed in check_parallel");
+	if (pid == 0) {
+	    close(fds[0]);
+	    check_worker(w, jobs, tracefiles, num_tracefiles, fds[1],
+			 shared, fit_policy, maint);
+	}
+    }
+    close(fds[1]);
+
+    /* Messages are smaller than PIPE_BUF, so they arrive whole */
+    while (read(fds[0], &m, sizeof(m)) == sizeof(m)) {
+	stats[m.tracenum] = m.stats;
+	checks[m.tracenum] = m.check;
+	errors += m.errors;
+	checked[m.tracenum] = 1;
+    }
+    close(fds[0]);
+    while (wait(NULL) > 0)
+	;
+
+    for (i = 0; i < num_tracefiles; i++)
+	if (!checked[i]) {
+	    errors++;
+	    printf("ERROR [trace %d]: the worker checking it died\n", i);
+	}
+    free(checked);
+}
+
+/*
+ * check_worker - Body of a -j worker: set up its own heap, check every
+ *    jobs'th trace from the worker'th on and send each one's stats
+ *    down fd. Does not return.
+ */
+static void check_worker(int worker, int jobs, char **tracefiles, int num_tracefiles,
+			 int fd, int shared, int fit_policy, int maint)
+{
+    int i;
+    trace_t *trace;
+    stream_t *stream;
+    range_t *ranges = NULL;
+    check_msg_t m;
+
+    init_mm(shared, fit_policy, maint);
+    for (i = worker; i < num_tracefiles; i += jobs) {
+	memset(&m, 0, sizeof(m));
+	m.tracenum = i;
+	m.errors = errors;
+	if ((stream = open_stream(tracedir, tracefiles[i])) != NULL) {
+	    check_trace(NULL, stream, i, &ranges, &m.stats);
+	    close_stream(stream);
+	}
+	else {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    check_trace(trace, NULL, i, &ranges, &m.stats);
+	    free_trace(trace);
+	}
+	if (verbose > 1) {
+	    printf("\n");
+	    m.check = check_stats;
+	}
+	m.errors = errors - m.errors;
+	fflush(stdout);
+	if (write(fd, &m, sizeof(m)) != sizeof(m))
+	    unix_error("write failed in check_worker");
+    }
+    if (maint)
+	mm_maint_stop();
+    fflush(stdout);
+    _exit(0);
+}
+
+/*
+ * init_mm - Initialize the simulated memory system and mm.c's modes
+ *    for the runs this process makes
+ */
+static void init_mm(int shared, int fit_policy, int maint)
+{
+    if (!shared)
+	mem_init(); 
+    else if (mem_init_shared(NULL) < 0)
+	unix_error("mem_init_shared failed");
+    mm_set_fit_policy(fit_policy);
+    if (maint && mm_maint_start() < 0)
+	unix_error("mm_maint_start failed");
+}
+
+/*
+ * time_runs - Time f(argp) with fsecs runs times; return the median
+ *    and store the relative standard deviation of the runs in noise
+ */
+static double time_runs(fsecs_test_funct f, void *argp, int runs, double *noise)
+{
+    double t[REPORT_RUNS], tmp, mean = 0, var = 0;
+    int i, j;
+
+    for (i = 0; i < runs; i++) {
+	t[i] = fsecs(f, argp);
+	mean += t[i];
+	for (j = i; j > 0 && t[j-1] > t[j]; j--) {
+	    tmp = t[j];
+	    t[j] = t[j-1];
+	    t[j-1] = tmp;
+	}
+    }
+    mean /= runs;
+    for (i = 0; i < runs; i++)
+	var += (t[i] - mean) * (t[i] - mean);
+    *noise = runs > 1 ? sqrt(var / (runs - 1)) / mean : 0;
+    return runs % 2 ? t[runs / 2] : (t[runs / 2 - 1] + t[runs / 2]) / 2;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -999,19 +2258,536 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * printcheckstats - prints what mm_realloc did and the fit policy mm.c
+ *     settled on while a trace was checked
+ */
+static void printcheckstats(mm_stats_t *st)
+{
+    if (st->reallocs)
+	printf("  realloc: %lu in place, %lu slid, %lu moved, %llu bytes copied\n",
+	       st->realloc_inplace, st->realloc_slid, st->realloc_moved, st->realloc_copied);
+    printf("  fit: %s after %lu switches in %lu epochs\n",
+	   fit_names[st->fit_policy], st->fit_switches, st->fit_epochs);
+}
+
+/* 
+ * printlifetime - prints the space utilization of each trace without the
+ *     lifetime predictor, with a cold one and with one trained on a previous
+ *     run, and the throughput it costs
+ */
+static void printlifetime(int n, stats_t *stats, lt_stats_t *lt_stats)
+{
+    int i, nvalid = 0;
+    double util = 0, cold = 0, warm = 0, secs = 0, lt_secs = 0, ops = 0;
+
+    printf("%5s%6s%6s%6s%8s%8s%7s\n",
+	   "trace", "off", "cold", "warm", "Kops", "Kops on", "cost");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	printf("%2d%8.0f%%%5.0f%%%5.0f%%%8.0f%8.0f%6.1f%%\n",
+	       i,
+	       stats[i].util*100.0,
+	       lt_stats[i].util_cold*100.0,
+	       lt_stats[i].util_warm*100.0,
+	       (stats[i].ops/1e3)/stats[i].secs,
+	       (stats[i].ops/1e3)/lt_stats[i].secs,
+	       (lt_stats[i].secs/stats[i].secs - 1.0)*100.0);
+	nvalid++;
+	util += stats[i].util;
+	cold += lt_stats[i].util_cold;
+	warm += lt_stats[i].util_warm;
+	secs += stats[i].secs;
+	lt_secs += lt_stats[i].secs;
+	ops += stats[i].ops;
+    }
+    if (nvalid > 0)
+	printf("%5s%5.0f%%%5.0f%%%5.0f%%%8.0f%8.0f%6.1f%%\n",
+	       "Total",
+	       (util/nvalid)*100.0,
+	       (cold/nvalid)*100.0,
+	       (warm/nvalid)*100.0,
+	       (ops/1e3)/secs,
+	       (ops/1e3)/lt_secs,
+	       (lt_secs/secs - 1.0)*100.0);
+}
+
+/*
+ * printlatency - prints, for each valid trace, the latency percentiles of
+ *     each request type over all sizes and in each size band that has
+ *     requests, and the timer overhead taken off them
+ */
+static void printlatency(int n, stats_t *stats, lat_stats_t *lat_stats)
+{
+    int i, op, band, k;
+    lat_row_t *row;
+
+    printf("%5s%8s%8s%9s%8s%8s%8s%8s%9s\n",
+	   "trace", "op", "size", "count", "p50", "p90", "p99", "p999", "max");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	for (op = 0; op < LAT_OPS; op++)
+	    for (band = 0; band <= LAT_BANDS; band++) {
+		row = &lat_stats[i].row[op][band];
+		if (row->count == 0)
+		    continue;
+		printf("%2d%11s%8s%9lu", i, lat_op_names[op],
+		       lat_band_names[band], row->count);
+		for (k = 0; k < LAT_NPCT; k++)
+		    printf("%8llu", (unsigned long long)row->pct[k]);
+		printf("%9llu\n", (unsigned long long)row->max);
+	    }
+	printf("%2d%11s%8s%9s%8llu\n", i, "timer", "", "",
+	       (unsigned long long)lat_stats[i].overhead);
+    }
+}
+
+/*
+ * printevent - prints count per op in a column width wide, or "-" for
+ *     an event that was not counted
+ */
+static void printevent(double count, double ops, int width, int prec)
+{
+    if (count < 0)
+	printf("%*s", width, "-");
+    else
+	printf("%*.*f", width, prec, count / ops);
+}
+
+/*
+ * printevents - prints, for each valid trace and over all of them, the
+ *     hardware events of one run per request, and instructions per cycle
+ */
+static void printevents(int n, stats_t *stats, hw_stats_t *hw_stats)
+{
+    int i, e;
+    double ops = 0, total[PC_NEVENTS] = { 0 };
+    double *c;
+
+    printf("%5s%9s%9s%6s%9s%8s%8s%8s\n",
+	   "trace", "cycles", "instrs", "IPC", "br-miss", "L1D", "LLC", "dTLB");
+    for (i=0; i <= n; i++) {
+	if (i < n) {
+	    if (!stats[i].valid)
+		continue;
+	    c = hw_stats[i].counts;
+	    printf("%2d   ", i);
+	    ops += stats[i].ops;
+	    for (e = 0; e < PC_NEVENTS; e++)
+		total[e] = (c[e] < 0 || total[e] < 0) ? -1 : total[e] + c[e];
+	}
+	else {
+	    if (ops == 0)
+		break;
+	    c = total;
+	    printf("%5s", "Total");
+	}
+	printevent(c[PC_CYCLES], i < n ? stats[i].ops : ops, 9, 1);
+	printevent(c[PC_INSTRUCTIONS], i < n ? stats[i].ops : ops, 9, 1);
+	if (c[PC_CYCLES] > 0 && c[PC_INSTRUCTIONS] >= 0)
+	    printf("%6.2f", c[PC_INSTRUCTIONS] / c[PC_CYCLES]);
+	else
+	    printf("%6s", "-");
+	printevent(c[PC_BRANCH_MISSES], i < n ? stats[i].ops : ops, 9, 3);
+	printevent(c[PC_L1D_MISSES], i < n ? stats[i].ops : ops, 8, 3);
+	printevent(c[PC_LLC_MISSES], i < n ? stats[i].ops : ops, 8, 3);
+	printevent(c[PC_DTLB_MISSES], i < n ? stats[i].ops : ops, 8, 3);
+	printf("\n");
+    }
+}
+
+/*
+ * json_string - writes s to f as a JSON string
+ */
+static void json_string(FILE *f, char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(f, "\\%c", *s);
+	else if ((unsigned char)*s < 0x20)
+	    fprintf(f, "\\u%04x", *s);
+	else
+	    fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+/*
+ * csv_string - writes s to f as a CSV field, quoted if it has to be
+ */
+static void csv_string(FILE *f, char *s)
+{
+    if (strpbrk(s, ",\"\n") == NULL) {
+	fputs(s, f);
+	return;
+    }
+    fputc('"', f);
+    for (; *s; s++) {
+	if (*s == '"')
+	    fputc('"', f);
+	fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+/*
+ * putmeta - writes one key and value of the environment a run was made in
+ */
+static void putmeta(FILE *f, int json, char *key, char *val, int last)
+{
+    if (json) {
+	fprintf(f, "    \"%s\": ", key);
+	json_string(f, val);
+	fprintf(f, last ? "\n" : ",\n");
+    }
+    else
+	fprintf(f, "# %s: %s\n", key, val);
+}
+
+/*
+ * writemeta - writes the command line, time, host, system, CPU, compiler
+ *     and timer of this run
+ */
+static void writemeta(FILE *f, int json, int argc, char **argv)
+{
+    char buf[MAXLINE], line[MAXLINE], *p;
+    struct utsname uts;
+    time_t now = time(NULL);
+    FILE *cpuinfo;
+    int i;
+
+    buf[0] = '\0';
+    for (i = 0; i < argc; i++) {
+	if (i > 0)
+	    strncat(buf, " ", sizeof(buf) - strlen(buf) - 1);
+	strncat(buf, argv[i], sizeof(buf) - strlen(buf) - 1);
+    }
+    putmeta(f, json, "command", buf, 0);
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    putmeta(f, json, "time", buf, 0);
+    if (uname(&uts) < 0)
+	unix_error("uname failed in writemeta");
+    putmeta(f, json, "host", uts.nodename, 0);
+    snprintf(buf, sizeof(buf), "%s %s %s", uts.sysname, uts.release, uts.machine);
+    putmeta(f, json, "system", buf, 0);
+    strcpy(buf, "unknown");
+    if ((cpuinfo = fopen("/proc/cpuinfo", "r")) != NULL) {
+	while (fgets(line, sizeof(line), cpuinfo) != NULL)
+	    if (!strncmp(line, "model name", 10) && (p = strchr(line, ':')) != NULL) {
+		snprintf(buf, sizeof(buf), "%s", p + 2);
+		buf[strcspn(buf, "\n")] = '\0';
+		break;
+	    }
+	fclose(cpuinfo);
+    }
+    putmeta(f, json, "cpu", buf, 0);
+    snprintf(buf, sizeof(buf), "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+    putmeta(f, json, "cpus", buf, 0);
+    putmeta(f, json, "compiler", __VERSION__, 0);
+    snprintf(buf, sizeof(buf), "%s, median of %d runs",
+	     USE_FCYC ? "fcyc" : USE_ITIMER ? "itimer" : "gettimeofday", REPORT_RUNS);
+    putmeta(f, json, "timer", buf, 1);
+}
+
+/*
+ * writeresults - writes each trace's results, the totals and the
+ *     environment of the run to path, as JSON or as CSV. The JSON has
+ *     one trace per line, which is what readbaseline expects.
+ */
+static void writeresults(char *path, int json, int n, char **tracefiles, stats_t *stats,
+			 double perfindex, int argc, char **argv)
+{
+    FILE *f;
+    int i, nvalid = 0;
+    double secs = 0, ops = 0, util = 0;
+
+    if ((f = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in writeresults", path);
+	unix_error(msg);
+    }
+    if (json) {
+	fprintf(f, "{\n  \"meta\": {\n");
+	writemeta(f, json, argc, argv);
+	fprintf(f, "  },\n  \"traces\": [\n");
+    }
+    else {
+	writemeta(f, json, argc, argv);
+	fprintf(f, "trace,file,valid,ops,secs,noise,util,kops\n");
+    }
+    for (i = 0; i < n; i++) {
+	if (stats[i].valid) {
+	    nvalid++;
+	    secs += stats[i].secs;
+	    ops += stats[i].ops;
+	    util += stats[i].util;
+	}
+	if (json) {
+	    fprintf(f, "    {\"trace\": %d, \"file\": ", i);
+	    json_string(f, tracefiles[i]);
+	    fprintf(f, ", \"valid\": %d, \"ops\": %.0f, \"secs\": %.9f, "
+		    "\"noise\": %.4f, \"util\": %.6f, \"kops\": %.3f}%s\n",
+		    stats[i].valid, stats[i].ops, stats[i].secs, stats[i].noise,
+		    stats[i].util, stats[i].valid ? (stats[i].ops/1e3)/stats[i].secs : 0,
+		    i < n - 1 ? "," : "");
+	}
+	else {
+	    fprintf(f, "%d,", i);
+	    csv_string(f, tracefiles[i]);
+	    fprintf(f, ",%d,%.0f,%.9f,%.4f,%.6f,%.3f\n",
+		    stats[i].valid, stats[i].ops, stats[i].secs, stats[i].noise,
+		    stats[i].util, stats[i].valid ? (stats[i].ops/1e3)/stats[i].secs : 0);
+	}
+    }
+    if (json)
+	fprintf(f, "  ],\n  \"total\": {\"valid\": %d, \"ops\": %.0f, \"secs\": %.9f, "
+		"\"util\": %.6f, \"kops\": %.3f, \"perfindex\": %.1f}\n}\n",
+		nvalid, ops, secs, util/n, secs > 0 ? (ops/1e3)/secs : 0, perfindex);
+    else
+	fprintf(f, "total,,%d,%.0f,%.9f,,%.6f,%.3f\n",
+		nvalid, ops, secs, util/n, secs > 0 ? (ops/1e3)/secs : 0);
+    if (fclose(f) != 0)
+	unix_error("fclose failed in writeresults");
+}
+
+/*
+ * json_field - returns the value of key in a one-line JSON object, or NULL
+ */
+static char *json_field(char *line, char *key)
+{
+    char pat[MAXLINE], *p;
+
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    if ((p = strstr(line, pat)) == NULL)
+	return NULL;
+    for (p += strlen(pat); *p == ' '; p++)
+	;
+    return p;
+}
+
+/*
+ * unquote - copies the JSON or CSV string that starts at s to out
+ */
+static void unquote(char *s, char *out, int json)
+{
+    int n = 0;
+
+    if (*s != '"') {
+	while (*s && *s != ',' && *s != '\n' && n < MAXLINE - 1)
+	    out[n++] = *s++;
+    }
+    else {
+	for (s++; *s && n < MAXLINE - 1; s++) {
+	    if (json && *s == '\\' && s[1] != '\0')
+		s++;
+	    else if (*s == '"' && !(!json && s[1] == '"'))
+		break;
+	    else if (*s == '"')
+		s++;
+	    out[n++] = *s;
+	}
+    }
+    out[n] = '\0';
+}
+
+/*
+ * csv_fields - splits a CSV line in place into at most max fields;
+ *     returns how many it has
+ */
+static int csv_fields(char *line, char **fields, int max)
+{
+    int n = 0, quoted = 0;
+    char *p;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    fields[n++] = line;
+    for (p = line; *p && n < max; p++) {
+	if (*p == '"')
+	    quoted = !quoted;
+	else if (*p == ',' && !quoted) {
+	    *p = '\0';
+	    fields[n++] = p + 1;
+	}
+    }
+    return n;
+}
+
+/*
+ * readbaseline - reads each trace's results from a run written with
+ *     --json or --csv into a malloc'd base; returns how many traces
+ */
+static int readbaseline(char *path, base_t **base)
+{
+    FILE *f;
+    char line[4 * MAXLINE], *field[8], *v;
+    int n = 0, max = 16, json = -1, col[5], have_cols = 0, i, j, k;
+    static char *cols[] = { "file", "valid", "kops", "noise", "util" };
+    base_t *b;
+
+    if ((f = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open baseline %s", path);
+	unix_error(msg);
+    }
+    if ((*base = malloc(max * sizeof(base_t))) == NULL)
+	unix_error("malloc failed in readbaseline");
+    while (fgets(line, sizeof(line), f) != NULL) {
+	if (json < 0 && line[0] != '#')
+	    json = line[0] == '{';
+	if (json < 0 || line[0] == '#')
+	    continue;
+	if (n == max && (*base = realloc(*base, (max *= 2) * sizeof(base_t))) == NULL)
+	    unix_error("realloc failed in readbaseline");
+	b = &(*base)[n];
+
+	if (json) {
+	    if ((v = json_field(line, "file")) == NULL)
+		continue;
+	    unquote(v, b->file, 1);
+	    b->valid = (v = json_field(line, "valid")) ? atoi(v) : 0;
+	    b->kops = (v = json_field(line, "kops")) ? strtod(v, NULL) : 0;
+	    b->noise = (v = json_field(line, "noise")) ? strtod(v, NULL) : 0;
+	    b->util = (v = json_field(line, "util")) ? strtod(v, NULL) : 0;
+	    n++;
+	    continue;
+	}
+
+	/* The first CSV line names the columns */
+	k = csv_fields(line, field, 8);
+	if (!have_cols) {
+	    for (i = 0; i < 5; i++)
+		for (col[i] = -1, j = 0; j < k; j++)
+		    if (!strcmp(field[j], cols[i]))
+			col[i] = j;
+	    have_cols = 1;
+	    if (col[0] < 0 || col[2] < 0) {
+		sprintf(msg, "Baseline %s has no file or kops column", path);
+		app_error(msg);
+	    }
+	    continue;
+	}
+	if (!strcmp(field[0], "total") || col[0] >= k || col[2] >= k)
+	    continue;
+	unquote(field[col[0]], b->file, 0);
+	b->valid = col[1] >= 0 && col[1] < k ? atoi(field[col[1]]) : 1;
+	b->kops = strtod(field[col[2]], NULL);
+	b->noise = col[3] >= 0 && col[3] < k ? strtod(field[col[3]], NULL) : 0;
+	b->util = col[4] >= 0 && col[4] < k ? strtod(field[col[4]], NULL) : 0;
+	n++;
+    }
+    fclose(f);
+    return n;
+}
+
+/*
+ * checkbaseline - compares each trace's throughput and utilization with
+ *     the run stored in path, prints how they changed and returns the
+ *     number of regressions. Throughput has regressed when it drops by
+ *     more than BASE_MIN_TOL or BASE_SIGMAS times the noise of the two
+ *     runs together, whichever is more; utilization, by more than
+ *     BASE_UTIL_TOL; a trace that was correct, when it no longer is.
+ */
+static int checkbaseline(char *path, int n, char **tracefiles, stats_t *stats)
+{
+    base_t *base;
+    int nbase, i, j, regressions = 0, matched = 0, slower, worse;
+    double change, tol, ops = 0, secs = 0, bsecs = 0, var = 0, bvar = 0;
+    double util = 0, butil = 0, s;
+
+    nbase = readbaseline(path, &base);
+    printf("Baseline %s:\n", path);
+    printf("%5s%9s%9s%8s%7s%6s%6s\n",
+	   "trace", "Kops", "base", "change", "tol", "util", "base");
+    for (i = 0; i < n; i++) {
+	for (j = 0; j < nbase && strcmp(base[j].file, tracefiles[i]); j++)
+	    ;
+	if (j == nbase) {
+	    printf("%2d   not in baseline\n", i);
+	    continue;
+	}
+	if (!base[j].valid)
+	    continue;
+	if (!stats[i].valid) {
+	    printf("%2d   no longer correct\n", i);
+	    regressions++;
+	    continue;
+	}
+	change = (stats[i].ops/1e3)/stats[i].secs / base[j].kops - 1.0;
+	tol = BASE_SIGMAS * sqrt(stats[i].noise * stats[i].noise +
+				 base[j].noise * base[j].noise);
+	tol = tol > BASE_MIN_TOL ? tol : BASE_MIN_TOL;
+	slower = change < -tol;
+	worse = stats[i].util < base[j].util - BASE_UTIL_TOL;
+	printf("%2d%12.0f%9.0f%+7.1f%%%6.1f%%%5.0f%%%5.0f%%%s\n",
+	       i, (stats[i].ops/1e3)/stats[i].secs, base[j].kops, change*100.0,
+	       tol*100.0, stats[i].util*100.0, base[j].util*100.0,
+	       slower && worse ? "  slower, less util" :
+	       slower ? "  slower" : worse ? "  less util" : "");
+	regressions += slower + worse;
+
+	/* The totals are over the traces correct in both runs */
+	s = stats[i].ops / (base[j].kops*1e3);
+	matched++;
+	ops += stats[i].ops;
+	secs += stats[i].secs;
+	bsecs += s;
+	var += (stats[i].noise * stats[i].secs) * (stats[i].noise * stats[i].secs);
+	bvar += (base[j].noise * s) * (base[j].noise * s);
+	util += stats[i].util;
+	butil += base[j].util;
+    }
+    if (matched > 0) {
+	change = bsecs / secs - 1.0;
+	tol = BASE_SIGMAS * sqrt(var / (secs*secs) + bvar / (bsecs*bsecs));
+	tol = tol > BASE_MIN_TOL ? tol : BASE_MIN_TOL;
+	slower = change < -tol;
+	worse = util/matched < butil/matched - BASE_UTIL_TOL;
+	printf("%5s%9.0f%9.0f%+7.1f%%%6.1f%%%5.0f%%%5.0f%%%s\n",
+	       "Total", (ops/1e3)/secs, (ops/1e3)/bsecs, change*100.0, tol*100.0,
+	       util/matched*100.0, butil/matched*100.0,
+	       slower && worse ? "  slower, less util" :
+	       slower ? "  slower" : worse ? "  less util" : "");
+	regressions += slower + worse;
+    }
+    if (regressions > 0)
+	printf("%d regression%s against %s\n", regressions,
+	       regressions > 1 ? "s" : "", path);
+    free(base);
+    return regressions;
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValmEHLPI] [-c <n>] [-f <file>] [-F <policy>] [-j <n>] [-S <prefix>] [-t <dir>] [-T <file>]\n");
+    fprintf(stderr, "               [-u <n>] [-U <prefix>]\n");
+    fprintf(stderr, "               [--json <file>] [--csv <file>] [--baseline <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
-    fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-c <n>     Check heap consistency every <n> ops.\n");
+    fprintf(stderr, "\t-E         Count cycles, instructions and cache, TLB and branch misses per op.\n");
+    fprintf(stderr, "\t-f <file>  Use <file> as the trace file (.rep, binary or streamed, see mmconv).\n");
+    fprintf(stderr, "\t-F <pol>   Pin the fit policy: first, next, best or adaptive.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Print latency percentiles of each request type and size.\n");
+    fprintf(stderr, "\t-I         Run mm.c through the inlined thread cache of mm_inline.h.\n");
+    fprintf(stderr, "\t-j <n>     Check traces in <n> processes, then time them one at a time.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Compare utilization with mm.c's lifetime predictor.\n");
+    fprintf(stderr, "\t-m         Run the allocator's background maintenance thread.\n");
+    fprintf(stderr, "\t-P         Run mm.c on a shared memory heap with process-safe locking.\n");
+    fprintf(stderr, "\t-S <pfx>   Snapshot each trace's heap at peak load to <pfx>.<trace>.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <file>  Dump allocator events to <file> (MM_TRACE=1 builds).\n");
+    fprintf(stderr, "\t-u <n>     Sample the -U timelines every <n> ops (default %d).\n", TIMELINE_INTERVAL);
+    fprintf(stderr, "\t-U <pfx>   Write each trace's utilization and fragmentation over time to <pfx>.<trace>.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t--json <file>      Write the results and environment as JSON to <file>.\n");
+    fprintf(stderr, "\t--csv <file>       Write them as CSV to <file>.\n");
+    fprintf(stderr, "\t--baseline <file>  Compare with a --json or --csv run, exit 2 if worse.\n");
 }
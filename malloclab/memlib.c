@@ -2,7 +2,15 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            mem_init_shared instead backs the heap with a shared memory
+ *            object that other processes can map with mem_attach_shared,
+ *            and mem_init_file with a file that outlives the process.
+ *            The brk then lives in a header page in front of the heap, so
+ *            every attached process, and the next one to map the file,
+ *            sees the heap grow.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,14 +18,43 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "memlib.h"
 #include "config.h"
 
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23 /* Linux 5.14+, may be missing from older headers */
+#endif
+
+#define MEM_GROWTH_HIST 4 /* number of recent sbrk increments remembered */
+
+#define MEM_SHARED_MAGIC 0x4d48534d /* "MSHM" */
+
+/* Header page at the start of a shared heap mapping; the heap follows it */
+typedef struct {
+    unsigned int magic;     /* MEM_SHARED_MAGIC */
+    unsigned int brk;       /* heap bytes in use */
+    size_t max;             /* heap bytes available */
+} mem_shared_t;
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_growth[MEM_GROWTH_HIST]; /* the most recent sbrk increments */
+static unsigned mem_growth_next;           /* next slot to overwrite in mem_growth */
+static mem_shared_t *mem_shared;  /* header of a shared heap, NULL for a private one */
+static size_t mem_map_size;       /* bytes mapped for a shared heap, header included */
+static int mem_fd = -1;           /* shared memory object of a shared heap */
+
+/* In a shared heap another process may have moved the brk; pick it up before using it.
+   The brk is stored atomically, since mem_prefault reads it from the maintenance thread. */
+#define SET_BRK(p)  __atomic_store_n(&mem_brk, (p), __ATOMIC_RELAXED)
+#define SYNC_BRK()  do { if (mem_shared) SET_BRK(mem_start_brk + mem_shared->brk); } while (0)
+
+static int mem_map_shared(int fd, int create);
 
 /* 
  * mem_init - initialize the memory system model
@@ -40,15 +77,118 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
+    if (mem_shared) {
+	munmap(mem_shared, mem_map_size);
+	close(mem_fd);
+	mem_shared = NULL;
+	mem_fd = -1;
+	return;
+    }
     free(mem_start_brk);
 }
 
+/*
+ * mem_init_shared - like mem_init, but back the heap with a shared memory
+ *    object: the POSIX shared memory object name (created, and failing if
+ *    it exists), or an anonymous memfd when name is NULL. Children forked
+ *    afterwards share the heap at the same address; other processes map
+ *    it with mem_attach_shared. Returns the object's fd, which stays open
+ *    until mem_deinit, or -1 on error. Removing a named object with
+ *    shm_unlink is up to the caller.
+ */
+int mem_init_shared(const char *name)
+{
+    int fd;
+
+    if (name != NULL)
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    else
+	fd = memfd_create("mm-heap", 0);
+    if (fd < 0)
+	return -1;
+    if (ftruncate(fd, mem_pagesize() + MAX_HEAP) < 0 || mem_map_shared(fd, 1) < 0) {
+	close(fd);
+	if (name != NULL)
+	    shm_unlink(name);
+	return -1;
+    }
+    return fd;
+}
+
+/*
+ * mem_attach_shared - map a heap made by mem_init_shared in another
+ *    process, found by name, or by fd when name is NULL (e.g. an fd
+ *    received over a unix socket, which mem_deinit then closes). The heap
+ *    usually lands at a different address than in the creating process.
+ *    Returns 0, or -1 on error.
+ */
+int mem_attach_shared(const char *name, int fd)
+{
+    if (name != NULL && (fd = shm_open(name, O_RDWR, 0)) < 0)
+	return -1;
+    if (mem_map_shared(fd, 0) < 0) {
+	if (name != NULL)
+	    close(fd);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * mem_init_file - like mem_init_shared, but back the heap with the file
+ *    at path, created if it does not exist. A file that already holds a
+ *    heap is mapped with its contents and brk as they were left, usually
+ *    at a different address. Returns 1 in that case, 0 for a new heap,
+ *    -1 on error (including a file that is not a heap).
+ */
+int mem_init_file(const char *path)
+{
+    int fd, existing;
+    struct stat st;
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0)
+	return -1;
+    if (fstat(fd, &st) < 0)
+	goto fail;
+    existing = st.st_size > 0;
+    if (!existing && ftruncate(fd, mem_pagesize() + MAX_HEAP) < 0)
+	goto fail;
+    if (mem_map_shared(fd, !existing) < 0)
+	goto fail;
+    return existing;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+/*
+ * mem_sync - write the heap of mem_init_file back to its file and wait
+ *    for it. Returns 0, or -1 on error or for a heap that is not shared.
+ */
+int mem_sync(void)
+{
+    if (mem_shared == NULL)
+	return -1;
+    return msync(mem_shared, mem_pagesize() + mem_shared->brk, MS_SYNC);
+}
+
+/*
+ * mem_is_shared - returns nonzero if the heap is a shared or file-backed one
+ */
+int mem_is_shared(void)
+{
+    return mem_shared != NULL;
+}
+
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    SET_BRK(mem_start_brk);
+    if (mem_shared)
+	__atomic_store_n(&mem_shared->brk, 0, __ATOMIC_RELAXED);
 }
 
 /* 
@@ -58,13 +198,19 @@ void mem_reset_brk()
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk;
+
+    SYNC_BRK();
+    old_brk = mem_brk;
     if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    SET_BRK(mem_brk + incr);
+    if (mem_shared)
+	__atomic_store_n(&mem_shared->brk, mem_brk - mem_start_brk, __ATOMIC_RELAXED);
+    __atomic_store_n(&mem_growth[mem_growth_next++ % MEM_GROWTH_HIST], incr, __ATOMIC_RELAXED);
     return (void *)old_brk;
 }
 
@@ -81,6 +227,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
+    SYNC_BRK();
     return (void *)(mem_brk - 1);
 }
 
@@ -89,6 +236,7 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
+    SYNC_BRK();
     return (size_t)(mem_brk - mem_start_brk);
 }
 
@@ -99,3 +247,123 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_recent_growth - returns the total of the last few sbrk increments,
+ *    a rough measure of how fast the heap is currently growing
+ */
+size_t mem_recent_growth(void)
+{
+    size_t total = 0;
+    int i;
+
+    for (i = 0; i < MEM_GROWTH_HIST; i++)
+	total += __atomic_load_n(&mem_growth[i], __ATOMIC_RELAXED);
+    return total;
+}
+
+/*
+ * mem_prefault - make the bytes pages just past the brk resident, so
+ *    that a later mem_sbrk hands out memory that will not page-fault on
+ *    first touch. The contents are never modified and the brk is read
+ *    atomically, so this is safe to call from another thread while the
+ *    heap is growing into the range; a stale brk only misplaces the
+ *    range. Falls back to mlock/munlock on kernels without
+ *    MADV_POPULATE_WRITE.
+ */
+void mem_prefault(size_t bytes)
+{
+    size_t pagesize = mem_pagesize();
+    char *brk = mem_shared ? mem_start_brk + __atomic_load_n(&mem_shared->brk, __ATOMIC_RELAXED)
+			   : __atomic_load_n(&mem_brk, __ATOMIC_RELAXED);
+    char *lo = (char *)(((unsigned long)brk + pagesize - 1) & ~(pagesize - 1));
+    char *hi = brk + bytes;
+
+    if (hi > mem_max_addr)
+	hi = mem_max_addr;
+    hi = (char *)((unsigned long)hi & ~(pagesize - 1));
+    if (hi <= lo)
+	return;
+    if (madvise(lo, hi - lo, MADV_POPULATE_WRITE) == 0)
+	return;
+    if (mlock(lo, hi - lo) == 0)
+	munlock(lo, hi - lo);
+}
+
+/*
+ * mem_purge - give the whole pages inside [lo, lo+len) back to the OS.
+ *    They read back as zeroes and are faulted in again on next touch.
+ *    MADV_DONTNEED only drops a private heap's pages: a shared or file
+ *    heap keeps them in its object, so there the range is punched out
+ *    of the object instead, with MADV_REMOVE where fallocate cannot.
+ */
+void mem_purge(void *lo, size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    char *start = (char *)(((unsigned long)lo + pagesize - 1) & ~(pagesize - 1));
+    char *end = (char *)(((unsigned long)lo + len) & ~(pagesize - 1));
+
+    if (end <= start)
+	return;
+    if (mem_shared == NULL)
+	madvise(start, end - start, MADV_DONTNEED);
+    else if (fallocate(mem_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		       start - (char *)mem_shared, end - start) < 0)
+	madvise(start, end - start, MADV_REMOVE);
+}
+
+/*
+ * mem_hugepage - ask for the huge pages that fit inside [lo, lo+len) to
+ *    be backed by transparent huge pages. Returns -1 where that is not
+ *    supported, which only costs the TLB savings.
+ */
+int mem_hugepage(void *lo, size_t len)
+{
+#ifdef MADV_HUGEPAGE
+    size_t hpage = 1 << 21;
+    char *start = (char *)(((unsigned long)lo + hpage - 1) & ~(hpage - 1));
+    char *end = (char *)(((unsigned long)lo + len) & ~(hpage - 1));
+
+    if (end > start)
+	return madvise(start, end - start, MADV_HUGEPAGE);
+#endif
+    return -1;
+}
+
+/*
+ * mem_map_shared - map the shared memory object fd as the heap. A new
+ *    object (create) gets its header written; an existing one must carry
+ *    a valid header. Returns 0, or -1 on error.
+ */
+static int mem_map_shared(int fd, int create)
+{
+    struct stat st;
+    size_t pagesize = mem_pagesize();
+    mem_shared_t *hdr;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size <= pagesize) {
+	errno = EINVAL;
+	return -1;
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED)
+	return -1;
+    if (create) {
+	hdr->brk = 0;
+	hdr->max = st.st_size - pagesize;
+	hdr->magic = MEM_SHARED_MAGIC;
+    }
+    else if (hdr->magic != MEM_SHARED_MAGIC || hdr->max != st.st_size - pagesize) {
+	munmap(hdr, st.st_size);
+	errno = EINVAL;
+	return -1;
+    }
+
+    mem_shared = hdr;
+    mem_map_size = st.st_size;
+    mem_fd = fd;
+    mem_start_brk = (char *)hdr + pagesize;
+    mem_max_addr = mem_start_brk + hdr->max;
+    mem_brk = mem_start_brk + hdr->brk;
+    return 0;
+}
@@ -2,10 +2,19 @@
 
 void mem_init(void);               
 void mem_deinit(void);
+int mem_init_shared(const char *name);
+int mem_attach_shared(const char *name, int fd);
+int mem_init_file(const char *path);
+int mem_sync(void);
+int mem_is_shared(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+size_t mem_recent_growth(void);
+void mem_prefault(size_t bytes);
+void mem_purge(void *lo, size_t len);
+int mem_hugepage(void *lo, size_t len);
 
@@ -16,6 +16,57 @@
  * request is found, it is then removed from the explicit free list by updating the next and
  * previous pointers of the blocks directly next to it. When a block is added to the free list,
  * it is added to the very beginning of the list, and the start pointer is updated accordingly.
+ *
+ * Allocated blocks also carry a 4-bit allocation tag in the top bits of their header and
+ * footer, which mm_malloc_tagged sets and mm_free reads back to keep per-tag counters.
+ *
+ * find_fit searches the free list with one of three policies: first-fit, next-fit (resuming
+ * where the previous search stopped) or best-fit among the first FIT_BEST_K fits. By default
+ * the allocator keeps cheap statistics over epochs of FIT_EPOCH allocations (entropy of the
+ * request sizes, free list length, split rate, search depth) and picks the policy for the next
+ * epoch from them; mm_set_fit_policy pins one instead.
+ *
+ * mm_malloc_hint places blocks the caller marks hot or cold in an arena of their own: a
+ * stretch of the heap fenced off by two allocated blocks, with its own free list. The hot
+ * arena is aligned and advised for huge pages, so the hot blocks share as few cache lines and
+ * TLB entries as possible; the free space in the cold arena is purged early by the
+ * maintenance thread. When an arena fills up it is retired, its free space joins the main
+ * heap, and a new one is created. Large hinted requests, and those that miss in an arena that
+ * is only fragmented rather than full, use the main heap.
+ *
+ * Fixed-size objects can skip the rounding and the fit search: mm.h turns a constant request
+ * size into a size class at compile time, mm_free_class keeps up to CLASS_KEEP freed blocks per
+ * class on a list of their own, still marked allocated, and mm_malloc_class pops the head of
+ * that list. An empty list is refilled by carving a batch of blocks out of one free block,
+ * so a single fit search serves the whole batch. mm_inline.h adds a lock-free
+ * per-thread cache in front of the class lists, inlined into the caller, which moves blocks
+ * to and from them in batches. mm_malloc_cpu and mm_free_cpu keep the same kind of cache per
+ * CPU instead of per thread, with restartable sequences (mmrseq.h) in place of thread-local
+ * storage, so thousands of threads share a few caches; without rseq they use the thread's.
+ *
+ * With mm_set_lifetime, allocations whose size (and optional call-site id) has been seen to
+ * outlive the average block are predicted long-lived and carved from the top of the free
+ * block they land in, while everything else is carved from the bottom. The long-lived
+ * blocks then pile up at one end of each free region instead of pinning holes among the
+ * short-lived ones.
+ *
+ * Free list links are 4-byte offsets from the base of the heap rather than pointers, so a heap
+ * means the same wherever it is mapped. That lets a heap from mem_init_shared be used by several
+ * processes at once: mm_init then keeps the allocator's roots (free lists, wilderness, arenas,
+ * fit state, tag accounting) in a header at the bottom of the heap, guarded by a robust
+ * process-shared mutex, and other processes join with mm_attach. Each process loads the roots
+ * into its own globals when it takes the lock and stores them back when it releases it, so the
+ * rest of the allocator is unaware of the sharing. mm_stats_t, the fit telemetry and the lifetime
+ * predictor stay per process.
+ *
+ * The same header makes a heap file from mem_init_file restartable. It records the layout
+ * version, a root block (mm_set_root) and whether the last process shut the heap down cleanly
+ * (mm_shutdown). When mm_init finds the file already holds a heap, it checks it in one walk and
+ * reuses the free lists as they are, or rebuilds them from the walk after an unclean shutdown,
+ * instead of starting an empty heap.
+ *
+ * Building with MM_TRACE=1 records heap extensions, splits, coalesces, fit searches and
+ * realloc paths into per-thread ring buffers (see mmtrace.h); by default the hooks compile away.
  */
 
 #include <stdio.h>
@@ -23,9 +74,17 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "mm.h"
+#include "mm_inline.h"
 #include "memlib.h"
+#include "mmrseq.h"
+#include "mmtrace.h"
+#include "mmsnap.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -51,6 +110,7 @@ team_t team = {
 #define MIN_BLOCK_SIZE 4*WSIZE /* Minimum block size: header + footer + 2 pointers */
 
 #define MAX(x, y)     ((x) > (y)? (x) : (y))    /* Returns the maximum value between two inputs */
+#define MIN(x, y)     ((x) < (y)? (x) : (y))    /* Returns the minimum value between two inputs */
 #define ROUNDUP(s, a) ((((s)+((a)-1))/(a))*(a)) /* Round size s up to a-byte alignment */
 
 /* Pack a size and allocated bit into a word */
@@ -61,9 +121,93 @@ team_t team = {
 #define PUT(p, val)  (*(unsigned int *)(p) = (val))
 
 /* Read the size and allocated fields from address p */
-#define GET_SIZE(p)  (GET(p) & ~0x7)
+#define GET_SIZE(p)  (GET(p) & SIZE_MASK)
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
+/* Allocation tags live in the top bits of an allocated block's header and footer.
+   MAX_HEAP is 256 MB (2^28 bytes), so no block size ever reaches these bits. */
+#define TAG_SHIFT      28
+#define SIZE_MASK      (~0x7 & ((1u << TAG_SHIFT) - 1))
+#define GET_TAG(p)     (GET(p) >> TAG_SHIFT)
+#define PACK_TAG(size, alloc, tag)  (PACK(size, alloc) | ((unsigned int)(tag) << TAG_SHIFT))
+
+#if TAG_SHIFT != MMSNAP_TAG_SHIFT
+#error "mmsnap.h must decode tags the way mm.c packs them"
+#endif
+
+/* Scratch header bit that mm_check sets on free-list members and clears again */
+#define CHECK_MARK     0x2
+
+/* Set in a large free block's header and footer by the maintenance thread once it has
+   seen the block idle for a tick. Any rewrite of the block's boundary tags clears it. */
+#define IDLE_MARK      0x4
+
+/* Set in an allocated block's header and footer once mm_realloc has resized it. The same bit
+   is IDLE_MARK on free blocks, so test it together with the allocated bit (GROWING). */
+#define REALLOC_MARK   0x4
+#define GROWING(p)     ((GET(p) & (REALLOC_MARK | 0x1)) == (REALLOC_MARK | 0x1))
+
+/* Payload bytes to ask for when a block that has been resized before has to move:
+   half as much again, so that the next few growth steps fit in place. */
+#define HEADROOM(size) ((size) + (size)/2)
+
+/* Set alongside IDLE_MARK once the block's pages have been purged. Free blocks carry no
+   tag, so the lowest tag bit is reused for this. */
+#define PURGED_MARK    (1u << TAG_SHIFT)
+
+/* Background maintenance (see mm_maint_start) */
+#define MAINT_TICK_NS     1000000   /* Wake up at least this often (1 ms) */
+#define MAINT_RESERVE_MIN (1<<16)   /* Smallest pre-faulted reserve kept past the brk (bytes) */
+#define MAINT_RESERVE_MAX (1<<24)   /* Largest pre-faulted reserve kept past the brk (bytes) */
+#define MAINT_PURGE_MIN   (1<<20)   /* Only purge free blocks at least this large (bytes) */
+
+/* Lifetime prediction (see mm_set_lifetime) */
+#define LT_CLASSES   160     /* Size classes: 8-byte steps up to 1 KB, then powers of 2 */
+#define LT_SMALL     1024    /* Largest size with a class of its own (bytes) */
+#define LT_TRACK     4096    /* Slots for sampled live blocks (power of 2) */
+#define LT_SAMPLE    8       /* Track the lifetime of one allocation in LT_SAMPLE per class */
+#define LT_DECAY     (1<<16) /* Halve a class's history after this many observations */
+#define LT_SITE_MIX  97      /* Spreads call-site ids over the classes */
+#define LT_REFRESH   64      /* Recompute every class's prediction after this many observations */
+
+/* Fit policy selection (see find_fit and fit_epoch) */
+#define FIT_BEST_K     8       /* Best-fit picks the smallest of this many fits */
+#define FIT_EPOCH      512     /* Allocations per telemetry epoch */
+#define FIT_NBUCKETS   16      /* Request size buckets for the entropy: powers of 2 from 16 */
+
+/* Size class lists (see mm_malloc_class) */
+#define CLASS_KEEP     64                          /* Freed blocks kept per class */
+#define CLASS_CARVE    16                          /* Blocks carved per empty class list */
+#define CLASS_CARVE_BYTES 1024                     /* ... fewer for classes this would overrun */
+#define CLASS_SIZE(c)  ((size_t)((c) + 2) * DSIZE) /* Block size of class c, as MM_CLASS in mm.h */
+
+/* Thread caches (mm_inline.h): mm_heap_gen counts heaps in steps of 2 above TCACHE_OFF */
+#define TCACHE_OFF     1UL                        /* Caches bypassed (see mm_set_lifetime) */
+#define TCACHE_GEN(g)  ((g) & ~TCACHE_OFF)        /* Generation a cache of heap g records */
+
+/* Hot and cold arenas (see mm_malloc_hint). Arena a serves hint a + 1. */
+#define ARENA_HOT       (MM_HOT - 1)
+#define ARENA_COLD      (MM_COLD - 1)
+#define NARENAS         2
+#define HOT_ARENA_SIZE  (1<<21)    /* One huge page (bytes) */
+#define HOT_ARENA_ALIGN (1<<21)    /* ... aligned so that the kernel can back it with one */
+#define COLD_ARENA_SIZE (1<<20)    /* Bytes */
+#define FENCE_SIZE      (2*DSIZE)  /* Allocated block on each side of an arena */
+#define ARENA_SIZE(a)   ((a) == ARENA_HOT ? HOT_ARENA_SIZE : COLD_ARENA_SIZE)
+#define ARENA_MAX_REQUEST(a) (ARENA_SIZE(a) / 64) /* Larger hinted requests use the main heap */
+#define ARENA_FULL(a)   (ARENA_SIZE(a) / 8)  /* Retire an arena with less free space than this */
+
+/* Serialize the public entry points while the maintenance thread is running or the heap is
+   used by several threads (mm_set_threads), and always in a shared heap (see heap_lock).
+   MM_LOCK is -1 if the lock cannot be taken; the entry point then fails without the lock. */
+#define MM_LOCK()    heap_lock()
+#define MM_UNLOCK()  heap_unlock()
+
+/* Shared heaps (see mm_init and mm_attach) */
+#define HEAP_MAGIC     0x50414548 /* "HEAP" */
+#define HEAP_VERSION   1          /* Bump when heap_hdr_t or the block format changes */
+#define HEAP_HDR_SIZE  ROUNDUP(sizeof(heap_hdr_t), DSIZE)
+
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
@@ -72,45 +216,248 @@ team_t team = {
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
+/* Convert between a block pointer and its offset from the heap base (0 for NULL) */
+#define OFFSET(p)      ((p) ? (unsigned int)((char *)(p) - heap_base) : 0)
+#define POINTER(o)     ((char *)((o) ? (unsigned long)heap_base + (o) : 0))
+
 /* Given block ptr bp, get the next and previous block pointers (next stored first, then prev)*/
-#define GET_NEXT(bp)   (*(char **)(bp))
-#define GET_PREV(bp)   (*(char **)(bp + WSIZE))
+#define GET_NEXT(bp)   POINTER(GET(bp))
+#define GET_PREV(bp)   POINTER(GET((char *)(bp) + WSIZE))
 
 /* Given block ptr bp, set the next and previous block pointers to pointer np */
-#define SET_NEXT(bp, np)   (GET_NEXT(bp) = np)
-#define SET_PREV(bp, np)   (GET_PREV(bp) = np)
+#define SET_NEXT(bp, np)   PUT(bp, OFFSET(np))
+#define SET_PREV(bp, np)   PUT((char *)(bp) + WSIZE, OFFSET(np))
+
+/* Allocator roots of a shared heap, at its base. Pointers are stored as offsets. */
+typedef struct {
+    unsigned int magic;          /* HEAP_MAGIC once mm_init has built the heap */
+    unsigned int version;        /* HEAP_VERSION of the allocator that built it */
+    unsigned int hdr_size;       /* HEAP_HDR_SIZE of that build */
+    unsigned int clean;          /* set by mm_shutdown, cleared by the next heap_lock */
+    unsigned int root;           /* heap_root */
+    unsigned int free_list;      /* free_list_startp */
+    unsigned int wilderness;     /* wilderness_p */
+    unsigned int rover;          /* fit_rover */
+    size_t grow_demand;
+    size_t fit_floor;
+    unsigned long free_count;
+    int fit_policy;
+    struct { unsigned int lo, hi, free_list; } arenas[NARENAS];
+    mm_tag_stats_t tag_stats[MM_NTAGS];
+    pthread_mutex_t lock;        /* process-shared and robust */
+} heap_hdr_t;
 
 /* Global variables */
+static char *heap_base = 0;        /* Base of the heap; free list links are offsets from it */
+static heap_hdr_t *heap_hdr = 0;   /* Roots of a shared heap (NULL for a private one) */
 static char *heap_listp = 0;       /* Pointer to first block in heap */
+static char *heap_root = 0;        /* Block set by mm_set_root */
 static char *free_list_startp = 0; /* Pointer to beginning of free list */
+static char *wilderness_p = 0;     /* Free block just before the epilogue (never on the free list) */
+static size_t grow_demand = 0;     /* Running average of heap shortfalls (see grow_size) */
+static size_t fit_floor = (size_t)-1; /* Every block on the free list is smaller than this */
+static mm_stats_t stats;           /* Allocator-wide counters (see mm_get_stats) */
+static unsigned long free_count = 0; /* Blocks on the free list */
+
+/* Current arenas, created on the first request with their hint and dropped by mm_init */
+static struct {
+    char *lo, *hi;     /* Blocks with lo <= bp < hi belong to the arena (NULL until created) */
+    char *free_list;   /* Its free blocks, kept apart from free_list_startp */
+} arenas[NARENAS];
+
+/* Freed blocks kept per size class by mm_free_class, linked through their first payload word.
+   They stay marked allocated, so the rest of the allocator sees them as in use, but the tag
+   counters and the lifetime predictor count them as freed. */
+static char *class_list[MM_NCLASSES];
+static unsigned int class_len[MM_NCLASSES];
+
+/* Per-thread caches of mm_inline.h, and the heap generation they must match. The low bit of
+   mm_heap_gen is TCACHE_OFF, set while the lifetime predictor runs: no cache's gen matches
+   then, so every request takes the slow path, which sends it to the heap. */
+__thread mm_tcache_t mm_tcache;
+unsigned long mm_heap_gen;
+
+/* Per-CPU caches of mm_malloc_cpu: for each CPU, one list per class of mm_inline.h */
+typedef struct {
+    mmr_list_t list[MM_TCACHE_CLASSES];
+} cpu_cache_t;
+
+static cpu_cache_t *cpu_caches;  /* cpu_ncaches of them, allocated on first use */
+static int cpu_ncaches;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+/* Fit policy and the telemetry of the current epoch. The pinned policy survives mm_init. */
+static int fit_pinned = MM_FIT_ADAPTIVE; /* mm_set_fit_policy */
+static int fit_policy = MM_FIT_FIRST;    /* Policy find_fit uses */
+static char *fit_rover = 0;              /* Next-fit: where the next search starts */
+static struct {
+    unsigned int mallocs;                /* Allocations this epoch */
+    unsigned int splits;                 /* ... that split their block */
+    unsigned long free_len;              /* Sum of the free list length seen by each */
+    unsigned long depth;                 /* Sum of blocks each search looked at */
+    unsigned int size_hist[FIT_NBUCKETS]; /* Request sizes by power of 2 */
+} ep;
+
+/* Per-tag accounting (see mm_malloc_tagged). Counters are reset by mm_init, limits are not.
+   In a shared heap the counters are the ones in the heap header. */
+static mm_tag_stats_t tag_stats_private[MM_NTAGS];
+static mm_tag_stats_t *tag_stats = tag_stats_private; /* live bytes and op counts per tag */
+static size_t tag_limit[MM_NTAGS];             /* soft limit in bytes, 0 = no limit */
+static mm_tag_limit_fn tag_limit_fn[MM_NTAGS]; /* called when live bytes cross the limit */
+
+/* Lifetime predictor. Learned lifetimes survive mm_init, so one run can train the next;
+   mm_reset_lifetime forgets them. Lifetimes are measured in allocations. */
+static int lt_enabled = 0;                      /* mm_set_lifetime switch */
+static unsigned long lt_clock = 0;              /* Allocations made so far */
+static unsigned long long lt_sum[LT_CLASSES];   /* Sum of observed lifetimes per class */
+static unsigned long lt_n[LT_CLASSES];          /* Observations per class */
+static unsigned int lt_allocs[LT_CLASSES];      /* Allocations per class, for sampling */
+static unsigned char lt_long[LT_CLASSES];       /* Cached lt_predict_long per class */
+static unsigned long long lt_total_sum;         /* ... and over all classes */
+static unsigned long lt_total_n;
+static struct {
+    char *bp;                 /* Sampled live block, NULL if the slot is empty */
+    unsigned long birth;      /* lt_clock when it was allocated */
+    unsigned int cls;         /* Its class */
+} lt_track[LT_TRACK];
+
+/* Background maintenance thread state */
+static int maint_running = 0;    /* set while the thread runs; private heaps then take maint_lock */
+static int threaded = 0;         /* set by mm_set_threads; private heaps then take maint_lock */
+static int maint_stop = 0;       /* asks the thread to exit */
+static pthread_t maint_thread;
+static pthread_mutex_t maint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maint_cond = PTHREAD_COND_INITIALIZER;
 
 /* Function prototypes for internal helper routines */
 static void *extend_heap(size_t words);
-static void place(void *bp, size_t asize, char coal);
+static void *place(void *bp, size_t asize, int high);
 static void *find_fit(size_t asize);
 static void *coalesce(void *bp);
-static int mm_check();
+static void tag_account(unsigned int tag, long delta);
+static void tag_resize(unsigned int tag, size_t oldsize, size_t newsize);
+static size_t grow_size(size_t deficit);
+static size_t adjust_size(size_t size);
+static void trim_block(void *bp, size_t asize);
+static void fit_epoch(void);
+static unsigned int log2_q8(unsigned long x);
+static void *malloc_block(size_t size, int tag, unsigned int site, int hint);
+static void free_block(void *bp);
+static void release_block(void *bp);
+static void alloc_account(void *bp, int tag, unsigned int cls);
+static void free_account(void *bp);
+static void *realloc_block(void *bp, size_t size);
+static void *maint_main(void *arg);
+static int heap_lock(void);
+static void heap_unlock(void);
+static void heap_load(void);
+static void heap_store(void);
+static void heap_repair(void);
+static void heap_lock_init(heap_hdr_t *hdr);
+static int heap_reopen(void);
+static long heap_validate(void);
+static void *class_pop(int cls);
+static void *class_carve(int cls);
+static void class_push(void *bp, int cls);
+static void class_flush(void);
+static void cpu_flush(void);
+static void tcache_reset(mm_tcache_t *tc);
+static int tcache_lock(void);
+static void tcache_unlock(void);
+static void cpu_setup(void);
+static void *cpu_refill(int cls);
+static void cpu_spill(void *bp, int cls);
+static void maint_purge(void);
+static int arena_of(void *bp);
+static int arena_create(int a);
+static void arena_retire(int a);
+static void *arena_fit(int a, size_t asize, size_t *free_bytes);
+static char **free_list_head(void *bp);
+static unsigned int lt_class(size_t asize, unsigned int site);
+static int lt_predict_long(unsigned int cls);
+static void lt_refresh(void);
+static void lt_birth(void *bp, unsigned int cls);
+static void lt_death(void *bp);
+static void lt_observe(unsigned int cls, unsigned long life);
 
 /* Function prototypes for explicit free list */
 static void insert_into_free_list(void *bp); /* inserts block bp into the free list */
 static void remove_from_free_list(void *bp); /* removes the block bp from the free list */
+static void link_free(void *bp);   /* files a free block as the wilderness or on the free list */
+static void unlink_free(void *bp); /* undoes link_free */
 
 
 /* Function: mm_init
- * Checks: returns NULL if initializing or extending the heap gives an error.
- * 1. Initialize the memory manager by extending the heap by 16 bytes for the
+ * Checks: returns -1 if initializing or extending the heap gives an error.
+ * 1. If memlib maps a heap file that already holds a heap (mem_init_file), reopen it with
+ *    heap_reopen instead and stop.
+ *    If memlib maps a shared heap (mem_init_shared or a new file), start the heap with a
+ *    heap_hdr_t for the roots, and set up its robust process-shared mutex, held until the
+ *    heap is built.
+ * 2. Initialize the memory manager by extending the heap by 16 bytes for the
  *    4-byte alignment padding, 8-byte prologue and 4-byte epilogue
- * 2. Set the heap_listp pointer to point to the beginning of the heap, directly
+ * 3. Set the heap_listp pointer to point to the beginning of the heap, directly
  *    after the prologue header.
- * 3. Extend the heap by CHUNKSIZE (4k bytes).
+ * 4. Extend the heap by CHUNKSIZE (4k bytes), which becomes the first wilderness block.
+ * 5. Publish the roots of a shared heap, after which other processes can mm_attach.
  */
 int mm_init(void)
 {
+    int error = 0;
+    heap_hdr_t *hdr = NULL;
+
+    /* Keep the maintenance thread out while the heap is rebuilt */
+    if (maint_running || threaded)
+        pthread_mutex_lock(&maint_lock);
+    heap_hdr = NULL;
+    heap_base = mem_heap_lo();
+    heap_root = NULL;
+    tag_stats = tag_stats_private;
     free_list_startp = NULL;
+    wilderness_p = NULL;
+    grow_demand = 0;
+    fit_floor = (size_t)-1;
+    memset(&stats, 0, sizeof(stats));
+    free_count = 0;
+    fit_rover = NULL;
+    fit_policy = (fit_pinned == MM_FIT_ADAPTIVE) ? MM_FIT_FIRST : fit_pinned;
+    stats.fit_policy = fit_policy;
+    memset(&ep, 0, sizeof(ep));
+    memset(lt_track, 0, sizeof(lt_track)); /* blocks of the old heap are gone */
+    memset(arenas, 0, sizeof(arenas));
+    memset(class_list, 0, sizeof(class_list));
+    memset(class_len, 0, sizeof(class_len));
+    mm_heap_gen += 2; /* every thread's cache holds blocks of the old heap */
+    if (cpu_caches != NULL)
+        memset(cpu_caches, 0, cpu_ncaches * sizeof(cpu_cache_t));
+
+    /* A heap file mapped again already has a heap */
+    if (mem_is_shared() && mem_heapsize() > 0) {
+        error = heap_reopen();
+        goto done;
+    }
+
+    /* A shared heap starts with its roots */
+    if (mem_is_shared()) {
+        if ((hdr = mem_sbrk(HEAP_HDR_SIZE)) == (void *)-1) {
+            error = -1;
+            goto out;
+        }
+        hdr->magic = 0;
+        hdr->version = HEAP_VERSION;
+        hdr->hdr_size = HEAP_HDR_SIZE;
+        hdr->clean = 0;
+        heap_lock_init(hdr);
+        pthread_mutex_lock(&hdr->lock);
+        tag_stats = hdr->tag_stats;
+    }
+    memset(tag_stats, 0, MM_NTAGS * sizeof(mm_tag_stats_t));
 
     /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1)
-        return -1;
+    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1) {
+        error = -1;
+        goto out;
+    }
     PUT(heap_listp, 0);                          /* Alignment padding */
     PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */
     PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */
@@ -119,10 +466,120 @@ int mm_init(void)
 
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
     if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
+        error = -1;
+
+out:
+    if (hdr != NULL) {
+        heap_hdr = hdr;
+        heap_store();
+        if (error == 0)
+            hdr->magic = HEAP_MAGIC;
+        pthread_mutex_unlock(&hdr->lock);
+    }
+done:
+    if (maint_running || threaded)
+        pthread_mutex_unlock(&maint_lock);
+    return error;
+}
+
+/* Function: mm_attach
+ * Checks: returns -1 unless memlib maps a shared heap that mm_init has built.
+ * Joins a shared heap created by another process, once mem_attach_shared has mapped it:
+ * 1. Point heap_base, heap_hdr and heap_listp at this process's mapping of the heap, which
+ *    is usually at a different address than in the creator.
+ * 2. Reset the per-process state as mm_init would. The roots themselves are loaded from the
+ *    header by every entry point, under the lock.
+ * Children forked after mm_init already share the heap and its roots, and need not call this.
+ */
+int mm_attach(void)
+{
+    heap_hdr_t *hdr = mem_heap_lo();
+
+    if (!mem_is_shared() || mem_heapsize() < HEAP_HDR_SIZE || hdr->magic != HEAP_MAGIC ||
+        hdr->version != HEAP_VERSION || hdr->hdr_size != HEAP_HDR_SIZE)
         return -1;
+    heap_base = (char *)hdr;
+    heap_listp = heap_base + HEAP_HDR_SIZE + 2*WSIZE;
+    tag_stats = hdr->tag_stats;
+    memset(&stats, 0, sizeof(stats));
+    memset(&ep, 0, sizeof(ep));
+    memset(lt_track, 0, sizeof(lt_track));
+    memset(class_list, 0, sizeof(class_list));
+    memset(class_len, 0, sizeof(class_len));
+    mm_heap_gen += 2;
+    if (cpu_caches != NULL)
+        memset(cpu_caches, 0, cpu_ncaches * sizeof(cpu_cache_t));
+    heap_hdr = hdr;
     return 0;
 }
 
+/* Function: mm_shutdown
+ * Checks: returns -1 for a private heap, or if the heap cannot be written back to its file.
+ * Marks a shared or file-backed heap as shut down cleanly, so that the next mm_init on its
+ * file trusts the free lists after one checking walk instead of rebuilding them:
+ * 1. Flush the calling thread's cache (mm_tcache_flush). Under the lock, free the blocks
+ *    this process keeps on its per-CPU lists and class lists, which would otherwise stay
+ *    allocated for good, and set the clean flag. The next entry point to take the lock
+ *    clears it. No other thread of the process may be using the heap meanwhile.
+ * 2. Write the heap back to its file with mem_sync.
+ */
+int mm_shutdown(void)
+{
+    if (heap_hdr == NULL)
+        return -1;
+    mm_tcache_flush();
+    if (MM_LOCK() < 0)
+        return -1;
+    cpu_flush();
+    class_flush();
+    heap_hdr->clean = 1;
+    MM_UNLOCK();
+    return mem_sync();
+}
+
+/* Function: mm_set_root
+ * Records block ptr (or NULL) as the heap's root: the block from which a process that maps
+ * the heap file again, or attaches to a shared heap, finds everything else (mm_get_root).
+ */
+void mm_set_root(void *ptr)
+{
+    if (MM_LOCK() < 0)
+        return;
+    heap_root = ptr;
+    MM_UNLOCK();
+}
+
+/* Function: mm_get_root
+ * Returns the block recorded by mm_set_root, or NULL.
+ */
+void *mm_get_root(void)
+{
+    void *ptr;
+
+    if (MM_LOCK() < 0)
+        return NULL;
+    ptr = heap_root;
+    MM_UNLOCK();
+    return ptr;
+}
+
+/* Function: mm_offset
+ * Returns the offset of ptr from the heap base, or 0 for NULL. Unlike ptr itself, the offset
+ * names the same block in every process that maps a shared heap; mm_pointer turns it back.
+ */
+size_t mm_offset(void *ptr)
+{
+    return OFFSET(ptr);
+}
+
+/* Function: mm_pointer
+ * Returns this process's pointer to the block at offset (see mm_offset), or NULL for 0.
+ */
+void *mm_pointer(size_t offset)
+{
+    return POINTER(offset);
+}
+
 /* Function: mm_malloc
  * Checks: returns NULL if the size = 0, or if extending the heap by the
  *         extend size gives an error.
@@ -130,40 +587,393 @@ int mm_init(void)
  *    alignment requirements (multiple of 8 bytes).
  * 2. If the free list is nonempty, search the free list for a block that is
  *    sufficiently large and place the new allocated size into the free block.
- * 3. If no free block is found, extend the heap by extendsize and place the
- *    new block into the extended region.
+ * 3. If no free block is found, carve the block from the wilderness, which is always
+ *    used last. If the wilderness is too small, first extend the heap by only the
+ *    shortfall, rounded up by grow_size, so that it merges into the wilderness.
  * 4. Return a pointer to the start of the newly allcoated block.
+ * The work is done by malloc_block; plain allocations are charged to tag 0.
  */
 void *mm_malloc(size_t size)
+{
+    return mm_malloc_tagged(size, 0);
+}
+
+/* Function: mm_malloc_tagged
+ * Checks: returns NULL if the size = 0, if the tag is out of range, or if extending
+ *         the heap by the extend size gives an error.
+ * 1. Allocate the block exactly as mm_malloc describes. Untagged allocations made
+ *    through mm_malloc use tag 0.
+ * 2. Stamp the tag into the top bits of the new block's header and footer so that
+ *    mm_free and mm_realloc can find it again without a side table.
+ * 3. Charge the block size to the tag's counters, which may fire its soft limit.
+ */
+void *mm_malloc_tagged(size_t size, int tag)
+{
+    void *bp;
+
+    if (MM_LOCK() < 0)
+        return NULL;
+    bp = malloc_block(size, tag, 0, 0);
+    MM_UNLOCK();
+    return bp;
+}
+
+/* Function: mm_malloc_site
+ * Checks: returns NULL under the same conditions as mm_malloc.
+ * 1. Allocate the block exactly as mm_malloc describes, charged to tag 0.
+ * 2. The lifetime predictor keys on the site id as well as the size, so that
+ *    same-sized objects from different call sites are predicted separately. Plain
+ *    mm_malloc calls use site 0.
+ */
+void *mm_malloc_site(size_t size, unsigned int site)
+{
+    void *bp;
+
+    if (MM_LOCK() < 0)
+        return NULL;
+    bp = malloc_block(size, 0, site, 0);
+    MM_UNLOCK();
+    return bp;
+}
+
+/* Function: mm_malloc_hint
+ * Checks: returns NULL under the same conditions as mm_malloc.
+ * 1. If hint is MM_HOT or MM_COLD, allocate the block from that hint's arena, creating the
+ *    arena at the end of the heap on first use. The hot arena packs blocks that are touched
+ *    on every request together, on huge pages where the system allows; the cold arena keeps
+ *    rarely touched blocks out of their way.
+ * 2. If the arena is full (less than an eighth free), retire it and create a new one.
+ * 3. If the request is too large for an arena (ARENA_MAX_REQUEST), the arena cannot be created
+ *    or has no fit, or for any other hint, allocate the block from the main heap exactly as
+ *    mm_malloc does.
+ * mm_realloc keeps a block in its arena when it has to move it.
+ */
+void *mm_malloc_hint(size_t size, int hint)
+{
+    void *bp;
+
+    if (MM_LOCK() < 0)
+        return NULL;
+    bp = malloc_block(size, 0, 0, hint);
+    MM_UNLOCK();
+    return bp;
+}
+
+/* Function: mm_malloc_class
+ * Checks: returns NULL if cls is not a size class, or if the heap cannot grow.
+ * Allocates a block of size class cls, which MM_CLASS in mm.h computes from a request size,
+ * at compile time when the size is a constant:
+ * 1. Pop the most recently freed block of the class off its class list.
+ * 2. If the list is empty, carve a batch of blocks of the class from the heap, return one
+ *    and keep the rest on the list.
+ */
+void *mm_malloc_class(int cls)
+{
+    void *bp;
+
+    if (cls < 0 || cls >= MM_NCLASSES)
+        return NULL;
+    if (MM_LOCK() < 0)
+        return NULL;
+    bp = class_pop(cls);
+    MM_UNLOCK();
+    return bp;
+}
+
+/* Function: mm_free_class
+ * Frees block bp, allocated by mm_malloc_class(cls) or by mm_malloc for a size of class cls:
+ * 1. If bp is an untagged block of exactly the class's size and the class list has room,
+ *    push it onto the list without coalescing it, for the next mm_malloc_class(cls).
+ * 2. Otherwise free it as mm_free does.
+ */
+void mm_free_class(void *bp, int cls)
+{
+    if (MM_LOCK() < 0)
+        return;
+    class_push(bp, cls);
+    MM_UNLOCK();
+}
+
+/* Function: mm_tcache_refill
+ * Checks: returns NULL as mm_malloc does.
+ * The slow path of mm_malloc_inline (mm_inline.h), taken when the calling thread's cache
+ * cannot serve a request of size bytes. Everything it does is under tcache_lock:
+ * 1. If the cache belongs to an earlier heap, drop its blocks, which that heap took with it.
+ * 2. While the caches are off (TCACHE_OFF), return the cache's blocks to the heap and
+ *    allocate the block as mm_malloc does. Sizes the cache does not hold are allocated
+ *    that way too.
+ * 3. Otherwise take MM_TCACHE_BATCH blocks of the class, from its class list first, return
+ *    one and cache the rest.
+ */
+void *mm_tcache_refill(size_t size)
+{
+    mm_tcache_t *tc = &mm_tcache;
+    int cls = MM_CLASS(size);
+    void *bp, *first;
+    int i;
+
+    if (tc->gen != TCACHE_GEN(mm_heap_gen))
+        tcache_reset(tc);
+    if (mm_heap_gen & TCACHE_OFF)
+        mm_tcache_flush();
+    if (tcache_lock() < 0)
+        return NULL;
+    if (size == 0 || size > MM_TCACHE_MAX || (mm_heap_gen & TCACHE_OFF)) {
+        first = malloc_block(size, 0, 0, 0);
+        tcache_unlock();
+        return first;
+    }
+
+    stats.tcache_refills++;
+    first = class_pop(cls);
+    for (i = 1; first != NULL && i < MM_TCACHE_BATCH && (bp = class_pop(cls)) != NULL; i++) {
+        *(void **)bp = tc->head[cls];
+        tc->head[cls] = bp;
+        tc->count[cls]++;
+    }
+    tcache_unlock();
+    return first;
+}
+
+/* Function: mm_tcache_spill
+ * The slow path of mm_free_inline (mm_inline.h), taken when the calling thread's cache
+ * cannot keep block bp, allocated with size bytes. Everything it does is under tcache_lock:
+ * 1. If the cache belongs to an earlier heap, drop its blocks.
+ * 2. While the caches are off, return the cache's blocks to the heap and free bp as mm_free
+ *    does. Blocks of sizes the cache does not hold, and tagged or marked blocks, are freed
+ *    that way too.
+ * 3. If the class's cache is full, hand the older half of it to the class list or the
+ *    free list, then cache bp.
+ */
+void mm_tcache_spill(void *bp, size_t size)
+{
+    mm_tcache_t *tc = &mm_tcache;
+    int cls = MM_CLASS(size);
+    void *last, *old, *next;
+    unsigned int i;
+
+    if (tc->gen != TCACHE_GEN(mm_heap_gen))
+        tcache_reset(tc);
+    if (mm_heap_gen & TCACHE_OFF)
+        mm_tcache_flush();
+    if (size == 0 || size > MM_TCACHE_MAX || GET(HDRP(bp)) != PACK(CLASS_SIZE(cls), 1) ||
+        (mm_heap_gen & TCACHE_OFF)) {
+        if (tcache_lock() < 0)
+            return;
+        free_block(bp);
+        tcache_unlock();
+        return;
+    }
+
+    if (tc->count[cls] >= MM_TCACHE_KEEP) {
+        if (tcache_lock() < 0)
+            return; /* bp stays allocated rather than be freed without the lock */
+        for (i = 1, last = tc->head[cls]; i < MM_TCACHE_KEEP / 2; i++)
+            last = *(void **)last;
+        old = *(void **)last;
+        *(void **)last = NULL;
+        tc->count[cls] = MM_TCACHE_KEEP / 2;
+        stats.tcache_spills++;
+        for (; old != NULL; old = next) {
+            next = *(void **)old;
+            class_push(old, cls);
+        }
+        tcache_unlock();
+    }
+    *(void **)bp = tc->head[cls];
+    tc->head[cls] = bp;
+    tc->count[cls]++;
+}
+
+/* Function: mm_tcache_flush
+ * Returns every block in the calling thread's cache to the class lists or the free list.
+ * A thread calls this before it exits; mm_shutdown calls it for its caller.
+ */
+void mm_tcache_flush(void)
+{
+    mm_tcache_t *tc = &mm_tcache;
+    void *bp;
+    int c;
+
+    if (tc->gen == TCACHE_GEN(mm_heap_gen)) {
+        for (c = 0; c < MM_TCACHE_CLASSES && tc->head[c] == NULL; c++)
+            ;
+        if (c == MM_TCACHE_CLASSES)
+            return; /* nothing cached */
+        if (tcache_lock() < 0)
+            return; /* keep the blocks for a later flush */
+        for (; c < MM_TCACHE_CLASSES; c++) {
+            while ((bp = tc->head[c]) != NULL) {
+                tc->head[c] = *(void **)bp;
+                class_push(bp, c);
+            }
+        }
+        tcache_unlock();
+    }
+    tcache_reset(tc);
+}
+
+/* Function: mm_malloc_cpu
+ * Checks: returns NULL as mm_malloc does.
+ * mm_malloc(size), served from a cache of the CPU the caller runs on:
+ * 1. Without rseq, for sizes the cache does not hold, or while the lifetime predictor runs,
+ *    use mm_malloc_inline, whose cache is per thread, or mm_malloc.
+ * 2. Pop a block of the size's class off this CPU's list in a restartable sequence,
+ *    retrying if the kernel aborts it.
+ * 3. If the list is empty, refill it in a batch (cpu_refill).
+ */
+void *mm_malloc_cpu(size_t size)
+{
+#if MM_RSEQ
+    int cls = MM_CLASS(size);
+    void *bp;
+    int r;
+
+    if (size - 1 < MM_TCACHE_MAX && !(mm_heap_gen & TCACHE_OFF) && mm_cpu_cache()) {
+        while ((r = mmr_pop(&cpu_caches[0].list[cls], sizeof(cpu_cache_t), &bp)) < 0)
+            ;
+        return r ? bp : cpu_refill(cls);
+    }
+#endif
+    return mm_malloc_inline(size);
+}
+
+/* Function: mm_free_cpu
+ * mm_free(bp) for a block allocated with size bytes, kept in a cache of the CPU the caller
+ * runs on:
+ * 1. Without rseq, for sizes the cache does not hold, or while the lifetime predictor runs,
+ *    use mm_free_inline.
+ * 2. Tagged, marked or resized blocks go to mm_free, as in mm_free_inline.
+ * 3. Push bp onto this CPU's list in a restartable sequence. If the list is full, hand half
+ *    of it back to the heap first (cpu_spill).
+ */
+void mm_free_cpu(void *bp, size_t size)
+{
+#if MM_RSEQ
+    int cls = MM_CLASS(size);
+    int r;
+
+    if (size - 1 < MM_TCACHE_MAX && !(mm_heap_gen & TCACHE_OFF) && mm_cpu_cache()) {
+        if (GET(HDRP(bp)) != PACK(CLASS_SIZE(cls), 1)) {
+            mm_free(bp);
+            return;
+        }
+        while ((r = mmr_push(&cpu_caches[0].list[cls], sizeof(cpu_cache_t), bp)) < 0)
+            ;
+        if (r == 0)
+            cpu_spill(bp, cls);
+        return;
+    }
+#endif
+    mm_free_inline(bp, size);
+}
+
+/* Function: mm_cpu_cache
+ * Returns 1 if mm_malloc_cpu and mm_free_cpu use per-CPU caches for the calling thread,
+ * 0 if they fall back to its thread cache because rseq is not available.
+ */
+int mm_cpu_cache(void)
+{
+#if MM_RSEQ
+    int cpu = mmr_cpu();
+
+    if (cpu_caches == NULL)
+        pthread_once(&cpu_once, cpu_setup);
+    return cpu >= 0 && cpu < cpu_ncaches;
+#else
+    return 0;
+#endif
+}
+
+/* Function: mm_set_threads
+ * With on set, makes a private heap safe to use from several threads at once: every public
+ * entry point takes maint_lock, as while the maintenance thread runs. Shared heaps always
+ * lock. Change it only while no other thread is inside the allocator.
+ */
+void mm_set_threads(int on)
+{
+    threaded = on;
+}
+
+/* Function: malloc_block
+ * Does the work of mm_malloc_tagged, with the lock (if any) already held.
+ */
+static void *malloc_block(size_t size, int tag, unsigned int site, int hint)
 {
     size_t asize;      /* Adjusted block size */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    char *bp;
+    size_t wsize;      /* Size of the wilderness block */
+    unsigned int cls = 0; /* Lifetime class */
+    int high = 0;      /* Predicted long-lived: place at the top of the fit */
+    int a = hint - 1;  /* Arena for the hint */
+    size_t afree;      /* Free bytes in the arena */
+    char *bp = NULL;
     
-    /* If size parameter is 0, return immediately */
-    if (size == 0)
+    /* If size parameter is 0 or the tag is invalid, return immediately */
+    if (size == 0 || tag < 0 || tag >= MM_NTAGS)
         return NULL;
 
     /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)
-        asize = 2*DSIZE;
-    else
-        asize = ROUNDUP(size + DSIZE, DSIZE);
+    asize = adjust_size(size);
 
-    /* Search the free list for a fit, place if fit is found */
-    if ((bp = find_fit(asize)) != NULL) {
-        place(bp, asize, 0);
-        return bp;
+    /* Epoch telemetry for the fit policy */
+    ep.mallocs++;
+    ep.free_len += free_count;
+    ep.size_hist[MIN(log2_q8(asize) >> 8, FIT_NBUCKETS + 3) - 4]++;
+    if (ep.mallocs == FIT_EPOCH)
+        fit_epoch();
+
+    /* Hinted requests try their arena first, replacing it once it is full */
+    if (a >= 0 && a < NARENAS && asize <= ARENA_MAX_REQUEST(a)) {
+        if (arenas[a].lo != NULL && (bp = arena_fit(a, asize, &afree)) == NULL &&
+            afree < ARENA_FULL(a))
+            arena_retire(a);
+        if (arenas[a].lo == NULL && arena_create(a) == 0)
+            bp = arena_fit(a, asize, &afree);
+    }
+    if (a >= 0 && a < NARENAS) {
+        if (bp != NULL)
+            stats.hinted++;
+        else
+            stats.hint_spills++;
     }
 
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize,CHUNKSIZE);
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
-        return NULL;
-    place(bp, asize, 1);
+    if (lt_enabled && bp == NULL) {
+        cls = lt_class(asize, site);
+        if ((high = lt_long[cls]))
+            stats.lt_long++;
+    }
+
+    /* Search the free list for a fit. If none, use the wilderness, growing it by the shortfall */
+    if (bp == NULL && (bp = find_fit(asize)) == NULL) {
+        wsize = wilderness_p ? GET_SIZE(HDRP(wilderness_p)) : 0;
+        if (wsize < asize && extend_heap(grow_size(asize - wsize)/WSIZE) == NULL)
+            return NULL;
+        bp = wilderness_p;
+    }
+    bp = place(bp, asize, high);
+
+    /* Tag the block (place leaves the tag bits clear) and charge it to the tag */
+    if (tag != 0) {
+        PUT(HDRP(bp), PACK_TAG(GET_SIZE(HDRP(bp)), 1, tag));
+        PUT(FTRP(bp), PACK_TAG(GET_SIZE(HDRP(bp)), 1, tag));
+    }
+    alloc_account(bp, tag, cls);
     return bp;
 }
 
+/* Function: alloc_account
+ * Description: Charges the newly allocated block bp to tag and, with the lifetime predictor
+ *              on, counts it as an allocation of lifetime class cls, sampling it per class so
+ *              that alternating sizes cannot alias with the sampling period. Every block a
+ *              request hands out goes through here, from the heap or from a class list.
+ */
+static void alloc_account(void *bp, int tag, unsigned int cls)
+{
+    tag_account(tag, GET_SIZE(HDRP(bp)));
+    if (lt_enabled && (lt_clock++, ++lt_allocs[cls] % LT_SAMPLE == 0))
+        lt_birth(bp, cls);
+}
+
 /* Function: m_free
  * Checks: return 0 if the block bp has allocation bit set to 0.
  * 1. Free the block by changing the allocation bit in the header
@@ -172,10 +982,43 @@ void *mm_malloc(size_t size)
  *    the free list or coalesce with nearby blocks.
  */
 void mm_free(void *bp)
+{
+    if (MM_LOCK() < 0)
+        return;
+    free_block(bp);
+    MM_UNLOCK();
+}
+
+/* Function: free_block
+ * Does the work of mm_free, with the lock (if any) already held.
+ */
+static void free_block(void *bp)
 {
     if (GET_ALLOC(HDRP(bp)) == 0)
         return;
 
+    free_account(bp);
+    release_block(bp);
+}
+
+/* Function: free_account
+ * Description: Undoes alloc_account for block bp, which the program is giving back: credits
+ *              its tag and records its lifetime if it was sampled.
+ */
+static void free_account(void *bp)
+{
+    tag_account(GET_TAG(HDRP(bp)), -(long)GET_SIZE(HDRP(bp)));
+    if (lt_enabled)
+        lt_death(bp);
+}
+
+/* Function: release_block
+ * Description: Marks the allocated block bp free and coalesces it, without accounting for it:
+ *              free_block has done that already, and a block on a class list was accounted
+ *              for when it was pushed there.
+ */
+static void release_block(void *bp)
+{
     size_t size = GET_SIZE(HDRP(bp));
 
     PUT(HDRP(bp), PACK(size, 0));
@@ -185,15 +1028,16 @@ void mm_free(void *bp)
 
 /* Function: coalesce
  * Checks: four different cases
- * 1. If next and prev blocks are both allocated, insert bp into the free list
- *    and return a pointer to bp.
- * 2. If next is free, remove the next block from the free list and update bp's
- *    header and next's footer with the new size. Add bp to the free list and return
- *    a pointer to bp.
+ * 1. If next and prev blocks are both allocated, file bp as free and return a pointer to bp.
+ * 2. If next is free, unlink the next block and update bp's header and next's footer with
+ *    the new size. File bp as free and return a pointer to bp.
  * 3. If prev is free, update the header of the previous block to the new size.
  *    Update the footer of bp. Point bp to the previous block and return a pointer to bp.
- * 4. If both next and prev are free, remove next from the free list and update prev's
- *    header and next's footer with the new size. Point bp to prev and return a pointer to bp.
+ * 4. If both next and prev are free, unlink next and update prev's header and next's footer
+ *    with the new size. Point bp to prev and return a pointer to bp.
+ * "Filing" a free block (link_free) makes it the wilderness if it ends at the epilogue and
+ * otherwise inserts it into the free list. In cases 3 and 4 prev keeps its place in the free
+ * list, unless the merged block now ends at the epilogue and has to become the wilderness.
  */
 static void *coalesce(void *bp)
 {
@@ -203,17 +1047,19 @@ static void *coalesce(void *bp)
 
     /* Case 1: next and prev are allocated */
     if (prev_alloc && next_alloc) {
-        insert_into_free_list(bp);
+        link_free(bp);
+        MMT_EVENT(MMT_COALESCE, 1, bp, size);
         return bp;
     }
 
-    /* Case 2: next is free, remove next from free list */
+    /* Case 2: next is free, unlink next */
     else if (prev_alloc && !next_alloc) {
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        remove_from_free_list(NEXT_BLKP(bp));
+        unlink_free(NEXT_BLKP(bp));
         PUT(HDRP(bp), PACK(size, 0)); /* Header of current block updated with new size */
         PUT(FTRP(bp), PACK(size,0));  /* Footer of current (coalesced) block updated with new size */
-        insert_into_free_list(bp);
+        link_free(bp);
+        MMT_EVENT(MMT_COALESCE, 2, bp, size);
     }
 
     /* Case 3: prev is free, update the header of prev to the new size */
@@ -222,15 +1068,34 @@ static void *coalesce(void *bp)
         PUT(FTRP(bp), PACK(size, 0));            /* Footer of current block updated with new size */
         PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0)); /* Header of previous block updated with new size */
         bp = PREV_BLKP(bp);
+        if (bp != wilderness_p && GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0) {
+            remove_from_free_list(bp);           /* prev now reaches the epilogue */
+            wilderness_p = bp;
+        }
+        else if (bp != wilderness_p && size >= fit_floor)
+            fit_floor = (size_t)-1;              /* prev grew in place on the list */
+        MMT_EVENT(MMT_COALESCE, 3, bp, size);
     }
 
-    /* Case 4: both are free, remove next and add bp once moved to point to prev free block */
+    /* Case 4: both are free, unlink next and keep prev, which absorbs bp and next */
     else {
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        remove_from_free_list(NEXT_BLKP(bp));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0)); /* Header of previous block updated with new size */
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0)); /* Footer of next block updated with new size */
-        bp = PREV_BLKP(bp);
+        if (NEXT_BLKP(bp) == wilderness_p) {
+            remove_from_free_list(PREV_BLKP(bp)); /* prev takes over as the wilderness */
+            PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+            PUT(FTRP(PREV_BLKP(bp)), PACK(size, 0));
+            bp = PREV_BLKP(bp);
+            wilderness_p = bp;
+        }
+        else {
+            remove_from_free_list(NEXT_BLKP(bp));
+            PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0)); /* Header of previous block updated with new size */
+            PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0)); /* Footer of next block updated with new size */
+            bp = PREV_BLKP(bp);
+            if (size >= fit_floor)
+                fit_floor = (size_t)-1;          /* prev grew in place on the list */
+        }
+        MMT_EVENT(MMT_COALESCE, 4, bp, size);
     }
    
     return bp; /* bp points to the very beginning of the coalesced block (prev for cases 3-4) */
@@ -239,63 +1104,156 @@ static void *coalesce(void *bp)
 /* Function: mm_realloc
  * Checks: If size = 0, free the block bp. If bp = NULL, allocate a block of the
  *         right size.
- * 1. Allocate a new block of desired new size, and if it fails, return NULL.
- * 2. Copy over the data from the old block to the new block. If the new size is
- *    smaller, copy in as much as will fit.
- * 3. Free the old block. Return a pointer to the new block of new size.
+ * 1. If the block is shrinking, keep it where it is and give the tail back with trim_block.
+ * 2. If the block is growing, try in place: absorb the next block if it is free. When the
+ *    block is the last one before the wilderness or the epilogue, first extend the heap by
+ *    the shortfall so that it can always grow in place.
+ * 3. Otherwise, if the free block just before it (plus the next one, if free) makes enough
+ *    room, slide the payload down into it with memmove.
+ * 4. Otherwise, allocate a new block under the old block's tag, copy over the data and free
+ *    the old block; if that allocation fails, return NULL and leave the old block untouched.
+ *    A block that has been resized before is moved with HEADROOM, since it will likely grow
+ *    again.
+ * Resized blocks carry REALLOC_MARK, which also keeps find_fit from handing out the space
+ * right after them to other requests while anything else fits.
  */
 void *mm_realloc(void *bp, size_t size)
 {
-    size_t oldsize;
+    void *newbp;
+
+    if (MM_LOCK() < 0)
+        return NULL;
+    newbp = realloc_block(bp, size);
+    MM_UNLOCK();
+    return newbp;
+}
+
+/* Function: realloc_block
+ * Does the work of mm_realloc, with the lock (if any) already held.
+ */
+static void *realloc_block(void *bp, size_t size)
+{
+    size_t asize;     /* Adjusted block size */
+    size_t oldsize;   /* Current block size */
+    size_t avail;     /* Block size available without moving */
+    size_t copysize;  /* Payload bytes to preserve */
+    unsigned int keep; /* Tag and REALLOC_MARK bits for the resized block */
+    unsigned int tag; /* bp's tag, read before a slide can overwrite its header */
+    int growing;      /* Block was resized before */
+    char *next, *prev;
     void *newbp;
 
     /* If size == 0 then this is just free, and we return NULL. */
     if (size == 0) {
-        mm_free(bp);
+        MMT_EVENT(MMT_REALLOC, MMT_RA_FREE, bp, 0);
+        free_block(bp);
         return 0;
     }
 
     /* If oldptr is NULL, then this is just malloc. */
     if (bp == NULL) {
-        return mm_malloc(size);
+        newbp = malloc_block(size, 0, 0, 0);
+        MMT_EVENT(MMT_REALLOC, MMT_RA_MALLOC, newbp, newbp ? GET_SIZE(HDRP(newbp)) : 0);
+        return newbp;
     }
 
-    /* newptr will be nonzero if malloc succeeds, 0 if it fails (there isn't a sufficiently
- *      * large free block to allocate)
- *           */
-    newbp = mm_malloc(size);
+    stats.reallocs++;
+    asize = adjust_size(size);
+    oldsize = GET_SIZE(HDRP(bp));
+    keep = (GET(HDRP(bp)) & ~SIZE_MASK & ~0x7) | REALLOC_MARK;
+    tag = GET_TAG(HDRP(bp));
+    growing = GROWING(HDRP(bp));
+    copysize = MIN(oldsize - DSIZE, size);
 
-    /* If realloc() fails the original block is left untouched  */
-    if (!newbp) {
-        return NULL;
+    /* Case 1: shrinking, stay in place */
+    if (asize <= oldsize) {
+        stats.realloc_inplace++;
+        PUT(HDRP(bp), PACK(oldsize, 1) | keep);
+        PUT(FTRP(bp), PACK(oldsize, 1) | keep);
+        trim_block(bp, asize);
+        tag_resize(tag, oldsize, GET_SIZE(HDRP(bp)));
+        MMT_EVENT(MMT_REALLOC, MMT_RA_SHRINK, bp, GET_SIZE(HDRP(bp)));
+        return bp;
+    }
+
+    /* Case 2: growing into the next block, extending the heap if bp is the last block */
+    next = NEXT_BLKP(bp);
+    if (GET_SIZE(HDRP(next)) == 0 || next == wilderness_p) {
+        avail = oldsize + (next == wilderness_p ? GET_SIZE(HDRP(next)) : 0);
+        if (avail < asize && extend_heap(grow_size(asize - avail)/WSIZE) == NULL)
+            return NULL;
+        next = NEXT_BLKP(bp); /* now the wilderness */
+    }
+    avail = oldsize + (GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next)));
+    if (avail >= asize) {
+        stats.realloc_inplace++;
+        unlink_free(next);
+        newbp = bp;
+        MMT_EVENT(MMT_REALLOC, MMT_RA_GROW, bp, avail);
     }
 
-    /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(bp)) - DSIZE;
-    if (size < oldsize)
-        oldsize = size;
-    memcpy(newbp, bp, oldsize);
+    /* Case 3: sliding down into a free previous block */
+    else if (!GET_ALLOC(HDRP(prev = PREV_BLKP(bp))) && avail + GET_SIZE(HDRP(prev)) >= asize) {
+        stats.realloc_slid++;
+        stats.realloc_copied += copysize;
+        if (!GET_ALLOC(HDRP(next)))
+            unlink_free(next);
+        unlink_free(prev);
+        avail += GET_SIZE(HDRP(prev));
+        memmove(prev, bp, copysize);
+        newbp = prev;
+        MMT_EVENT(MMT_REALLOC, MMT_RA_SLIDE, newbp, avail);
+    }
 
-    /* Free the old block. */
-    mm_free(bp);
+    /* Case 4: moving, with headroom if the block keeps growing */
+    else {
+        if ((newbp = malloc_block(growing ? HEADROOM(size) : size, tag, 0,
+                                  arena_of(bp) + 1)) == NULL)
+            return NULL;
+        stats.realloc_moved++;
+        stats.realloc_copied += copysize;
+        memcpy(newbp, bp, copysize);
+        free_block(bp);
+        PUT(HDRP(newbp), GET(HDRP(newbp)) | REALLOC_MARK);
+        PUT(FTRP(newbp), GET(FTRP(newbp)) | REALLOC_MARK);
+        MMT_EVENT(MMT_REALLOC, MMT_RA_MOVE, newbp, GET_SIZE(HDRP(newbp)));
+        return newbp;
+    }
 
+    /* Cases 2 and 3: newbp now spans avail bytes; give back what it does not need */
+    PUT(HDRP(newbp), PACK(avail, 1) | keep);
+    PUT(FTRP(newbp), PACK(avail, 1) | keep);
+    trim_block(newbp, asize);
+    tag_resize(tag, oldsize, GET_SIZE(HDRP(newbp)));
     return newbp;
 }
 
 /* Function: mm_check
- * Description: Checks for the below errors. Returns -1 if any error is present after
- *              checking through all the possible errors.
- * 1. Check that the prologue header/footer stores a size of 16 bytes and marked as allocated.
- * 2. Check that each block's pointer is aligned to 8 bytes (last 3 bits are 0)
- * 3. Check that each block is a multiple of 8 bytes and is at least 16 bytes in size to
+ * Description: Checks for the below errors in time linear in the number of heap blocks.
+ *              Returns -1 if any error is present after checking through all the possible errors.
+ * Pass 1 walks the free list once:
+ * 1. Check that each free list entry lies inside the heap, is marked free, and that its prev
+ *    pointer names the entry before it.
+ * 2. Mark the entry with the scratch CHECK_MARK bit in its header. An entry that is already
+ *    marked means the list has a cycle or lists a block twice, so the walk stops there.
+ * Pass 2 walks every block in the heap once:
+ * 3. Check that the prologue header/footer stores a size of 8 bytes and marked as allocated.
+ * 4. Check that each block's pointer is aligned to 8 bytes (last 3 bits are 0)
+ * 5. Check that each block is a multiple of 8 bytes and is at least 16 bytes in size to
  *    maintain alignment.
- * 4. Check that each block's header matches its footer.
- * 5. Check that all free blocks are on the free list, and all allocated blocks aren't on the
- *    free list.
- * 6. Check that all free blocks do not have a free block right in front of it (prev != free)
+ * 6. Check that each block's header matches its footer (ignoring the scratch mark).
+ * 7. Check that all free blocks are on the free list, and all allocated blocks aren't on the
+ *    free list, by testing the mark set in pass 1. The mark is cleared as the block is visited.
+ * 8. Check that all free blocks do not have a free block right in front of it (prev != free)
  *     A) Uses a local variable prev_free that stores a 1 if the previous block was free. Checks
  *        against the current block's allocation bit
- * 7. Check that the epilogue is of size 0 and marked as allocated.
+ * 9. Check that the free block that ends at the epilogue, if any, is the wilderness and is
+ *    not on the free list.
+ * 10. Check that the epilogue is of size 0 and marked as allocated, and that the heap walk saw
+ *    as many free blocks as the free list holds, which is also the running free_count.
+ * Pass 3 clears the mark from any listed block the heap walk did not reach (only after errors).
+ * 11. Check that every block on a class list is an allocated block of its class's size, and
+ *     that each list holds as many blocks as class_len says.
  *
  * Checkheap can be called before and after functions mm_malloc, mm_realloc, and mm_init for the
  * most accurate results. Calling checkheap within functions place, coalesce, extend_heap, or
@@ -303,22 +1261,69 @@ void *mm_realloc(void *bp, size_t size)
  * a fully-functioning state. The print messages are designed to narrow down possible errors and
  * give detailed information about which block contained the error.
  */
-static int mm_check()
+int mm_check(void)
 {
     char *bp = 0;
     char *fbp = 0;
+    char *prev = 0;
+    char *head;
+    char *lo = (char *)mem_heap_lo();
+    char *hi = (char *)mem_heap_hi();
     char alloc;
     char prev_free = 0;
+    size_t nlisted = 0;   /* blocks marked in pass 1 */
+    size_t nfree = 0;     /* free blocks found in pass 2 */
+    char seen_wilderness = 0;
+    size_t i;
+    int a;
     int error = 0;
 
-    /* Check that the prologue is 16 bytes and allocated */
+    if (MM_LOCK() < 0)
+        return -1;
+
+    /* Pass 1: mark every block on the free list and the arenas' lists (a = NARENAS is the
+       main free list) */
+    for (a = 0; a <= NARENAS; a++) {
+      head = (a == NARENAS) ? free_list_startp : arenas[a].free_list;
+      for (fbp = head, prev = NULL; fbp != NULL; prev = fbp, fbp = GET_NEXT(fbp)) {
+        if (fbp < heap_listp || fbp > hi || ((long)fbp & 0x7) != 0) {
+            printf("Free list entry %p lies outside the heap or is misaligned\n", fbp);
+            error = -1;
+            break;
+        }
+        if (arena_of(fbp) != (a == NARENAS ? -1 : a)) {
+            printf("Free list entry %p is on the list of another arena\n", fbp);
+            error = -1;
+        }
+        if (GET(HDRP(fbp)) & CHECK_MARK) {
+            printf("Free list revisits block %p (cycle or duplicate entry)\n", fbp);
+            error = -1;
+            break;
+        }
+        if (GET_ALLOC(HDRP(fbp))) {
+            printf("Free list entry %p is marked allocated\n", fbp);
+            error = -1;
+        }
+        if (GET_PREV(fbp) != prev) {
+            printf("Free list entry %p has prev %p, expected %p\n", fbp, GET_PREV(fbp), prev);
+            error = -1;
+        }
+        PUT(HDRP(fbp), GET(HDRP(fbp)) | CHECK_MARK);
+        nlisted++;
+      }
+    }
+
+    /* Check that the prologue is 8 bytes and allocated */
     if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp))) {
         printf("Bad prologue header\n");
         error = -1;
     }
 
-    /* Check every block in the heap */
+    /* Pass 2: check every block in the heap */
     for (bp = heap_listp + DSIZE; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        char listed = (GET(HDRP(bp)) & CHECK_MARK) != 0;
+
+        PUT(HDRP(bp), GET(HDRP(bp)) & ~CHECK_MARK);
         alloc = GET_ALLOC(HDRP(bp));
         
         /* Check that each pointer is aligned to 8 bytes */
@@ -332,6 +1337,13 @@ static int mm_check()
             printf("Block %p size %d is not a multiple of 8 or less than 16 \n", bp, GET_SIZE(HDRP(bp)));
             error = -1;
         }
+
+        /* A corrupt size would send the walk outside the heap */
+        if (FTRP(bp) > hi || FTRP(bp) < lo) {
+            printf("Block %p extends past the end of the heap\n", bp);
+            error = -1;
+            break;
+        }
         
         /* Check that the header matches the footer */
         if (GET(HDRP(bp)) != GET(FTRP(bp))) {
@@ -339,18 +1351,24 @@ static int mm_check()
             error = -1;
         }
         
-        
-        /* Check that all allocated blocks aren't in free list, and all free blocks are in free list */
-        for (fbp = free_list_startp; fbp != NULL; fbp = GET_NEXT(fbp)) {
-            if (bp == fbp) {
-                break;
+        /* The wilderness must be the free block that ends at the epilogue, off the list */
+        if (bp == wilderness_p || (alloc == 0 && GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0)) {
+            if (bp != wilderness_p || alloc || listed || GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0) {
+                printf("Block %p is not a valid wilderness (wilderness_p %p)\n", bp, wilderness_p);
+                error = -1;
             }
+            else if (prev_free == 1) {
+                printf("Wilderness %p must be coalesced with previous\n", bp);
+                error = -1;
+            }
+            prev_free = 1;
+            seen_wilderness = 1;
         }
-        
-        /* Error occurs if an allocated block has a match on the free list, or the free
- *          * block isn't on the free list
- *                   */
-        if ((alloc == 0 && fbp == NULL) || (alloc == 1 && fbp != NULL)) {
+
+        /* Error occurs if an allocated block is on the free list, or the free
+         * block isn't on the free list
+         */
+        else if ((alloc == 0 && !listed) || (alloc == 1 && listed)) {
             prev_free = 0;
             printf("Block %p allocate in error: %d \n", bp, alloc);
             error = -1;
@@ -358,8 +1376,9 @@ static int mm_check()
         
         /* If a free block's previous block is also free, coalescing error */
         else if (alloc == 0) {
+            nfree++;
             if (prev_free == 1) {
-                printf("Block %p must be coalesced with previous\n", fbp);
+                printf("Block %p must be coalesced with previous\n", bp);
                 error = -1;
             }
             prev_free = 1;
@@ -373,13 +1392,1110 @@ static int mm_check()
         printf("Bad epilogue header\n");
         error = -1;
     }
-    
-    return error;
-}
+
+    if (wilderness_p != NULL && !seen_wilderness) {
+        printf("Wilderness %p is not a block in the heap\n", wilderness_p);
+        error = -1;
+    }
+
+    /* Every listed block must have been found free by the heap walk */
+    if (nfree != nlisted) {
+        printf("Free list holds %lu blocks but the heap has %lu free blocks\n",
+               (unsigned long)nlisted, (unsigned long)nfree);
+        error = -1;
+
+        /* Pass 3: clear marks the heap walk did not reach */
+        for (a = 0; a <= NARENAS; a++) {
+            head = (a == NARENAS) ? free_list_startp : arenas[a].free_list;
+            for (fbp = head, i = 0; fbp != NULL && i < nlisted; fbp = GET_NEXT(fbp), i++)
+                PUT(HDRP(fbp), GET(HDRP(fbp)) & ~CHECK_MARK);
+        }
+    }
+    if (free_count != nlisted) {
+        printf("Free list holds %lu blocks but free_count is %lu\n",
+               (unsigned long)nlisted, free_count);
+        error = -1;
+    }
+
+    /* Class lists */
+    for (a = 0; a < MM_NCLASSES; a++) {
+        for (fbp = class_list[a], i = 0; fbp != NULL && i <= CLASS_KEEP; fbp = GET_NEXT(fbp), i++) {
+            if (fbp < heap_listp || fbp > hi || GET(HDRP(fbp)) != PACK(CLASS_SIZE(a), 1)) {
+                printf("Class %d list entry %p is not an allocated block of %lu bytes\n",
+                       a, fbp, (unsigned long)CLASS_SIZE(a));
+                error = -1;
+                break;
+            }
+        }
+        if (fbp == NULL && i != class_len[a]) {
+            printf("Class %d list holds %lu blocks but class_len is %u\n",
+                   a, (unsigned long)i, class_len[a]);
+            error = -1;
+        }
+    }
+    
+    MM_UNLOCK();
+    return error;
+}
+
+
+/* Function: mm_snapshot
+ * Checks: returns -1 if the file cannot be created or written.
+ * 1. Write a placeholder mmsnap_hdr_t, since the block count is not known until the end.
+ * 2. Walk the heap from heap_listp to the epilogue and copy each block's header word into a
+ *    fixed buffer, flushing it with one write() whenever it fills up.
+ * 3. Rewrite the header with the final block count.
+ * The snapshot is read by the mmsnap analyzer; see mmsnap.h for the layout.
+ */
+int mm_snapshot(const char *path)
+{
+    unsigned int buf[4096]; /* block words waiting to be written */
+    size_t n = 0;
+    mmsnap_hdr_t hdr;
+    char *bp;
+    int fd;
+    int error = 0;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+    if (MM_LOCK() < 0) {
+        close(fd);
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MMSNAP_MAGIC;
+    hdr.version = MMSNAP_VERSION;
+    hdr.heap_lo = (unsigned long)mem_heap_lo();
+    hdr.heap_size = mem_heapsize();
+    hdr.first_offset = (unsigned int)(HDRP(heap_listp + DSIZE) - (char *)mem_heap_lo());
+    hdr.overhead = DSIZE;
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        error = -1;
+
+    for (bp = heap_listp + DSIZE; !error && GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        buf[n++] = GET(HDRP(bp));
+        hdr.nblocks++;
+        if (n == sizeof(buf) / sizeof(buf[0])) {
+            if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+                error = -1;
+            n = 0;
+        }
+    }
+    if (!error && n > 0 && write(fd, buf, n * sizeof(buf[0])) != (ssize_t)(n * sizeof(buf[0])))
+        error = -1;
+    MM_UNLOCK();
+
+    /* Patch in the block count */
+    if (!error && pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        error = -1;
+    if (close(fd) < 0)
+        error = -1;
+    return error;
+}
+
+/* Function: mm_get_stats
+ * Copies the allocator-wide counters, which mm_init resets, into *st.
+ */
+void mm_get_stats(mm_stats_t *st)
+{
+    if (MM_LOCK() < 0) {
+        memset(st, 0, sizeof(*st));
+        return;
+    }
+    *st = stats;
+    MM_UNLOCK();
+}
+
+/* Function: mm_get_free_stats
+ * 1. Walk the free list and the arenas' lists, adding up the free block sizes and keeping the
+ *    largest. The wilderness is off the lists, so add it separately.
+ * 2. Add up the blocks the class lists keep, which are free to the program but marked allocated.
+ */
+void mm_get_free_stats(mm_free_stats_t *st)
+{
+    char *bp;
+    size_t size;
+    int a;
+
+    memset(st, 0, sizeof(*st));
+    if (MM_LOCK() < 0)
+        return;
+    for (a = 0; a <= NARENAS; a++) {
+        for (bp = (a == NARENAS) ? free_list_startp : arenas[a].free_list; bp != NULL;
+             bp = GET_NEXT(bp)) {
+            size = GET_SIZE(HDRP(bp));
+            st->free_bytes += size;
+            st->free_blocks++;
+            st->largest_free = MAX(st->largest_free, size);
+        }
+    }
+    if (wilderness_p != NULL) {
+        size = GET_SIZE(HDRP(wilderness_p));
+        st->free_bytes += size;
+        st->free_blocks++;
+        st->largest_free = MAX(st->largest_free, size);
+    }
+    for (a = 0; a < MM_NCLASSES; a++)
+        st->class_bytes += class_len[a] * CLASS_SIZE(a);
+    MM_UNLOCK();
+}
+
+/* Function: mm_set_fit_policy
+ * Pins find_fit to policy (MM_FIT_FIRST, MM_FIT_NEXT or MM_FIT_BEST), or lets the allocator
+ * choose one per epoch again (MM_FIT_ADAPTIVE). Returns -1 if policy is not one of these.
+ */
+int mm_set_fit_policy(int policy)
+{
+    if (policy < MM_FIT_ADAPTIVE || policy > MM_FIT_BEST)
+        return -1;
+    if (MM_LOCK() < 0)
+        return -1;
+    fit_pinned = policy;
+    if (policy != MM_FIT_ADAPTIVE)
+        fit_policy = stats.fit_policy = policy;
+    fit_rover = NULL;
+    MM_UNLOCK();
+    return 0;
+}
+
+/* Function: mm_set_lifetime
+ * Turns lifetime-segregated placement on (on != 0) or off. While it is on, the predictor
+ * samples allocations, learns how long each size class lives and places the classes it
+ * predicts long-lived at the top of their free block. Turning it on starts tracking afresh
+ * but keeps what was learned before; turning it off only stops the placement and sampling.
+ * While it is on, mm_inline.h's thread caches are bypassed, so that the predictor sees every
+ * allocation and free.
+ */
+void mm_set_lifetime(int on)
+{
+    if (MM_LOCK() < 0)
+        return;
+    if (on && !lt_enabled)
+        memset(lt_track, 0, sizeof(lt_track));
+    lt_enabled = on != 0;
+    /* Cache hits would escape the predictor's clock, so the caches are bypassed meanwhile */
+    mm_heap_gen = lt_enabled ? mm_heap_gen | TCACHE_OFF : TCACHE_GEN(mm_heap_gen);
+    MM_UNLOCK();
+}
+
+/* Function: mm_reset_lifetime
+ * Forgets every lifetime the predictor has learned.
+ */
+void mm_reset_lifetime(void)
+{
+    if (MM_LOCK() < 0)
+        return;
+    lt_clock = 0;
+    lt_total_sum = 0;
+    lt_total_n = 0;
+    memset(lt_sum, 0, sizeof(lt_sum));
+    memset(lt_n, 0, sizeof(lt_n));
+    memset(lt_allocs, 0, sizeof(lt_allocs));
+    memset(lt_long, 0, sizeof(lt_long));
+    memset(lt_track, 0, sizeof(lt_track));
+    MM_UNLOCK();
+}
+
+/* Function: mm_set_tag_limit
+ * Checks: ignores tags that are out of range.
+ * 1. Set the soft limit (in block bytes) for the given tag. A limit of 0 disables it.
+ * 2. Register fn to be called whenever the tag's live bytes rise above the limit.
+ *    The limit is soft: the allocation that crosses it still succeeds.
+ */
+void mm_set_tag_limit(int tag, size_t limit, mm_tag_limit_fn fn)
+{
+    if (tag < 0 || tag >= MM_NTAGS || MM_LOCK() < 0)
+        return;
+    tag_limit[tag] = limit;
+    tag_limit_fn[tag] = fn;
+    MM_UNLOCK();
+}
+
+/* Function: mm_get_tag_stats
+ * Checks: clears *stats if the tag is out of range or the heap cannot be locked.
+ * 1. Copy the tag's live-byte and operation counters into *stats.
+ */
+void mm_get_tag_stats(int tag, mm_tag_stats_t *stats)
+{
+    if (tag < 0 || tag >= MM_NTAGS || MM_LOCK() < 0) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = tag_stats[tag];
+    MM_UNLOCK();
+}
+
+/* Function: mm_maint_start
+ * Checks: returns 0 if the thread is already running, -1 if it cannot be created.
+ * Starts a background thread that keeps allocator housekeeping off the request path:
+ * 1. Pre-faulting: whenever the heap grows (and at least every MAINT_TICK_NS), the thread
+ *    populates a reserve of pages just past the brk, sized to twice the recent growth
+ *    reported by mem_recent_growth, so the next extend_heap takes pages that are already
+ *    resident instead of faulting them in inside mm_malloc.
+ * 2. Purging: free blocks of at least MAINT_PURGE_MIN bytes that stay idle for a whole tick
+ *    have their page-aligned interior handed back to the kernel with mem_purge.
+ * While the thread runs, every public entry point takes maint_lock. Start and stop the
+ * thread only while no other thread is inside the allocator.
+ */
+int mm_maint_start(void)
+{
+    if (maint_running)
+        return 0;
+    maint_stop = 0;
+    maint_running = 1;
+    if (pthread_create(&maint_thread, NULL, maint_main, NULL) != 0) {
+        maint_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Function: mm_maint_stop
+ * 1. Ask the maintenance thread to exit, wake it, and wait for it.
+ * 2. Clear maint_running so that the entry points stop taking the lock.
+ */
+void mm_maint_stop(void)
+{
+    if (!maint_running)
+        return;
+    pthread_mutex_lock(&maint_lock);
+    maint_stop = 1;
+    pthread_cond_signal(&maint_cond);
+    pthread_mutex_unlock(&maint_lock);
+    pthread_join(maint_thread, NULL);
+    maint_running = 0;
+}
 
 
 /* Helper Functions */
 
+/* Function: heap_lock
+ * Checks: returns -1, without the lock, if the mutex of a shared heap cannot be taken: it is
+ *         ENOTRECOVERABLE, because an owner died and its heir released it without repairing
+ *         the heap, or pthread_mutex_lock fails in any other way. Returns 0 with the lock.
+ * Takes the lock that serializes the public entry points:
+ * 1. In a shared heap, the mutex in its header; then load the roots into the globals. If the
+ *    previous owner died holding the mutex (EOWNERDEAD), mark it consistent and let
+ *    heap_repair rebuild whatever the dead process left half-updated.
+ * 2. In a private heap, maint_lock while the maintenance thread runs or mm_set_threads is on.
+ */
+static int heap_lock(void)
+{
+    int r;
+
+    if (heap_hdr != NULL) {
+        if ((r = pthread_mutex_lock(&heap_hdr->lock)) == EOWNERDEAD) {
+            if (pthread_mutex_consistent(&heap_hdr->lock) != 0) {
+                pthread_mutex_unlock(&heap_hdr->lock);
+                return -1;
+            }
+            heap_load();
+            heap_repair();
+        }
+        else if (r != 0)
+            return -1;
+        else
+            heap_load();
+        heap_hdr->clean = 0;
+    }
+    else if (maint_running || threaded)
+        pthread_mutex_lock(&maint_lock);
+    return 0;
+}
+
+/* Function: heap_unlock
+ * Undoes heap_lock, storing the roots of a shared heap back into its header first.
+ */
+static void heap_unlock(void)
+{
+    if (heap_hdr != NULL) {
+        heap_store();
+        pthread_mutex_unlock(&heap_hdr->lock);
+    }
+    else if (maint_running || threaded)
+        pthread_mutex_unlock(&maint_lock);
+}
+
+/* Function: heap_load
+ * Description: Copies the roots of a shared heap from its header into the globals, turning
+ *              offsets into this process's pointers.
+ */
+static void heap_load(void)
+{
+    int a;
+
+    heap_root = POINTER(heap_hdr->root);
+    free_list_startp = POINTER(heap_hdr->free_list);
+    wilderness_p = POINTER(heap_hdr->wilderness);
+    fit_rover = POINTER(heap_hdr->rover);
+    grow_demand = heap_hdr->grow_demand;
+    fit_floor = heap_hdr->fit_floor;
+    free_count = heap_hdr->free_count;
+    fit_policy = stats.fit_policy = heap_hdr->fit_policy;
+    for (a = 0; a < NARENAS; a++) {
+        arenas[a].lo = POINTER(heap_hdr->arenas[a].lo);
+        arenas[a].hi = POINTER(heap_hdr->arenas[a].hi);
+        arenas[a].free_list = POINTER(heap_hdr->arenas[a].free_list);
+    }
+}
+
+/* Function: heap_store
+ * Description: Undoes heap_load: copies the globals back into the shared heap's header.
+ */
+static void heap_store(void)
+{
+    int a;
+
+    heap_hdr->root = OFFSET(heap_root);
+    heap_hdr->free_list = OFFSET(free_list_startp);
+    heap_hdr->wilderness = OFFSET(wilderness_p);
+    heap_hdr->rover = OFFSET(fit_rover);
+    heap_hdr->grow_demand = grow_demand;
+    heap_hdr->fit_floor = fit_floor;
+    heap_hdr->free_count = free_count;
+    heap_hdr->fit_policy = fit_policy;
+    for (a = 0; a < NARENAS; a++) {
+        heap_hdr->arenas[a].lo = OFFSET(arenas[a].lo);
+        heap_hdr->arenas[a].hi = OFFSET(arenas[a].hi);
+        heap_hdr->arenas[a].free_list = OFFSET(arenas[a].free_list);
+    }
+}
+
+/* Function: class_pop
+ * Description: Returns the most recently freed block of class cls from its class list. If the
+ *              list is empty, refills it with class_carve, or allocates a single block with
+ *              malloc_block if the heap cannot grow by a whole batch. A block from the list or
+ *              the batch is charged to tag 0 and the predictor as malloc_block charges its own.
+ */
+static void *class_pop(int cls)
+{
+    char *bp;
+
+    if ((bp = class_list[cls]) != NULL) {
+        class_list[cls] = GET_NEXT(bp);
+        class_len[cls]--;
+        stats.class_hits++;
+    }
+    else if ((bp = class_carve(cls)) != NULL)
+        stats.class_carves++;
+    else
+        return malloc_block(CLASS_SIZE(cls) - DSIZE, 0, 0, 0);
+    alloc_account(bp, 0, lt_enabled ? lt_class(CLASS_SIZE(cls), 0) : 0);
+    return bp;
+}
+
+/* Function: class_carve
+ * Description: Refills the empty list of class cls from the heap and returns one more block of
+ *              the class, or NULL if the heap cannot grow. Fits one block for CLASS_CARVE blocks
+ *              of the class (fewer for large classes, so that it stays within
+ *              CLASS_CARVE_BYTES), as malloc_block would, and splits it: the last block is returned, with any tail
+ *              too small for place to split off, and the others go on the list lowest first.
+ *              The list blocks are not charged to anything, as if freed by mm_free_class.
+ */
+static void *class_carve(int cls)
+{
+    size_t size = CLASS_SIZE(cls);
+    size_t n = MIN(CLASS_CARVE, CLASS_CARVE_BYTES / size);
+    size_t wsize, total;
+    char *bp;
+    size_t i;
+
+    if ((bp = find_fit(n * size)) == NULL) {
+        wsize = wilderness_p ? GET_SIZE(HDRP(wilderness_p)) : 0;
+        if (wsize < n * size && extend_heap(grow_size(n * size - wsize)/WSIZE) == NULL)
+            return NULL;
+        bp = wilderness_p;
+    }
+    bp = place(bp, n * size, 0);
+    total = GET_SIZE(HDRP(bp));
+    for (i = n - 1; i-- > 0; ) {
+        PUT(HDRP(bp + i*size), PACK(size, 1));
+        PUT(FTRP(bp + i*size), PACK(size, 1));
+        SET_NEXT(bp + i*size, class_list[cls]);
+        class_list[cls] = bp + i*size;
+        class_len[cls]++;
+    }
+    bp += (n - 1) * size;
+    PUT(HDRP(bp), PACK(total - (n - 1) * size, 1));
+    PUT(FTRP(bp), PACK(total - (n - 1) * size, 1));
+    return bp;
+}
+
+/* Function: class_push
+ * Description: Keeps block bp on the list of class cls if it is an untagged block of exactly
+ *              that class's size and the list has room, and frees it otherwise. Either way it
+ *              is accounted for as freed, as free_block does.
+ */
+static void class_push(void *bp, int cls)
+{
+    if (cls >= 0 && cls < MM_NCLASSES && class_len[cls] < CLASS_KEEP &&
+        GET(HDRP(bp)) == PACK(CLASS_SIZE(cls), 1)) {
+        free_account(bp);
+        SET_NEXT(bp, class_list[cls]);
+        class_list[cls] = bp;
+        class_len[cls]++;
+    }
+    else
+        free_block(bp);
+}
+
+/* Function: cpu_setup
+ * Description: Allocates one cpu_cache_t for every CPU the system may bring online, outside
+ *              the heap, since they are per process. Runs once.
+ */
+static void cpu_setup(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+
+    if (n <= 0 || (cpu_caches = calloc(n, sizeof(cpu_cache_t))) == NULL)
+        return;
+    cpu_ncaches = n;
+}
+
+/* Function: cpu_refill
+ * Description: The slow path of mm_malloc_cpu. Under one lock, takes MM_TCACHE_BATCH blocks
+ *              of class cls, from its class list first. Returns one, and pushes the rest onto
+ *              the list of whatever CPU the caller then runs on; those that do not fit go
+ *              back under the lock.
+ */
+static void *cpu_refill(int cls)
+{
+#if MM_RSEQ
+    void *bp[MM_TCACHE_BATCH];
+    int n, r;
+
+    if (tcache_lock() < 0)
+        return NULL;
+    stats.cpu_refills++;
+    for (n = 0; n < MM_TCACHE_BATCH && (bp[n] = class_pop(cls)) != NULL; n++)
+        ;
+    tcache_unlock();
+    while (n > 1) {
+        while ((r = mmr_push(&cpu_caches[0].list[cls], sizeof(cpu_cache_t), bp[n - 1])) < 0)
+            ;
+        if (r == 0)
+            break;
+        n--;
+    }
+    if (n > 1 && tcache_lock() == 0) {
+        while (n > 1)
+            class_push(bp[--n], cls);
+        tcache_unlock();
+    }
+    return n ? bp[0] : NULL;
+#else
+    return NULL;
+#endif
+}
+
+/* Function: cpu_spill
+ * Description: The slow path of mm_free_cpu, for a full list. Pops half of the current
+ *              CPU's list of class cls and hands those blocks to the class list or the free
+ *              list under one lock, then caches bp, or frees it too if the list filled up
+ *              again in between.
+ */
+static void cpu_spill(void *bp, int cls)
+{
+#if MM_RSEQ
+    void *old[MMR_KEEP / 2];
+    int n = 0, r;
+
+    if (tcache_lock() < 0)
+        return; /* bp stays allocated rather than be freed without the lock */
+    while (n < MMR_KEEP / 2 &&
+           (r = mmr_pop(&cpu_caches[0].list[cls], sizeof(cpu_cache_t), &old[n])) != 0)
+        if (r > 0)
+            n++;
+    while ((r = mmr_push(&cpu_caches[0].list[cls], sizeof(cpu_cache_t), bp)) < 0)
+        ;
+    stats.cpu_spills++;
+    while (n > 0)
+        class_push(old[--n], cls);
+    if (r == 0)
+        class_push(bp, cls);
+    tcache_unlock();
+#endif
+}
+
+/* Function: tcache_lock
+ * Description: Takes the lock for a thread cache's slow path. Threads that allocate only
+ *              through mm_inline.h meet nowhere else, so on a private heap this takes
+ *              maint_lock even when MM_LOCK would not, and the caches are safe to use from
+ *              several threads without mm_set_threads. Returns -1 as heap_lock does.
+ */
+static int tcache_lock(void)
+{
+    if (heap_hdr == NULL && !maint_running && !threaded) {
+        pthread_mutex_lock(&maint_lock);
+        return 0;
+    }
+    return heap_lock();
+}
+
+/* Function: tcache_unlock
+ * Description: Undoes tcache_lock.
+ */
+static void tcache_unlock(void)
+{
+    if (heap_hdr == NULL && !maint_running && !threaded)
+        pthread_mutex_unlock(&maint_lock);
+    else
+        heap_unlock();
+}
+
+/* Function: tcache_reset
+ * Description: Empties thread cache tc without touching its blocks, and ties it to the
+ *              current heap.
+ */
+static void tcache_reset(mm_tcache_t *tc)
+{
+    memset(tc, 0, sizeof(*tc));
+    tc->gen = TCACHE_GEN(mm_heap_gen);
+}
+
+/* Function: class_flush
+ * Description: Returns every block on the class lists to the free list. Their accounting was
+ *              done when they were pushed.
+ */
+static void class_flush(void)
+{
+    char *bp;
+    int c;
+
+    for (c = 0; c < MM_NCLASSES; c++) {
+        while ((bp = class_list[c]) != NULL) {
+            class_list[c] = GET_NEXT(bp);
+            release_block(bp);
+        }
+        class_len[c] = 0;
+    }
+}
+
+/* Function: cpu_flush
+ * Description: Empties every CPU's lists onto the class lists or the free list. It reads the
+ *              lists directly rather than in restartable sequences, so no other thread may
+ *              be using them.
+ */
+static void cpu_flush(void)
+{
+    mmr_list_t *l;
+    int cpu, c;
+
+    for (cpu = 0; cpu_caches != NULL && cpu < cpu_ncaches; cpu++) {
+        for (c = 0; c < MM_TCACHE_CLASSES; c++) {
+            l = &cpu_caches[cpu].list[c];
+            while (l->cur > 0)
+                class_push(l->slot[--l->cur], c);
+        }
+    }
+}
+
+/* Function: heap_lock_init
+ * Description: Sets up the robust process-shared mutex of the shared heap hdr.
+ */
+static void heap_lock_init(heap_hdr_t *hdr)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&hdr->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/* Function: heap_reopen
+ * Checks: returns -1 if the heap was built with another HEAP_VERSION or heap_hdr_t layout,
+ *         or is damaged beyond what heap_repair can fix.
+ * Called by mm_init for a heap file that memlib has mapped again with its contents.
+ * 1. Check the header, and set up the mutex afresh: the old one may be held by a process
+ *    that no longer exists.
+ * 2. Load the roots and check the whole heap in one walk (heap_validate). If the last
+ *    process shut the heap down cleanly and the walk finds as many free blocks as the roots
+ *    account for, use the free lists as they are.
+ * 3. Otherwise rebuild them from the walk with heap_repair, and check the result.
+ * Every link and root is an offset from the heap base, so nothing needs to change for the
+ * heap landing at a different address than in the process that built it.
+ */
+static int heap_reopen(void)
+{
+    heap_hdr_t *hdr = mem_heap_lo();
+    long nfree;
+    int error = 0;
+
+    if (mem_heapsize() < HEAP_HDR_SIZE + 4*WSIZE || hdr->magic != HEAP_MAGIC ||
+        hdr->version != HEAP_VERSION || hdr->hdr_size != HEAP_HDR_SIZE)
+        return -1;
+    heap_lock_init(hdr);
+    pthread_mutex_lock(&hdr->lock);
+    heap_hdr = hdr;
+    heap_listp = heap_base + HEAP_HDR_SIZE + 2*WSIZE;
+    tag_stats = hdr->tag_stats;
+    heap_load();
+
+    nfree = heap_validate();
+    if (!hdr->clean || nfree != (long)free_count + (wilderness_p != NULL)) {
+        heap_repair();
+        if (heap_validate() < 0)
+            error = -1;
+    }
+    hdr->clean = 0;
+    heap_unlock();
+    return error;
+}
+
+/* Function: heap_validate
+ * Description: Walks the heap once and returns how many free blocks it holds, or -1 if the
+ *              prologue is damaged, a block is misaligned, too small, runs past the brk or
+ *              has a footer that disagrees with its header, or the walk does not end at an
+ *              epilogue at the brk.
+ */
+static long heap_validate(void)
+{
+    char *bp;
+    char *end = (char *)mem_heap_hi() + 1;
+    size_t size;
+    long nfree = 0;
+
+    if (GET(HDRP(heap_listp)) != PACK(DSIZE, 1) || GET(FTRP(heap_listp)) != PACK(DSIZE, 1))
+        return -1;
+    for (bp = heap_listp + DSIZE; bp < end && GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        size = GET_SIZE(HDRP(bp));
+        if (((unsigned long)bp & 0x7) != 0 || size < MIN_BLOCK_SIZE || bp + size > end ||
+            GET(HDRP(bp)) != GET(FTRP(bp)))
+            return -1;
+        if (!GET_ALLOC(HDRP(bp)))
+            nfree++;
+    }
+    if (bp != end || GET(HDRP(bp)) != PACK(0, 1))
+        return -1;
+    return nfree;
+}
+
+/* Function: heap_repair
+ * Called with the lock of a shared heap taken over from a process that died holding it.
+ * Every operation writes a block's boundary tags before it touches the free lists, so a
+ * process that dies between the two leaves a heap that can still be walked by its headers
+ * but lists that cannot be trusted. (One that dies between the header writes of a split
+ * leaves nothing to repair from.)
+ * 1. Forget the free lists, the wilderness and the fit caches.
+ * 2. Walk the heap by its headers, rewriting each allocated block's footer, and file every
+ *    run of free blocks again as one block, merging neighbours that a half-finished
+ *    coalesce left apart.
+ * 3. If the walk stops short of the brk, the process died in extend_heap after mem_sbrk:
+ *    the space from the epilogue to the brk joins the last run. Either way the epilogue
+ *    header is written again.
+ */
+static void heap_repair(void)
+{
+    char *bp, *run = NULL;
+    char *end = (char *)mem_heap_hi() + 1;
+    size_t size;
+    int a;
+
+    free_list_startp = NULL;
+    wilderness_p = NULL;
+    fit_rover = NULL;
+    fit_floor = (size_t)-1;
+    free_count = 0;
+    for (a = 0; a < NARENAS; a++)
+        arenas[a].free_list = NULL;
+
+    for (bp = heap_listp + DSIZE; bp < end && GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (!GET_ALLOC(HDRP(bp))) {
+            if (run == NULL)
+                run = bp;
+            continue;
+        }
+        PUT(FTRP(bp), GET(HDRP(bp)));
+        if (run != NULL) {
+            size = bp - run;
+            PUT(HDRP(run), PACK(size, 0));
+            PUT(FTRP(run), PACK(size, 0));
+            link_free(run);
+            run = NULL;
+        }
+    }
+    if (bp + DSIZE <= end) {
+        if (run == NULL)
+            run = bp;
+        bp = end;
+    }
+    PUT(HDRP(bp), PACK(0, 1));
+    if (run != NULL) {
+        size = bp - run;
+        PUT(HDRP(run), PACK(size, 0));
+        PUT(FTRP(run), PACK(size, 0));
+        link_free(run);
+    }
+    stats.heap_repairs++;
+}
+
+/* Function: maint_main
+ * Body of the maintenance thread. Each tick:
+ * 1. Pre-fault the reserve past the brk. mem_prefault never changes memory contents, so
+ *    it runs without the lock even if mm_malloc is extending the heap into that range.
+ * 2. Purge idle free blocks under the lock (see maint_purge).
+ * 3. Sleep until extend_heap signals or the tick expires.
+ */
+static void *maint_main(void *arg)
+{
+    struct timespec deadline;
+    size_t reserve;
+
+    pthread_mutex_lock(&maint_lock);
+    while (!maint_stop) {
+        pthread_mutex_unlock(&maint_lock);
+        reserve = 2 * mem_recent_growth();
+        if (reserve < MAINT_RESERVE_MIN)
+            reserve = MAINT_RESERVE_MIN;
+        if (reserve > MAINT_RESERVE_MAX)
+            reserve = MAINT_RESERVE_MAX;
+        mem_prefault(reserve);
+        pthread_mutex_lock(&maint_lock);
+
+        if (heap_listp != NULL && (heap_hdr == NULL || heap_lock() == 0)) {
+            maint_purge();
+            if (heap_hdr != NULL)
+                heap_unlock();
+        }
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += MAINT_TICK_NS;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        if (!maint_stop)
+            pthread_cond_timedwait(&maint_cond, &maint_lock, &deadline);
+    }
+    pthread_mutex_unlock(&maint_lock);
+    return arg;
+}
+
+/* Function: maint_purge
+ * Called with maint_lock held, and in a shared heap with its lock too.
+ * 1. Walk the free list looking at blocks of at least MAINT_PURGE_MIN bytes.
+ * 2. A block without IDLE_MARK is seen for the first time: mark it and move on.
+ * 3. A block that still has IDLE_MARK has not been split, coalesced or reallocated since the
+ *    last tick, so purge its pages. The first and last words hold the boundary tags and the
+ *    list links, so mem_purge only drops whole pages strictly inside the payload area.
+ *    PURGED_MARK then keeps the block from being purged again.
+ */
+static void maint_purge(void)
+{
+    char *bp;
+    unsigned int hdr;
+
+    for (bp = free_list_startp; bp != NULL; bp = GET_NEXT(bp)) {
+        if (GET_SIZE(HDRP(bp)) < MAINT_PURGE_MIN)
+            continue;
+        hdr = GET(HDRP(bp));
+        if (!(hdr & IDLE_MARK)) {
+            PUT(HDRP(bp), hdr | IDLE_MARK);
+            PUT(FTRP(bp), hdr | IDLE_MARK);
+        }
+        else if (!(hdr & PURGED_MARK)) {
+            mem_purge(bp + DSIZE, GET_SIZE(HDRP(bp)) - 2*DSIZE);
+            PUT(HDRP(bp), hdr | PURGED_MARK);
+            PUT(FTRP(bp), hdr | PURGED_MARK);
+        }
+    }
+
+    /* Cold free space is purged on sight, whatever its size */
+    for (bp = arenas[ARENA_COLD].free_list; bp != NULL; bp = GET_NEXT(bp)) {
+        hdr = GET(HDRP(bp));
+        if (!(hdr & PURGED_MARK)) {
+            mem_purge(bp + DSIZE, GET_SIZE(HDRP(bp)) - 2*DSIZE);
+            PUT(HDRP(bp), hdr | IDLE_MARK | PURGED_MARK);
+            PUT(FTRP(bp), hdr | IDLE_MARK | PURGED_MARK);
+        }
+    }
+}
+
+/* Function: tag_account
+ * 1. Add delta (positive for an allocation, negative for a free) block bytes to the
+ *    tag's live bytes and bump the matching operation counter.
+ * 2. If the allocation moved live bytes from at or below the soft limit to above it,
+ *    call the tag's limit callback. Firing only on the crossing keeps the callback
+ *    from running on every allocation while the tag stays over budget.
+ */
+static void tag_account(unsigned int tag, long delta)
+{
+    mm_tag_stats_t *ts = &tag_stats[tag];
+    size_t before = ts->live_bytes;
+
+    ts->live_bytes += delta;
+    if (delta < 0) {
+        ts->frees++;
+        return;
+    }
+
+    ts->mallocs++;
+    if (ts->live_bytes > ts->peak_bytes)
+        ts->peak_bytes = ts->live_bytes;
+    if (tag_limit[tag] && before <= tag_limit[tag] && ts->live_bytes > tag_limit[tag]
+        && tag_limit_fn[tag])
+        tag_limit_fn[tag](tag, ts->live_bytes, tag_limit[tag]);
+}
+
+/* Function: tag_resize
+ * 1. Move the tag's live bytes from a block's oldsize to its newsize after an in-place
+ *    realloc. The block stays the same allocation, so the operation counters do not move.
+ * 2. Call the limit callback as tag_account does, only if the resize crossed the limit.
+ */
+static void tag_resize(unsigned int tag, size_t oldsize, size_t newsize)
+{
+    mm_tag_stats_t *ts = &tag_stats[tag];
+    size_t before = ts->live_bytes;
+
+    ts->live_bytes = before - oldsize + newsize;
+    if (ts->live_bytes > ts->peak_bytes)
+        ts->peak_bytes = ts->live_bytes;
+    if (tag_limit[tag] && before <= tag_limit[tag] && ts->live_bytes > tag_limit[tag]
+        && tag_limit_fn[tag])
+        tag_limit_fn[tag](tag, ts->live_bytes, tag_limit[tag]);
+}
+
+/* Function: lt_class
+ * Description: Returns the lifetime class of an asize-byte block from call site site. Sizes up
+ *              to LT_SMALL get a class each, larger ones share one per power of 2.
+ */
+static unsigned int lt_class(size_t asize, unsigned int site)
+{
+    unsigned int cls;
+
+    if (asize <= LT_SMALL)
+        cls = asize / DSIZE;
+    else
+        for (cls = LT_SMALL/DSIZE; asize > LT_SMALL; asize >>= 1)
+            cls++;
+    return (cls + site * LT_SITE_MIX) % LT_CLASSES;
+}
+
+/* Function: lt_predict_long
+ * Description: A class is predicted long-lived once its blocks have been seen to live at
+ *              least 1.5 times as long as the average block. Classes never observed are not.
+ */
+static int lt_predict_long(unsigned int cls)
+{
+    if (lt_n[cls] == 0 || lt_total_n == 0)
+        return 0;
+    return 2 * lt_sum[cls] * lt_total_n >= 3 * lt_total_sum * lt_n[cls];
+}
+
+/* Function: lt_birth
+ * Description: Starts tracking the sampled block bp. A block still live in the slot it
+ *              replaces has lived at least its current age, which is recorded as its lifetime
+ *              so that blocks that are never freed still count as long-lived.
+ */
+static void lt_birth(void *bp, unsigned int cls)
+{
+    unsigned int slot = ((unsigned long)bp / DSIZE) & (LT_TRACK - 1);
+
+    stats.lt_sampled++;
+    if (lt_track[slot].bp != NULL)
+        lt_observe(lt_track[slot].cls, lt_clock - lt_track[slot].birth);
+    lt_track[slot].bp = bp;
+    lt_track[slot].birth = lt_clock;
+    lt_track[slot].cls = cls;
+}
+
+/* Function: lt_death
+ * Description: Records the lifetime of bp, which is being freed, if it was sampled.
+ */
+static void lt_death(void *bp)
+{
+    unsigned int slot = ((unsigned long)bp / DSIZE) & (LT_TRACK - 1);
+
+    if (lt_track[slot].bp == bp) {
+        lt_observe(lt_track[slot].cls, lt_clock - lt_track[slot].birth);
+        lt_track[slot].bp = NULL;
+    }
+}
+
+/* Function: lt_observe
+ * Description: Adds one observed lifetime to class cls and to the overall average. A class's
+ *              history is halved every LT_DECAY observations so that it follows phase changes.
+ */
+static void lt_observe(unsigned int cls, unsigned long life)
+{
+    lt_sum[cls] += life;
+    lt_total_sum += life;
+    lt_total_n++;
+    if (++lt_n[cls] >= LT_DECAY) {
+        lt_total_sum -= lt_sum[cls] / 2;
+        lt_total_n -= lt_n[cls] / 2;
+        lt_sum[cls] /= 2;
+        lt_n[cls] /= 2;
+    }
+    if (lt_total_n % LT_REFRESH == 0)
+        lt_refresh();
+    else
+        lt_long[cls] = lt_predict_long(cls);
+}
+
+/* Function: lt_refresh
+ * Description: Recomputes the cached prediction of every class, since a change in the overall
+ *              average can move classes that have not been observed lately.
+ */
+static void lt_refresh(void)
+{
+    unsigned int cls;
+
+    for (cls = 0; cls < LT_CLASSES; cls++)
+        lt_long[cls] = lt_predict_long(cls);
+}
+
+/* Function: arena_of
+ * Description: Returns the arena that block bp lies in, or -1 for the main heap.
+ */
+static int arena_of(void *bp)
+{
+    int a;
+
+    for (a = 0; a < NARENAS; a++)
+        if ((char *)bp >= arenas[a].lo && (char *)bp < arenas[a].hi)
+            return a;
+    return -1;
+}
+
+/* Function: arena_create
+ * Description: Creates arena a at the end of the heap. Returns -1 if the heap cannot grow.
+ * 1. Choose where the arena's one free block starts: two fence blocks past the current end
+ *    of the heap (the wilderness, or the epilogue if there is none), rounded up so that its
+ *    payload is aligned for huge pages (hot) or pages (cold).
+ * 2. Extend the heap to the end of the arena plus its closing fence.
+ * 3. Lay out, from where the wilderness started: a free pad block up to the alignment, the
+ *    opening fence, the arena block, the closing fence and a new epilogue. The pad goes on the
+ *    main free list (its neighbours are allocated) and the arena block on the arena's list.
+ *    The heap is left without a wilderness, so the next extension starts after the arena.
+ * 4. Ask for the hot arena to be backed by huge pages.
+ */
+static int arena_create(int a)
+{
+    size_t size = (a == ARENA_HOT) ? HOT_ARENA_SIZE : COLD_ARENA_SIZE;
+    size_t align = (a == ARENA_HOT) ? HOT_ARENA_ALIGN : mem_pagesize();
+    char *start, *in, *end; /* headers of the pad block, the arena block and the epilogue */
+    size_t pad;
+
+    start = wilderness_p ? HDRP(wilderness_p) : (char *)mem_heap_hi() + 1 - WSIZE;
+    in = (char *)ROUNDUP((unsigned long)start + 2*FENCE_SIZE + WSIZE, align) - WSIZE;
+    pad = in - FENCE_SIZE - start;
+    end = in + size + FENCE_SIZE;
+    if (mem_sbrk(end + WSIZE - ((char *)mem_heap_hi() + 1)) == (void *)-1)
+        return -1;
+
+    if (wilderness_p != NULL)
+        unlink_free(wilderness_p);
+    PUT(start, PACK(pad, 0));                             /* Pad block */
+    PUT(start + pad - WSIZE, PACK(pad, 0));
+    PUT(in - FENCE_SIZE, PACK(FENCE_SIZE, 1));            /* Opening fence */
+    PUT(in - WSIZE, PACK(FENCE_SIZE, 1));
+    PUT(in, PACK(size, 0));                               /* Arena block */
+    PUT(in + size - WSIZE, PACK(size, 0));
+    PUT(in + size, PACK(FENCE_SIZE, 1));                  /* Closing fence */
+    PUT(end - WSIZE, PACK(FENCE_SIZE, 1));
+    PUT(end, PACK(0, 1));                                 /* New epilogue header */
+
+    arenas[a].lo = in + WSIZE;
+    arenas[a].hi = in + size;
+    stats.arenas++;
+    link_free(start + WSIZE);
+    link_free(in + WSIZE);
+    if (a == ARENA_HOT)
+        mem_hugepage(in + WSIZE, size);
+    return 0;
+}
+
+/* Function: arena_retire
+ * Description: Stops using arena a. Its blocks become ordinary main heap blocks (the fences
+ *              stay allocated), and its free blocks move to the main free list.
+ */
+static void arena_retire(int a)
+{
+    char *bp = arenas[a].free_list, *next;
+
+    arenas[a].lo = arenas[a].hi = arenas[a].free_list = NULL;
+    for (; bp != NULL; bp = next) {
+        next = GET_NEXT(bp);
+        free_count--;
+        insert_into_free_list(bp);
+    }
+}
+
+/* Function: arena_fit
+ * Description: First-fit search of arena a's free list. Blocks are carved from the bottom of
+ *              the fit, so the arena fills from its start and its blocks stay packed. On a
+ *              miss, *free_bytes is set to the arena's total free space.
+ */
+static void *arena_fit(int a, size_t asize, size_t *free_bytes)
+{
+    char *bp;
+
+    *free_bytes = 0;
+    for (bp = arenas[a].free_list; bp != NULL; bp = GET_NEXT(bp)) {
+        if (asize <= GET_SIZE(HDRP(bp)))
+            return bp;
+        *free_bytes += GET_SIZE(HDRP(bp));
+    }
+    return NULL;
+}
+
+/* Function: adjust_size
+ * Description: Returns the block size for a request of size payload bytes: the payload plus
+ *              header and footer, rounded up to a multiple of 8 and at least 16 bytes.
+ */
+static size_t adjust_size(size_t size)
+{
+    return MM_BLOCK_SIZE(size);
+}
+
+/* Function: trim_block
+ * Description: Shrinks the allocated block bp to asize bytes if the tail is big enough to be
+ *              a block of its own (16 bytes). The tail is freed and coalesced with whatever
+ *              follows it. The block keeps its tag and marks.
+ */
+static void trim_block(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    unsigned int keep = GET(HDRP(bp)) & ~SIZE_MASK;
+    char *tail;
+
+    if (csize - asize < 2*DSIZE)
+        return;
+    PUT(HDRP(bp), asize | keep);
+    PUT(FTRP(bp), asize | keep);
+    MMT_EVENT(MMT_SPLIT, csize-asize, bp, asize);
+    tail = NEXT_BLKP(bp);
+    PUT(HDRP(tail), PACK(csize-asize, 0));
+    PUT(FTRP(tail), PACK(csize-asize, 0));
+    coalesce(tail);
+}
+
+/* Function: grow_size
+ * Description: Returns how many bytes to extend the heap by when the wilderness is deficit
+ *              bytes short of a request.
+ * 1. Fold the deficit into grow_demand, a running average of recent shortfalls.
+ * 2. Round the deficit up to a granularity of a quarter of that average, kept between
+ *    DSIZE and CHUNKSIZE. A run of small requests then grows the heap a few bytes at a time,
+ *    while a run of large ones gets enough slack that the next few fit without another
+ *    extension. The overshoot never exceeds one granule.
+ */
+static size_t grow_size(size_t deficit)
+{
+    size_t gran;
+
+    grow_demand = grow_demand ? (3*grow_demand + deficit) / 4 : deficit;
+    gran = ROUNDUP(grow_demand / 4, DSIZE);
+    if (gran < DSIZE)
+        gran = DSIZE;
+    if (gran > CHUNKSIZE)
+        gran = CHUNKSIZE;
+    return ROUNDUP(deficit, gran);
+}
+
 /* Function: extend_heap
  * 1. Adjust size (in words) to an even number to help maintain alignment
  * 2. Call mem_sbrk (library function) to extend the heap by size bytes. If this
@@ -387,7 +2503,8 @@ static int mm_check()
  * 3. Set the new free block's header and footer with the new size. The header is the
  *    epilogue of the old heap.
  * 4. Set the new epilogue header with size 0 and allocation bit 1.
- * 5. Coalesce the new block if the previous block was free.
+ * 5. Coalesce the new block if the previous block was free. Either way the result ends at
+ *    the epilogue, so it becomes the wilderness.
  * 6. Return a pointer to the new block.
  */
 static void *extend_heap(size_t words)
@@ -404,6 +2521,11 @@ static void *extend_heap(size_t words)
     PUT(HDRP(bp), PACK(size, 0));         /* Free block header */
     PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+    MMT_EVENT(MMT_EXTEND, 0, bp, size);
+
+    /* Let the maintenance thread replenish the pre-faulted reserve */
+    if (maint_running)
+        pthread_cond_signal(&maint_cond);
     
     /* Coalesce if the previous block was free */
     bp = coalesce(bp);
@@ -415,56 +2537,195 @@ static void *extend_heap(size_t words)
  * Checks: two cases (split and no split)
  * 1. If the difference between the desired size and free block size is greater than minimum
  *    block size (16 bytes), split the block.
- *    A) Update the header and new footer of the free block with the desired size.
- *    B) Remove the current block from the free list. Move the block pointer to point to the next
- *       block, aka the remainder block.
- *    C) Update the header and footer of the remainder block to the remainder size. If place was
- *       called after extend_heap (coal = 1), call coalesce. If place was called after find_fit (coal = 0),
- *       simply insert the block into the free list.
- * 2. Otherwise, allocate the block by updating the header and footer and remove it from the free list.
+ *    A) Unlink the current block (from the free list, or as the wilderness).
+ *    B) Normally the allocated part is the bottom of the block: update its header and footer
+ *       with the desired size and move to the next block, aka the remainder block. If high is
+ *       set (a predicted long-lived block), the allocated part is the top of the block and
+ *       the remainder stays at bp.
+ *    C) Update the header and footer of the remainder block to the remainder size and file it,
+ *       which makes a remainder carved from the wilderness the new wilderness.
+ * 2. Otherwise, allocate the block by updating the header and footer and unlink it.
+ * Returns a pointer to the allocated block.
  */
-static void place(void *bp, size_t asize, char coal)
+static void *place(void *bp, size_t asize, int high)
 {
     size_t csize = GET_SIZE(HDRP(bp));
+    char *rp;  /* remainder */
+
+    unlink_free(bp); /* remove allocated block from free list or wilderness */
 
     /* if remainder is greater than or equal to minimum block size, split the free block into
        the allocated portion and the free portion */
     if ((csize - asize) >= (2*DSIZE)) {
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
-        remove_from_free_list(bp);      /* remove allocated block from free list */
-        bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize-asize, 0));
-        PUT(FTRP(bp), PACK(csize-asize, 0));
-        
-        if (coal == 1) /* only called when place is used after extend heap */
-            coalesce(bp);
-        else {
-            insert_into_free_list(bp);
+        if (high) {
+            rp = bp;
+            PUT(HDRP(rp), PACK(csize-asize, 0));
+            bp = NEXT_BLKP(rp);
+            PUT(HDRP(bp), PACK(asize, 1));
+            PUT(FTRP(bp), PACK(asize, 1));
+            PUT(FTRP(rp), PACK(csize-asize, 0));
+        } else {
+            PUT(HDRP(bp), PACK(asize, 1));
+            PUT(FTRP(bp), PACK(asize, 1));
+            rp = NEXT_BLKP(bp);
+            PUT(HDRP(rp), PACK(csize-asize, 0));
+            PUT(FTRP(rp), PACK(csize-asize, 0));
         }
+        MMT_EVENT(MMT_SPLIT, csize-asize, bp, asize);
+        ep.splits++;
+        link_free(rp);
     } else {
         PUT(HDRP(bp), PACK(csize, 1));
         PUT(FTRP(bp), PACK(csize, 1));
-        remove_from_free_list(bp);      /* remove allocated block from free list */
     }
+    return bp;
 }
 
 /*
  *  * Function: find_fit
- *   * 1. Using first-fit search, traverse the free list to find a block that is asize or larger.
- *    * 2. If a block is found, return the pointer to that block. If no block is found, return NULL.
+ *   * 1. If an earlier search for a block no larger than asize missed and no block at least that
+ *    *    large has joined the free list since (fit_floor), this search must miss too.
+ *   * 2. Traverse the free list for a block that is asize or larger using fit_policy:
+ *    *    - first-fit returns the first such block from the start of the list;
+ *    *    - next-fit does the same, but starts where the previous search stopped (fit_rover)
+ *    *      and wraps around to it;
+ *    *    - best-fit returns the smallest of the first FIT_BEST_K such blocks, or an exact fit
+ *    *      as soon as it is seen.
+ *    * 3. Skip blocks that directly follow a block with REALLOC_MARK, so that a growing block
+ *    *    can expand into them; use the first of them only if nothing else fits.
+ *    * 4. If a block is found, return the pointer to that block. If no block is found, lower
+ *    *    fit_floor to asize and return NULL.
  *     */
 static void *find_fit(size_t asize)
 {
-    /* First-fit search */
-    void *bp;
-    
-    for (bp = free_list_startp; bp != NULL; bp = GET_NEXT(bp)) {
-        if (asize <= GET_SIZE(HDRP(bp))) {
-            return bp;
+    void *bp, *start;
+    void *best = NULL;     /* smallest fit so far (best-fit) */
+    void *fallback = NULL; /* first fit that sits right after a growing block */
+    unsigned int nfits = 0, depth = 0;
+    size_t bsize;
+
+    /* Every listed block is smaller than fit_floor, so larger requests cannot fit */
+    if (asize >= fit_floor) {
+        MMT_EVENT(MMT_FIT, 0, NULL, asize);
+        return NULL;
+    }
+
+    start = (fit_policy == MM_FIT_NEXT && fit_rover != NULL) ? fit_rover : free_list_startp;
+    bp = start;
+    while (bp != NULL) {
+        depth++;
+        bsize = GET_SIZE(HDRP(bp));
+        if (asize <= bsize) {
+            /* Leave room for a growing block to expand into, unless nothing else fits */
+            if (GROWING((char *)bp - DSIZE)) {
+                if (fallback == NULL)
+                    fallback = bp;
+            }
+            else if (fit_policy != MM_FIT_BEST) {
+                best = bp;
+                break;
+            }
+            else {
+                if (best == NULL || bsize < GET_SIZE(HDRP(best)))
+                    best = bp;
+                if (bsize == asize || ++nfits == FIT_BEST_K)
+                    break;
+            }
         }
+
+        /* Next-fit wraps around to the start of the list and stops where it began */
+        if ((bp = GET_NEXT(bp)) == NULL && start != free_list_startp)
+            bp = free_list_startp;
+        if (bp == start)
+            break;
     }
-    return NULL; /* No fit */
+    ep.depth += depth;
+
+    if (best == NULL && (best = fallback) == NULL)
+        fit_floor = asize;
+    if (fit_policy == MM_FIT_NEXT)
+        fit_rover = best; /* moves on to its successor when best leaves the list */
+    MMT_EVENT(MMT_FIT, depth, best, asize);
+    return best; /* NULL if no fit */
+}
+
+/* Function: fit_epoch
+ * Description: Ends a telemetry epoch and, unless a policy is pinned, picks the fit policy
+ *              for the next one.
+ * 1. Compute the entropy of the request sizes (in bits, over power-of-2 buckets), the mean
+ *    free list length, the split rate and the mean search depth of the epoch.
+ * 2. A short free list makes every policy cheap and alike: use first-fit.
+ * 3. If most fits had to be split, or the sizes are spread widely (entropy of 2 bits or
+ *    more), the fits are poor: use best-fit to keep the large blocks whole.
+ * 4. Otherwise most fits are good fits, and a long search is the main cost: use next-fit if
+ *    searches have been deep, first-fit otherwise.
+ * 5. Record a change of policy in the stats' switch log.
+ */
+static void fit_epoch(void)
+{
+    unsigned int entropy, i;
+    unsigned long free_len, split_pct, depth;
+    unsigned long sum = 0;
+    int policy;
+
+    /* H = log2(N) - sum(c * log2(c)) / N, in 1/256 bits */
+    for (i = 0; i < FIT_NBUCKETS; i++)
+        if (ep.size_hist[i] > 1)
+            sum += ep.size_hist[i] * log2_q8(ep.size_hist[i]);
+    entropy = log2_q8(ep.mallocs) - sum / ep.mallocs;
+    free_len = ep.free_len / ep.mallocs;
+    split_pct = 100 * ep.splits / ep.mallocs;
+    depth = ep.depth / ep.mallocs;
+    stats.fit_epochs++;
+
+    if (fit_pinned != MM_FIT_ADAPTIVE)
+        policy = fit_pinned;
+    else if (free_len < FIT_BEST_K)
+        policy = MM_FIT_FIRST;
+    else if (split_pct >= 50 || entropy >= 2*256)
+        policy = MM_FIT_BEST;
+    else if (depth >= FIT_BEST_K)
+        policy = MM_FIT_NEXT;
+    else
+        policy = MM_FIT_FIRST;
+
+    if (policy != fit_policy) {
+        mm_fit_switch_t *sw = &stats.fit_log[stats.fit_switches % MM_FIT_LOG];
+
+        sw->epoch = stats.fit_epochs;
+        sw->from = fit_policy;
+        sw->to = policy;
+        sw->entropy = entropy * 100 / 256;
+        sw->free_len = free_len;
+        sw->split_pct = split_pct;
+        stats.fit_switches++;
+        fit_policy = stats.fit_policy = policy;
+        fit_rover = NULL;
+    }
+    memset(&ep, 0, sizeof(ep));
+}
+
+/* Function: log2_q8
+ * Description: Returns log2(x) for x >= 1 in fixed point with 8 fractional bits, so that
+ *              the fit telemetry needs no floating point.
+ */
+static unsigned int log2_q8(unsigned long x)
+{
+    unsigned int n = 0, i;
+    unsigned long long y;
+
+    while (x >> (n + 1))
+        n++;
+    y = ((unsigned long long)x << 16) >> n; /* x / 2^n in [1, 2), 16 fractional bits */
+    for (i = 0; i < 8; i++) {
+        y = (y * y) >> 16;
+        n <<= 1;
+        if (y >= (2ULL << 16)) {
+            y >>= 1;
+            n |= 1;
+        }
+    }
+    return n;
 }
 
 /* Function: insert_into_free_list
@@ -478,17 +2739,58 @@ static void *find_fit(size_t asize)
  */
 static void insert_into_free_list(void *bp)
 {
-    SET_NEXT(bp, free_list_startp); /* bp comes before current start block */
+    char **startp = free_list_head(bp); /* free_list_startp, or an arena's list */
+
+    if (startp == &free_list_startp && GET_SIZE(HDRP(bp)) >= fit_floor)
+        fit_floor = (size_t)-1;     /* a request that missed before might fit now */
+
+    free_count++;
+    SET_NEXT(bp, *startp);          /* bp comes before current start block */
     SET_PREV(bp, NULL);             /* bp has no previous block (at top) */
     
-    if (free_list_startp == NULL) { /* if list initially empty, */
-        free_list_startp = bp;
+    if (*startp == NULL) {          /* if list initially empty, */
+        *startp = bp;
         return;
     }
     
     /* list not empty, startp is a valid pointer */
-    SET_PREV(free_list_startp, bp); /* current start block comes after bp */
-    free_list_startp = bp;          /* point start pointer to bp which is new start */
+    SET_PREV(*startp, bp);          /* current start block comes after bp */
+    *startp = bp;                   /* point start pointer to bp which is new start */
+}
+
+/* Function: free_list_head
+ * Description: Returns the head of the list that the free block bp belongs on: its arena's
+ *              list if it lies in one, free_list_startp otherwise.
+ */
+static char **free_list_head(void *bp)
+{
+    int a = arena_of(bp);
+
+    return (a < 0) ? &free_list_startp : &arenas[a].free_list;
+}
+
+/* Function: link_free
+ * Description: Files the free block bp. The block that ends at the epilogue is the wilderness:
+ *              it is tracked by wilderness_p instead of the free list, so find_fit never
+ *              returns it and it is only carved when no other free block fits.
+ */
+static void link_free(void *bp)
+{
+    if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0)
+        wilderness_p = bp;
+    else
+        insert_into_free_list(bp);
+}
+
+/* Function: unlink_free
+ * Description: Removes the free block bp from wherever link_free filed it.
+ */
+static void unlink_free(void *bp)
+{
+    if (bp == wilderness_p)
+        wilderness_p = NULL;
+    else
+        remove_from_free_list(bp);
 }
 
 /* Function: remove_from_free_list
@@ -501,11 +2803,17 @@ static void insert_into_free_list(void *bp)
  */
 static void remove_from_free_list(void *bp)
 {
-    /* Case 1: bp is the first block in the list */
+    free_count--;
+    if (bp == fit_rover)
+        fit_rover = GET_NEXT(bp);
+
+    /* Case 1: bp is the first block in the list (free_list_startp or an arena's) */
     if (!GET_PREV(bp)) {
-        free_list_startp = GET_NEXT(bp);
-        if (free_list_startp != NULL)
-            SET_PREV(free_list_startp, NULL);
+        char **startp = free_list_head(bp);
+
+        *startp = GET_NEXT(bp);
+        if (*startp != NULL)
+            SET_PREV(*startp, NULL);
     }
     /* Case 2: bp is the last block in the list */
     else if (GET_PREV(bp) && !GET_NEXT(bp)) {
@@ -1,9 +1,154 @@
+#ifndef __MM_H_
+#define __MM_H_
+
 #include <stdio.h>
 
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_check(void);
+extern int mm_snapshot(const char *path);
+extern int mm_maint_start(void);
+extern void mm_maint_stop(void);
+
+/*
+ * Shared heaps. After mem_init_shared, mm_init builds a heap that
+ * other processes join with mem_attach_shared and mm_attach. Blocks
+ * are passed between processes as offsets from the heap base.
+ *
+ * After mem_init_file, mm_init builds a heap in a file, or reopens
+ * the heap the file already holds. The root block leads a restarted
+ * process to its data; mm_shutdown lets the next mm_init skip the
+ * rebuild of the free lists.
+ *
+ * If the lock of a shared heap cannot be taken (it was left
+ * unrecoverable), allocations return NULL, calls that return a status
+ * return -1, and the others do nothing.
+ */
+extern int mm_attach(void);
+extern size_t mm_offset(void *ptr);
+extern void *mm_pointer(size_t offset);
+extern int mm_shutdown(void);
+extern void mm_set_root(void *ptr);
+extern void *mm_get_root(void);
+
+/*
+ * Fit policies. With MM_FIT_ADAPTIVE (the default) the allocator
+ * picks one of the others per epoch from its running statistics and
+ * logs each switch in mm_stats_t.
+ */
+#define MM_FIT_ADAPTIVE 0
+#define MM_FIT_FIRST    1   /* first fit from the start of the free list */
+#define MM_FIT_NEXT     2   /* first fit from where the last search stopped */
+#define MM_FIT_BEST     3   /* smallest of the first few fits */
+#define MM_FIT_LOG      16  /* switches kept in mm_stats_t.fit_log */
+
+typedef struct {
+    unsigned long epoch;    /* epoch that ended with the switch */
+    int from, to;           /* MM_FIT_xxx */
+    unsigned int entropy;   /* entropy of the epoch's request sizes, in 1/100 bits */
+    unsigned int free_len;  /* mean free list length over the epoch */
+    unsigned int split_pct; /* allocations that split their block, in percent */
+} mm_fit_switch_t;
+
+extern int mm_set_fit_policy(int policy);
+
+/* Allocator-wide counters, reset by mm_init */
+typedef struct {
+    unsigned long reallocs;         /* mm_realloc calls that resized an existing block */
+    unsigned long realloc_inplace;  /* ... without moving the payload */
+    unsigned long realloc_slid;     /* ... by sliding it into the free block before it */
+    unsigned long realloc_moved;    /* ... by copying it to a new block */
+    unsigned long long realloc_copied; /* payload bytes copied or slid by mm_realloc */
+    unsigned long lt_long;          /* allocations predicted long-lived (mm_set_lifetime) */
+    unsigned long lt_sampled;       /* allocations whose lifetime was tracked */
+    unsigned long hinted;           /* mm_malloc_hint calls served from their arena */
+    unsigned long hint_spills;      /* ... that fell back to the main heap */
+    unsigned long arenas;           /* hot and cold arenas created */
+    unsigned long heap_repairs;     /* shared heap locks taken over from a dead process */
+    unsigned long class_hits;       /* blocks taken from a class list instead of the heap */
+    unsigned long class_carves;     /* empty class lists refilled with a batch from the heap */
+    unsigned long tcache_refills;   /* thread cache misses refilled in a batch (mm_inline.h) */
+    unsigned long tcache_spills;    /* full thread caches halved back into the heap */
+    unsigned long cpu_refills;      /* per-CPU cache misses refilled in a batch (mm_malloc_cpu) */
+    unsigned long cpu_spills;       /* full per-CPU caches halved back into the heap */
+    int fit_policy;                 /* MM_FIT_xxx find_fit currently uses */
+    unsigned long fit_epochs;       /* telemetry epochs completed */
+    unsigned long fit_switches;     /* policy switches; the last MM_FIT_LOG are in fit_log */
+    mm_fit_switch_t fit_log[MM_FIT_LOG]; /* switch n is fit_log[n % MM_FIT_LOG] */
+} mm_stats_t;
+
+extern void mm_get_stats(mm_stats_t *stats);
+
+/* Free space in the heap right now, from a walk of the free lists */
+typedef struct {
+    size_t free_bytes;      /* bytes in free blocks, the wilderness included */
+    size_t largest_free;    /* size of the largest of them */
+    unsigned long free_blocks;
+    size_t class_bytes;     /* bytes in blocks the class lists keep for reuse */
+} mm_free_stats_t;
+
+extern void mm_get_free_stats(mm_free_stats_t *stats);
+
+/* Access hints for mm_malloc_hint */
+#define MM_HOT  1   /* touched on every request: packed into the hot arena */
+#define MM_COLD 2   /* rarely touched: kept in the cold arena, purged early */
+
+extern void *mm_malloc_hint(size_t size, int hint);
+
+/*
+ * Size classes. Every request size maps to the block size mm_malloc
+ * gives it: payload plus header and footer, rounded up to 8 bytes and
+ * at least 16. Class c holds blocks of (c + 2) * 8 bytes. For a
+ * constant size MM_CLASS is a constant, so callers of mm_malloc_class
+ * skip the rounding. Sizes over 512 bytes have no class.
+ */
+#define MM_BLOCK_SIZE(size) ((size) <= 8 ? 16 : (((size) + 15) / 8) * 8)
+#define MM_NCLASSES 64
+#define MM_CLASS(size) ((int)(MM_BLOCK_SIZE(size) / 8) - 2)
+
+extern void *mm_malloc_class(int cls);
+extern void mm_free_class(void *ptr, int cls);
+
+/*
+ * Per-CPU caches for sizes of 1 to 128 bytes, shared by all threads on
+ * a CPU through restartable sequences. mm_free_cpu needs the size the
+ * block was allocated with. Without rseq both use the calling thread's
+ * cache (mm_inline.h); mm_cpu_cache tells which. Private heaps used by
+ * several threads need mm_set_threads(1).
+ */
+extern void *mm_malloc_cpu(size_t size);
+extern void mm_free_cpu(void *ptr, size_t size);
+extern int mm_cpu_cache(void);
+extern void mm_set_threads(int on);
+
+/* Lifetime-segregated placement, off by default. Learned lifetimes survive mm_init. */
+extern void *mm_malloc_site(size_t size, unsigned int site);
+extern void mm_set_lifetime(int on);
+extern void mm_reset_lifetime(void);
+
+/*
+ * Tagged allocation accounting. Every block carries a small tag id
+ * (0 for plain mm_malloc) and the allocator keeps per-tag live-byte
+ * and operation counters. A tag may also have a soft limit whose
+ * callback fires when its live bytes rise above the limit. The
+ * callback runs with the heap locked, so it must not call mm_*.
+ */
+#define MM_NTAGS 16
+
+typedef struct {
+    size_t live_bytes;      /* block bytes currently allocated under this tag */
+    size_t peak_bytes;      /* high water mark of live_bytes */
+    unsigned long mallocs;  /* blocks allocated under this tag */
+    unsigned long frees;    /* blocks freed under this tag */
+} mm_tag_stats_t;
+
+typedef void (*mm_tag_limit_fn)(int tag, size_t live_bytes, size_t limit);
+
+extern void *mm_malloc_tagged(size_t size, int tag);
+extern void mm_set_tag_limit(int tag, size_t limit, mm_tag_limit_fn fn);
+extern void mm_get_tag_stats(int tag, mm_tag_stats_t *stats);
 
 
 /* 
@@ -21,3 +166,4 @@ typedef struct {
 
 extern team_t team;
 
+#endif /* __MM_H_ */
@@ -0,0 +1,108 @@
+/*
+ * mm_allocator.h - C++ allocator that puts standard containers on the mm heap
+ *
+ * mm_allocator<T> satisfies the standard Allocator requirements, so
+ * std::map<K, V, std::less<K>, mm_allocator<std::pair<const K, V> > >
+ * and friends allocate their nodes with mm_malloc. Node-based
+ * containers allocate one T at a time; since sizeof(T) is a constant,
+ * those requests go to the size class MM_CLASS(sizeof(T)) through
+ * mm_malloc_class and mm_free_class, skipping the size rounding and,
+ * when a node of the same type was freed recently, the fit search.
+ * Arrays and types too large for a class use mm_malloc and mm_free.
+ *
+ * The heap must be set up (mem_init, mm_init) before the first
+ * allocation. All instances are interchangeable: memory allocated
+ * through one can be freed through any other.
+ */
+#ifndef __MM_ALLOCATOR_H_
+#define __MM_ALLOCATOR_H_
+
+#include <cstddef>
+#include <new>
+
+extern "C" {
+#include "mm.h"
+}
+
+template <class T>
+class mm_allocator {
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <class U>
+    struct rebind {
+        typedef mm_allocator<U> other;
+    };
+
+    /* mm_malloc aligns payloads to 8 bytes only */
+    static_assert(alignof(T) <= 8, "mm_allocator cannot align beyond 8 bytes");
+
+    static constexpr int cls = MM_CLASS(sizeof(T));
+    static constexpr bool fixed = cls < MM_NCLASSES;
+
+    mm_allocator() noexcept {}
+    template <class U>
+    mm_allocator(const mm_allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        void *p;
+
+        if (n > static_cast<std::size_t>(-1) / sizeof(T))
+            throw std::bad_alloc();
+        p = (n == 1 && fixed) ? mm_malloc_class(cls) : mm_malloc(n * sizeof(T));
+        if (p == NULL)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept
+    {
+        if (n == 1 && fixed)
+            mm_free_class(p, cls);
+        else
+            mm_free(p);
+    }
+
+    std::size_t max_size() const noexcept
+    {
+        return static_cast<std::size_t>(-1) / sizeof(T);
+    }
+
+    template <class U, class... Args>
+    void construct(U *p, Args &&...args)
+    {
+        ::new (static_cast<void *>(p)) U(static_cast<Args &&>(args)...);
+    }
+
+    template <class U>
+    void destroy(U *p)
+    {
+        p->~U();
+    }
+};
+
+template <class T>
+constexpr int mm_allocator<T>::cls;
+template <class T>
+constexpr bool mm_allocator<T>::fixed;
+
+template <class T, class U>
+inline bool operator==(const mm_allocator<T> &, const mm_allocator<U> &) noexcept
+{
+    return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const mm_allocator<T> &, const mm_allocator<U> &) noexcept
+{
+    return false;
+}
+
+#endif /* __MM_ALLOCATOR_H_ */
@@ -0,0 +1,90 @@
+/*
+ * mm_inline.h - inlinable fast path for small allocations
+ *
+ * mm_malloc_inline and mm_free_inline keep a per-thread cache of
+ * freed blocks for each small size class and serve requests from it
+ * without a call into mm.c or a lock: a hit pops or pushes the head
+ * of a singly linked list in thread-local storage. When the size is a
+ * compile-time constant the class arithmetic and range check fold
+ * away, leaving about ten instructions. Anything else goes out of
+ * line: a miss refills the cache with a batch of blocks under one
+ * lock (mm_tcache_refill), and a free into a full cache returns half
+ * of it to the heap (mm_tcache_spill). The slow paths take the heap's
+ * lock even on a private heap, so threads that allocate only through
+ * these functions may share one; threads that also call mm_malloc and
+ * mm_free need mm_set_threads(1), as without the caches.
+ *
+ * Cached blocks stay marked allocated, as on the class lists of
+ * mm_free_class, and count as allocated to tag 0 until they are
+ * spilled. While the lifetime predictor is on (mm_set_lifetime) the
+ * caches are bypassed, since hits would not be seen by its clock:
+ * every request goes out of line to the heap, and each thread's
+ * cache is emptied the next time it is used.
+ *
+ * mm_free_inline needs the size the block was allocated with, and
+ * caches it only if its header is the untagged header mm_malloc
+ * gives that size; other blocks go to mm_free. A thread's cache
+ * belongs to the heap of the last mm_init or
+ * mm_attach: a new heap bumps mm_heap_gen, and each cache drops its
+ * blocks the next time it sees the new generation. A thread that
+ * exits should call mm_tcache_flush, or its cached blocks stay
+ * allocated.
+ */
+#ifndef __MM_INLINE_H_
+#define __MM_INLINE_H_
+
+#include <stddef.h>
+
+#include "mm.h"
+
+#define MM_TCACHE_CLASSES 16 /* classes cached per thread: requests of 1 to MM_TCACHE_MAX bytes */
+#define MM_TCACHE_MAX     (MM_TCACHE_CLASSES * 8)
+#define MM_TCACHE_KEEP    32 /* blocks cached per class before a spill */
+#define MM_TCACHE_BATCH   8  /* blocks fetched per class by a refill */
+
+/* One thread's cache. Blocks are linked through their first payload word. */
+typedef struct {
+    void *head[MM_TCACHE_CLASSES];
+    unsigned int count[MM_TCACHE_CLASSES];
+    unsigned long gen;      /* mm_heap_gen the cached blocks belong to */
+} mm_tcache_t;
+
+extern __thread mm_tcache_t mm_tcache;
+extern unsigned long mm_heap_gen;
+
+extern void *mm_tcache_refill(size_t size);
+extern void mm_tcache_spill(void *ptr, size_t size);
+extern void mm_tcache_flush(void);
+
+/* mm_malloc(size), served from this thread's cache when it can be */
+static inline void *mm_malloc_inline(size_t size)
+{
+    mm_tcache_t *tc = &mm_tcache;
+    int cls = MM_CLASS(size);
+    void *p;
+
+    if (size - 1 < MM_TCACHE_MAX && tc->gen == mm_heap_gen && (p = tc->head[cls]) != NULL) {
+        tc->head[cls] = *(void **)p;
+        tc->count[cls]--;
+        return p;
+    }
+    return mm_tcache_refill(size);
+}
+
+/* mm_free(ptr) for a block allocated with size bytes, kept in this thread's cache when it can be */
+static inline void mm_free_inline(void *ptr, size_t size)
+{
+    mm_tcache_t *tc = &mm_tcache;
+    int cls = MM_CLASS(size);
+
+    if (size - 1 < MM_TCACHE_MAX && tc->gen == mm_heap_gen && tc->count[cls] < MM_TCACHE_KEEP &&
+        ((unsigned int *)ptr)[-1] == MM_BLOCK_SIZE(size) + 1) {
+        *(void **)ptr = tc->head[cls];
+        tc->head[cls] = ptr;
+        tc->count[cls]++;
+        return;
+    }
+    mm_tcache_spill(ptr, size);
+}
+
+#endif /* __MM_INLINE_H_ */
@@ -0,0 +1,130 @@
+/*
+ * mmbtrace.h - binary trace format read by mdriver and written by mmconv
+ *
+ * A binary trace holds the same requests as a .rep file, laid out so
+ * that mdriver can mmap it and replay the ops where they lie: an
+ * mmbt_hdr_t carrying the four numbers of the .rep header, followed
+ * at hdr_size bytes by num_ops mmbt_op_t records. mdriver's traceop_t
+ * is an mmbt_op_t. Integers are in host byte order, so a trace
+ * written on a machine of the other endianness fails the magic check.
+ *
+ * mdriver checks the header, the file size and every op (a known
+ * type, an id below num_ids, a size of at least 0) before replaying a
+ * binary trace, since a file need not have come from mmconv. mmconv
+ * checks types and ids when it converts a .rep file, and also that the
+ * largest id used is num_ids - 1, as read_trace does for text traces.
+ *
+ * A streamed trace is for captures too large to hold in memory. After
+ * an mmbs_hdr_t, each op is a varint holding its type in the low two
+ * bits and, above them, the zigzag-coded difference between its id
+ * and the previous op's, followed for MMBT_ALLOC and MMBT_REALLOC by a
+ * varint size. Ids are slots: mmconv gives an allocated block the
+ * most recently freed slot, or a new one if none is free, so ids
+ * stay below num_slots, the most blocks ever live at once, and a
+ * replayer needs a table of only that many blocks. Most ops take two
+ * to four bytes.
+ */
+#ifndef __MMBTRACE_H_
+#define __MMBTRACE_H_
+
+#include <stdint.h>
+
+#define MMBT_MAGIC   0x54424d4d  /* "MMBT" */
+#define MMBT_VERSION 1
+
+/* mmbt_op_t types, the letters of a .rep line */
+#define MMBT_ALLOC   0           /* a <id> <size> */
+#define MMBT_FREE    1           /* f <id> */
+#define MMBT_REALLOC 2           /* r <id> <size> */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t hdr_size;      /* offset of the first op */
+    uint32_t op_size;       /* sizeof(mmbt_op_t) when written */
+    int32_t sugg_heapsize;  /* .rep header, in order */
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t weight;
+} mmbt_hdr_t;
+
+typedef struct {
+    int32_t type;           /* MMBT_xxx */
+    int32_t index;          /* block id */
+    int32_t size;           /* request bytes, 0 for MMBT_FREE */
+} mmbt_op_t;
+
+#define MMBS_MAGIC   0x53424d4d  /* "MMBS" */
+#define MMBS_VERSION 1
+#define MMBS_OP_MAX  10          /* bytes of the longest encoded op */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t hdr_size;      /* offset of the first op */
+    uint32_t num_slots;     /* ids are below this */
+    uint64_t num_ops;
+    int32_t sugg_heapsize;
+    int32_t weight;
+} mmbs_hdr_t;
+
+/* Writes op to p, given the previous op's id in *prev. Returns the bytes written. */
+static inline int mmbs_encode(unsigned char *p, const mmbt_op_t *op, int32_t *prev)
+{
+    int32_t delta = op->index - *prev;
+    uint64_t v = ((uint64_t)(((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31)) << 2) | op->type;
+    int n = 0, k;
+
+    for (k = 0; k < 2; k++) {
+        while (v >= 0x80) {
+            p[n++] = (unsigned char)(v | 0x80);
+            v >>= 7;
+        }
+        p[n++] = (unsigned char)v;
+        if (op->type == MMBT_FREE)
+            break;
+        v = (uint32_t)op->size;
+    }
+    *prev = op->index;
+    return n;
+}
+
+/*
+ * Reads one op from p into *op, given the previous op's id in *prev.
+ * Returns the bytes read, or 0 if the op runs past end or is not a
+ * well-formed op.
+ */
+static inline int mmbs_decode(const unsigned char *p, const unsigned char *end,
+                              mmbt_op_t *op, int32_t *prev)
+{
+    uint64_t v;
+    uint32_t z;
+    int n = 0, k, shift;
+
+    for (k = 0; k < 2; k++) {
+        v = 0;
+        for (shift = 0; ; shift += 7) {
+            if (p + n == end || shift > 28)
+                return 0;
+            v |= (uint64_t)(p[n] & 0x7f) << shift;
+            if (!(p[n++] & 0x80))
+                break;
+        }
+        if (k == 0) {
+            op->type = v & 3;
+            z = (uint32_t)(v >> 2);
+            op->index = (int32_t)((uint32_t)*prev + ((z >> 1) ^ -(z & 1)));
+            op->size = 0;
+            if (op->type == MMBT_FREE)
+                break;
+            if (op->type != MMBT_ALLOC && op->type != MMBT_REALLOC)
+                return 0;
+        }
+        else
+            op->size = (int32_t)v;
+    }
+    *prev = op->index;
+    return n;
+}
+
+#endif /* __MMBTRACE_H_ */
@@ -0,0 +1,380 @@
+/*
+ * mmcapture.c - Record a program's allocations as a capture for mmconv
+ *
+ * Built as mmcapture.so and preloaded into any program:
+ *
+ *     MMCAPTURE=app.cap LD_PRELOAD=./mmcapture.so app ...
+ *     mmconv app.cap app.bin
+ *
+ * writes app.cap (mmcapture.<pid>.cap without MMCAPTURE), and mmconv
+ * turns it into a binary trace mdriver can replay. The layout of a
+ * capture is in mmcapture.h. MMCAPTURE is taken out of the
+ * environment, so programs the captured one runs write captures of
+ * their own, under the default name, instead of overwriting it.
+ *
+ * The real functions are looked up with dlsym(RTLD_NEXT), and the
+ * allocations dlsym itself makes meanwhile come from a static boot
+ * heap. Each thread logs into a buffer of its own, mmap'd so that no
+ * allocation is logged, without taking a lock: a buffer is claimed
+ * with a compare-and-swap, pushed once onto a list of all buffers and
+ * handed to the next thread when its thread exits. A full buffer goes
+ * to the capture in one O_APPEND write, so chunks never interleave.
+ * Allocations made while logging, and in a forked child, which would
+ * otherwise log its parent's buffered events again, are not logged.
+ *
+ * Usage: MMCAPTURE=<file> LD_PRELOAD=./mmcapture.so <program> [args...]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "mmcapture.h"
+
+#define CAP_EVENTS 4096       /* events buffered per thread */
+#define BOOT_HEAP  65536      /* bytes for what dlsym allocates while we resolve */
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+/* A thread's buffer: the chunk header and its events, written out together */
+typedef struct buf {
+    struct buf *next;         /* on all_bufs */
+    int owned;                /* claimed by a live thread */
+    mmcp_chunk_t chunk __attribute__((aligned(8))); /* no gap before ev */
+    mmcp_event_t ev[CAP_EVENTS];
+} buf_t;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static void *(*real_memalign)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+
+static int fd = -1;           /* the capture, -1 while not logging */
+static buf_t *all_bufs;       /* every buffer ever made, pushed with CAS */
+static pthread_key_t buf_key; /* flushes a thread's buffer when it exits */
+static __thread buf_t *my_buf __attribute__((tls_model("initial-exec")));
+static __thread int busy __attribute__((tls_model("initial-exec")));
+
+static char boot_heap[BOOT_HEAP] __attribute__((aligned(16)));
+static size_t boot_used;
+static int resolving;
+
+/*
+ * boot_alloc - Hand out boot heap memory while dlsym is resolving
+ */
+static void *boot_alloc(size_t size, size_t align)
+{
+    size_t start = (boot_used + align - 1) & ~(align - 1);
+
+    if (start + size > BOOT_HEAP)
+        return NULL;
+    boot_used = start + size;
+    return boot_heap + start;
+}
+
+static int in_boot_heap(void *p)
+{
+    return (char *)p >= boot_heap && (char *)p < boot_heap + BOOT_HEAP;
+}
+
+/*
+ * resolve - Look up the functions we wrap. Returns -1 if called again
+ *     from inside dlsym, or if malloc cannot be found.
+ */
+static int resolve(void)
+{
+    if (resolving)
+        return -1;
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    resolving = 0;
+    return real_malloc && real_calloc && real_realloc && real_free ? 0 : -1;
+}
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * flush - Append b's events to the capture as one chunk
+ */
+static void flush(buf_t *b)
+{
+    char *p = (char *)&b->chunk;
+    size_t len = sizeof(mmcp_chunk_t) + b->chunk.count * sizeof(mmcp_event_t);
+    ssize_t n;
+
+    while (fd >= 0 && len > 0) {
+        if ((n = write(fd, p, len)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        p += n;
+        len -= n;
+    }
+    b->chunk.count = 0;
+}
+
+/*
+ * thread_exit - Flush an exiting thread's buffer and free it for reuse
+ */
+static void thread_exit(void *arg)
+{
+    buf_t *b = arg;
+
+    flush(b);
+    my_buf = NULL;
+    __atomic_store_n(&b->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * get_buf - This thread's buffer: one a finished thread left, or a new
+ *     one. Returns NULL if none can be had.
+ */
+static buf_t *get_buf(void)
+{
+    buf_t *b;
+
+    if (my_buf != NULL)
+        return my_buf;
+    for (b = __atomic_load_n(&all_bufs, __ATOMIC_ACQUIRE); b != NULL; b = b->next)
+        if (!b->owned && __sync_bool_compare_and_swap(&b->owned, 0, 1))
+            break;
+    if (b == NULL) {
+        if ((b = mmap(NULL, sizeof(buf_t), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+            return NULL;
+        b->owned = 1;
+        do
+            b->next = all_bufs;
+        while (!__sync_bool_compare_and_swap(&all_bufs, b->next, b));
+    }
+    b->chunk.magic = MMCP_CHUNK_MAGIC;
+    b->chunk.tid = (uint32_t)syscall(SYS_gettid);
+    b->chunk.count = 0;
+    my_buf = b;
+    pthread_setspecific(buf_key, b);
+    return b;
+}
+
+/*
+ * record - Log one event, timed at time (or now, if time is 0)
+ */
+static void record(int type, void *ptr, void *old, size_t size, uint64_t time)
+{
+    buf_t *b;
+    mmcp_event_t *e;
+
+    if (fd < 0 || busy)
+        return;
+    busy = 1;
+    if ((b = get_buf()) != NULL) {
+        e = &b->ev[b->chunk.count];
+        e->time = time ? time : now();
+        e->ptr = (uint64_t)(uintptr_t)ptr;
+        e->old = (uint64_t)(uintptr_t)old;
+        e->size = ((uint64_t)size << 2) | type;
+        if (++b->chunk.count == CAP_EVENTS)
+            flush(b);
+    }
+    busy = 0;
+}
+
+/*
+ * child - In a forked child, stop logging, since its buffers hold
+ *     events its parent will write
+ */
+static void child(void)
+{
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
+
+/*
+ * take_env - Remove MMCAPTURE from environ and return its value, or
+ *     NULL. Done by hand, since programs like bash bring their own
+ *     getenv and unsetenv that do not look at environ this early.
+ */
+static char *take_env(void)
+{
+    extern char **environ;
+    char **p, **q, *val = NULL;
+
+    for (p = q = environ; p != NULL && *p != NULL; p++) {
+        if (strncmp(*p, "MMCAPTURE=", 10) == 0)
+            val = *p + 10;
+        else
+            *q++ = *p;
+    }
+    if (q != NULL)
+        *q = NULL;
+    return val;
+}
+
+/*
+ * cap_init - Resolve the real functions and start the capture
+ */
+__attribute__((constructor))
+static void cap_init(void)
+{
+    static char path[4096];
+    char *env = take_env();
+    mmcp_hdr_t hdr;
+
+    if (real_malloc == NULL && resolve() < 0)
+        return;
+    if (env != NULL)
+        snprintf(path, sizeof(path), "%s", env);
+    else
+        snprintf(path, sizeof(path), "mmcapture.%d.cap", (int)getpid());
+    if (pthread_key_create(&buf_key, thread_exit) != 0)
+        return;
+    pthread_atfork(NULL, NULL, child);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+        perror(path);
+        return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MMCP_MAGIC;
+    hdr.version = MMCP_VERSION;
+    hdr.hdr_size = sizeof(hdr);
+    hdr.event_size = sizeof(mmcp_event_t);
+    hdr.pid = getpid();
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+/*
+ * cap_fini - Flush every buffer at exit, those of threads still
+ *     running included, and stop logging
+ */
+__attribute__((destructor))
+static void cap_fini(void)
+{
+    buf_t *b;
+
+    busy = 1;
+    for (b = all_bufs; b != NULL; b = b->next)
+        if (b->chunk.count > 0)
+            flush(b);
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL && resolve() < 0)
+        return boot_alloc(size, 16);
+    p = real_malloc(size);
+    if (p != NULL)
+        record(MMCP_MALLOC, p, NULL, size, 0);
+    return p;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL && resolve() < 0) {
+        if (size != 0 && n > (size_t)-1 / size)
+            return NULL;
+        return boot_alloc(n * size, 16); /* static, so already zero */
+    }
+    p = real_calloc(n, size);
+    if (p != NULL)
+        record(MMCP_MALLOC, p, NULL, n * size, 0);
+    return p;
+}
+
+void *realloc(void *old, size_t size)
+{
+    void *p;
+
+    if (real_realloc == NULL && resolve() < 0)
+        return NULL;
+    if (in_boot_heap(old)) {
+        if ((p = malloc(size)) != NULL)
+            memcpy(p, old, MIN(size, (size_t)(boot_heap + BOOT_HEAP - (char *)old)));
+        return p;
+    }
+    if (old != NULL)
+        record(MMCP_RELEASE, old, NULL, 0, 0);
+    p = real_realloc(old, size);
+    record(MMCP_REALLOC, p, old, size, 0);
+    return p;
+}
+
+void free(void *p)
+{
+    uint64_t t;
+
+    if (p == NULL || in_boot_heap(p))
+        return;
+    t = now();
+    if (real_free == NULL && resolve() < 0)
+        return;
+    real_free(p);
+    record(MMCP_FREE, p, NULL, 0, t);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (real_memalign == NULL && resolve() < 0)
+        return boot_alloc(size, align);
+    p = real_memalign(align, size);
+    if (p != NULL)
+        record(MMCP_MALLOC, p, NULL, size, 0);
+    return p;
+}
+
+int posix_memalign(void **pp, size_t align, size_t size)
+{
+    int err;
+
+    if (real_posix_memalign == NULL && resolve() < 0)
+        return (*pp = boot_alloc(size, align)) ? 0 : ENOMEM;
+    if ((err = real_posix_memalign(pp, align, size)) == 0)
+        record(MMCP_MALLOC, *pp, NULL, size, 0);
+    return err;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    void *p;
+
+    if (real_aligned_alloc == NULL && resolve() < 0)
+        return boot_alloc(size, align);
+    p = real_aligned_alloc(align, size);
+    if (p != NULL)
+        record(MMCP_MALLOC, p, NULL, size, 0);
+    return p;
+}
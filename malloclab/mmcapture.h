@@ -0,0 +1,63 @@
+/*
+ * mmcapture.h - capture format written by mmcapture.so and read by mmconv
+ *
+ * mmcapture.so, preloaded into a program, logs each malloc, calloc,
+ * realloc, free, memalign, posix_memalign and aligned_alloc it makes.
+ * Each thread fills a buffer of its own with events and appends it to
+ * the capture with a single write() when it fills up, when the thread
+ * exits and when the program does. A capture is an mmcp_hdr_t followed
+ * by chunks, an mmcp_chunk_t and then count events of thread tid in
+ * the order the thread made them. Chunks of different threads
+ * interleave in the order they were flushed.
+ *
+ * Events carry raw pointers and a CLOCK_MONOTONIC time in ns. mmconv
+ * sorts them by time into one request stream and renumbers the
+ * pointers into the dense ids of a trace. A request that hands out
+ * a block is timed after the call returns and one that gives a block
+ * back before it is made, so a block's events sort in the order its
+ * threads saw them. realloc does both, so it logs two events: an
+ * MMCP_RELEASE of the old block before the call and an MMCP_REALLOC
+ * after it returns.
+ */
+#ifndef __MMCAPTURE_H_
+#define __MMCAPTURE_H_
+
+#include <stdint.h>
+
+#define MMCP_MAGIC   0x50434d4d  /* "MMCP" */
+#define MMCP_VERSION 2
+#define MMCP_CHUNK_MAGIC 0x4b4e4843  /* "CHNK" */
+
+/* Event types */
+#define MMCP_MALLOC  0           /* ptr = malloc(size), and the other allocation calls */
+#define MMCP_FREE    1           /* free(ptr) */
+#define MMCP_REALLOC 2           /* ptr = realloc(old, size) */
+#define MMCP_RELEASE 3           /* realloc(ptr, size) is about to give ptr back */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t hdr_size;      /* offset of the first chunk */
+    uint32_t event_size;    /* sizeof(mmcp_event_t) when written */
+    uint32_t pid;           /* process captured */
+    uint32_t pad;
+} mmcp_hdr_t;
+
+typedef struct {
+    uint32_t magic;         /* MMCP_CHUNK_MAGIC */
+    uint32_t tid;           /* thread that made the events */
+    uint32_t count;         /* events that follow */
+    uint32_t pad;
+} mmcp_chunk_t;
+
+typedef struct {
+    uint64_t time;          /* ns, CLOCK_MONOTONIC */
+    uint64_t ptr;           /* block handed out (0 if the call failed), or given back */
+    uint64_t old;           /* block passed to realloc */
+    uint64_t size;          /* (request bytes << 2) | MMCP_xxx */
+} mmcp_event_t;
+
+#define MMCP_TYPE(e) ((int)((e)->size & 3))
+#define MMCP_SIZE(e) ((e)->size >> 2)
+
+#endif /* __MMCAPTURE_H_ */
@@ -0,0 +1,723 @@
+/*
+ * mmconv.c - Convert traces between the .rep text format and the
+ *            binary and streamed formats of mmbtrace.h
+ *
+ * The input format is told from its first bytes. A .rep trace or an
+ * mmcapture.so capture is written out as a binary trace and the other
+ * formats as .rep, unless -z asks for a streamed trace. The ops are
+ * converted one at a time, so the only memory that grows with the
+ * trace is the id to slot table of a streamed output.
+ *
+ * A capture is the exception: its events are read in whole, sorted by
+ * time and turned into ops up front (see load_capture), since the
+ * header needs the number of ids and ops. Each block handed out gets
+ * the next id and keeps it through reallocs until it is freed. Between
+ * the two events of a realloc, its block is set aside rather than live,
+ * so that another thread may be handed the old address meanwhile.
+ *
+ * The input is checked as it is converted: every op must be a, r or f
+ * with an id below num_ids, the op count must match the header, and
+ * in a .rep or binary trace the largest id allocated must be
+ * num_ids - 1, as mdriver's read_trace asserts. mdriver checks the
+ * ops of a binary trace again when it maps one. Writing a
+ * streamed trace also checks that ids are allocated before they are
+ * freed or reallocated, and not twice. Converting a trace to binary
+ * and back gives the original file up to white space; a streamed
+ * trace replays the same requests with its ids renumbered to slots.
+ *
+ * Usage: mmconv [-hz] <in> <out>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmbtrace.h"
+#include "mmcapture.h"
+
+#define FMT_REP    0
+#define FMT_BIN    1
+#define FMT_STREAM 2
+#define FMT_CAPTURE 3
+
+#define IOBUF 65536  /* bytes of streamed trace buffered per read or write */
+
+/* An input trace, its header and the state of reading its ops */
+typedef struct {
+    FILE *file;
+    const char *name;
+    int fmt;
+    int32_t sugg_heapsize;
+    int32_t num_ids;             /* num_slots of a streamed trace */
+    int32_t weight;
+    uint64_t num_ops;
+    uint64_t nread;              /* ops read so far */
+    long line;                   /* .rep line of the last op */
+    long max_index;              /* largest id allocated so far */
+    int32_t prev;                /* id of the last op of a streamed trace */
+    unsigned char buf[IOBUF];    /* undecoded bytes of a streamed trace... */
+    size_t pos, len;             /* ... from buf[pos] to buf[len] */
+    mmbt_op_t *ops;              /* ops of a capture */
+} input_t;
+
+/* A captured event and its place in the capture, which breaks ties in time */
+typedef struct {
+    mmcp_event_t ev;
+    uint64_t seq;
+} cevent_t;
+
+/* Live blocks of a capture: open addressing from address to id */
+typedef struct {
+    uint64_t *ptr;               /* 0 for an empty entry */
+    int32_t *id;
+    size_t cap, used;            /* cap is a power of 2 */
+} blockmap_t;
+
+/* An output trace and the state of writing its ops */
+typedef struct {
+    FILE *file;
+    const char *name;
+    int fmt;
+    mmbs_hdr_t shdr;             /* streamed header, num_slots filled in at the end */
+    int32_t *slot_of;            /* slot of each live input id, -1 if not live */
+    int32_t *free_slots;         /* stack of freed slots */
+    int nfree;
+    int32_t prev;                /* slot of the last op written */
+    unsigned char buf[IOBUF];
+    size_t len;
+} output_t;
+
+static void usage(void);
+static void open_input(input_t *in, const char *name);
+static int read_op(input_t *in, mmbt_op_t *op);
+static void fill_input(input_t *in);
+static void open_output(output_t *out, const char *name, int fmt, input_t *in);
+static void write_op(output_t *out, input_t *in, mmbt_op_t *op);
+static void close_output(output_t *out);
+static void bad_trace(input_t *in, const char *why);
+static void load_capture(input_t *in);
+static int cmp_event(const void *a, const void *b);
+static void map_init(blockmap_t *m);
+static size_t map_slot(blockmap_t *m, uint64_t ptr);
+static int32_t map_get(blockmap_t *m, uint64_t ptr);
+static void map_put(blockmap_t *m, uint64_t ptr, int32_t id);
+static void map_del(blockmap_t *m, uint64_t ptr);
+static void *xmalloc(size_t size);
+
+int main(int argc, char **argv)
+{
+    int c, stream = 0;
+    static input_t in;
+    static output_t out;
+    mmbt_op_t op;
+
+    while ((c = getopt(argc, argv, "zh")) != EOF) {
+        switch (c) {
+        case 'z': /* Write a streamed trace */
+            stream = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind != argc - 2) {
+        usage();
+        exit(1);
+    }
+
+    open_input(&in, argv[optind]);
+    open_output(&out, argv[optind + 1],
+                stream ? FMT_STREAM : in.fmt == FMT_REP || in.fmt == FMT_CAPTURE ? FMT_BIN : FMT_REP,
+                &in);
+    while (read_op(&in, &op))
+        write_op(&out, &in, &op);
+    close_output(&out);
+    fclose(in.file);
+    exit(0);
+}
+
+/*
+ * open_input - open a trace, tell its format and read its header
+ */
+static void open_input(input_t *in, const char *name)
+{
+    uint32_t magic;
+    mmbt_hdr_t bhdr;
+    mmbs_hdr_t shdr;
+
+    in->name = name;
+    in->max_index = -1;
+    if ((in->file = fopen(name, "r")) == NULL) {
+        perror(name);
+        exit(1);
+    }
+    if (fread(&magic, sizeof(magic), 1, in->file) != 1)
+        magic = 0;
+    rewind(in->file);
+
+    if (magic == MMBT_MAGIC) {
+        in->fmt = FMT_BIN;
+        if (fread(&bhdr, sizeof(bhdr), 1, in->file) != 1 || bhdr.version != MMBT_VERSION ||
+            bhdr.op_size != sizeof(mmbt_op_t) || bhdr.hdr_size < sizeof(bhdr) ||
+            bhdr.num_ids < 0 || bhdr.num_ops < 0 ||
+            fseek(in->file, bhdr.hdr_size, SEEK_SET) != 0)
+            bad_trace(in, "not a version 1 binary trace");
+        in->sugg_heapsize = bhdr.sugg_heapsize;
+        in->num_ids = bhdr.num_ids;
+        in->num_ops = bhdr.num_ops;
+        in->weight = bhdr.weight;
+    }
+    else if (magic == MMBS_MAGIC) {
+        in->fmt = FMT_STREAM;
+        if (fread(&shdr, sizeof(shdr), 1, in->file) != 1 || shdr.version != MMBS_VERSION ||
+            shdr.hdr_size < sizeof(shdr) || shdr.num_slots > INT32_MAX ||
+            fseek(in->file, shdr.hdr_size, SEEK_SET) != 0)
+            bad_trace(in, "not a version 1 streamed trace");
+        in->sugg_heapsize = shdr.sugg_heapsize;
+        in->num_ids = shdr.num_slots;
+        in->num_ops = shdr.num_ops;
+        in->weight = shdr.weight;
+    }
+    else if (magic == MMCP_MAGIC) {
+        in->fmt = FMT_CAPTURE;
+        load_capture(in);
+    }
+    else {
+        int num_ops;
+
+        in->fmt = FMT_REP;
+        if (fscanf(in->file, "%d %d %d %d", &in->sugg_heapsize, &in->num_ids,
+                   &num_ops, &in->weight) != 4 || in->num_ids < 0 || num_ops < 0)
+            bad_trace(in, "no .rep header");
+        in->num_ops = num_ops;
+        in->line = 4;
+    }
+}
+
+/*
+ * read_op - read and check the next op of in. Returns 0 at the end of
+ *     the trace.
+ */
+static int read_op(input_t *in, mmbt_op_t *op)
+{
+    char type[2];
+    unsigned int index, size;
+    int n;
+
+    switch (in->fmt) {
+    case FMT_REP:
+        if (fscanf(in->file, "%1s", type) != 1)
+            goto end;
+        in->line++;
+        if (type[0] == 'a' || type[0] == 'r') {
+            if (fscanf(in->file, "%u %u", &index, &size) != 2)
+                bad_trace(in, "expected <id> <size>");
+            op->type = type[0] == 'a' ? MMBT_ALLOC : MMBT_REALLOC;
+            op->size = size;
+        }
+        else if (type[0] == 'f') {
+            if (fscanf(in->file, "%u", &index) != 1)
+                bad_trace(in, "expected <id>");
+            op->type = MMBT_FREE;
+            op->size = 0;
+        }
+        else
+            bad_trace(in, "bogus request type");
+        if (index >= (unsigned int)in->num_ids)
+            bad_trace(in, "id not below num_ids");
+        op->index = index;
+        break;
+
+    case FMT_BIN:
+        if (in->nread == in->num_ops)
+            goto end;
+        if (fread(op, sizeof(mmbt_op_t), 1, in->file) != 1)
+            bad_trace(in, "truncated");
+        if (op->type != MMBT_ALLOC && op->type != MMBT_REALLOC && op->type != MMBT_FREE)
+            bad_trace(in, "bogus request type");
+        if (op->index < 0 || op->index >= in->num_ids)
+            bad_trace(in, "id not below num_ids");
+        break;
+
+    case FMT_STREAM:
+        if (in->len - in->pos < MMBS_OP_MAX)
+            fill_input(in);
+        if (in->pos == in->len)
+            goto end;
+        if ((n = mmbs_decode(in->buf + in->pos, in->buf + in->len, op, &in->prev)) == 0)
+            bad_trace(in, "bad op");
+        in->pos += n;
+        if (op->index < 0 || op->index >= in->num_ids)
+            bad_trace(in, "slot not below num_slots");
+        break;
+
+    case FMT_CAPTURE:
+        if (in->nread == in->num_ops)
+            goto end;
+        *op = in->ops[in->nread];
+        break;
+    }
+
+    if (op->type != MMBT_FREE && op->index > in->max_index)
+        in->max_index = op->index;
+    if (++in->nread > in->num_ops)
+        bad_trace(in, "more ops than the header says");
+    return 1;
+
+end:
+    if (in->nread != in->num_ops)
+        bad_trace(in, "fewer ops than the header says");
+    if (in->fmt != FMT_STREAM && in->max_index != in->num_ids - 1)
+        bad_trace(in, "largest id is not num_ids - 1");
+    return 0;
+}
+
+/*
+ * load_capture - read every chunk of a capture, sort the events by
+ *     time and turn them into ops in in->ops. Blocks handed out get new
+ *     ids, a realloc keeps the id of its block, and failed calls give
+ *     no op. A realloc's block waits in pending from its
+ *     MMCP_RELEASE to its MMCP_REALLOC. Frees of blocks the capture never saw handed out (made
+ *     before mmcapture.so was loaded) are dropped, and reallocs of them
+ *     become allocations; a block handed out again while it seems live
+ *     gets a free first, for a free that was lost. Requests of 0 bytes
+ *     become 1 byte, which mdriver can replay.
+ */
+static void load_capture(input_t *in)
+{
+    mmcp_hdr_t hdr;
+    mmcp_chunk_t chunk;
+    cevent_t *ev = NULL;
+    mmcp_event_t *e;
+    blockmap_t map, pending, *from;
+    size_t nev = 0, maxev = 0, i;
+    uint32_t *tids = NULL, threads = 0, t;
+    int32_t *sizes = NULL, num_ids = 0, id, old;
+    unsigned long unknown = 0, lost = 0;
+    uint64_t size, gone;
+    long live = 0, peak = 0;
+    int type;
+
+    if (fread(&hdr, sizeof(hdr), 1, in->file) != 1 || hdr.version != MMCP_VERSION ||
+        hdr.event_size != sizeof(mmcp_event_t) || hdr.hdr_size < sizeof(hdr) ||
+        fseek(in->file, hdr.hdr_size, SEEK_SET) != 0)
+        bad_trace(in, "not a version 2 capture");
+
+    /* Read the chunks, noting each thread */
+    while (fread(&chunk, sizeof(chunk), 1, in->file) == 1) {
+        if (chunk.magic != MMCP_CHUNK_MAGIC)
+            bad_trace(in, "bad chunk");
+        for (t = 0; t < threads && tids[t] != chunk.tid; t++)
+            ;
+        if (t == threads) {
+            if ((threads & (threads - 1)) == 0)
+                tids = realloc(tids, 2 * (threads + 1) * sizeof(uint32_t));
+            if (tids == NULL)
+                bad_trace(in, "out of memory");
+            tids[threads++] = chunk.tid;
+        }
+        for (i = 0; i < chunk.count; i++, nev++) {
+            if (nev == maxev) {
+                maxev = maxev ? 2 * maxev : 65536;
+                if ((ev = realloc(ev, maxev * sizeof(cevent_t))) == NULL)
+                    bad_trace(in, "out of memory");
+            }
+            if (fread(&ev[nev].ev, sizeof(mmcp_event_t), 1, in->file) != 1)
+                bad_trace(in, "truncated chunk");
+            ev[nev].seq = nev;
+        }
+    }
+    qsort(ev, nev, sizeof(cevent_t), cmp_event);
+
+    /* Renumber the blocks into ids; an event makes at most two ops */
+    in->ops = xmalloc((2 * nev + 1) * sizeof(mmbt_op_t));
+    in->num_ops = 0;
+    map_init(&map);
+    map_init(&pending);
+    for (i = 0; i < nev; i++) {
+        e = &ev[i].ev;
+        type = MMCP_TYPE(e);
+        size = MMCP_SIZE(e);
+
+        /* Set aside the block a realloc is about to give back */
+        if (type == MMCP_RELEASE) {
+            if ((id = map_get(&map, e->ptr)) >= 0) {
+                map_del(&map, e->ptr);
+                map_put(&pending, e->ptr, id);
+            }
+            continue;
+        }
+
+        /* Find the block a free or realloc gives back */
+        old = -1;
+        if (type == MMCP_FREE || (type == MMCP_REALLOC && e->old != 0)) {
+            gone = type == MMCP_FREE ? e->ptr : e->old;
+            from = type == MMCP_FREE ? &map : &pending;
+            if ((old = map_get(from, gone)) >= 0)
+                map_del(from, gone);
+        }
+
+        /*
+         * realloc(NULL, n) is malloc, realloc(p, 0) returning NULL is
+         * free, and a realloc that failed leaves its block live
+         */
+        if (type == MMCP_REALLOC && e->old == 0)
+            type = MMCP_MALLOC;
+        else if (type == MMCP_REALLOC && e->ptr == 0) {
+            if (size != 0) {
+                if (old >= 0)
+                    map_put(&map, e->old, old);
+                continue;
+            }
+            type = MMCP_FREE;
+        }
+        if (type != MMCP_FREE && e->ptr == 0)
+            continue; /* the call failed */
+        if (size > INT32_MAX)
+            bad_trace(in, "request of 2 GB or more");
+        if (size == 0)
+            size = 1;
+
+        if (type != MMCP_MALLOC) {
+            if (old < 0) {
+                unknown++;
+                if (type == MMCP_FREE)
+                    continue;
+                type = MMCP_MALLOC;
+            }
+            else
+                live -= sizes[old];
+        }
+        if (type == MMCP_FREE) {
+            in->ops[in->num_ops++] = (mmbt_op_t){ MMBT_FREE, old, 0 };
+            continue;
+        }
+
+        /* A block handed out while it seems live lost its free */
+        if ((id = map_get(&map, e->ptr)) >= 0) {
+            map_del(&map, e->ptr);
+            live -= sizes[id];
+            in->ops[in->num_ops++] = (mmbt_op_t){ MMBT_FREE, id, 0 };
+            lost++;
+        }
+        if (type == MMCP_MALLOC) {
+            if (num_ids == INT32_MAX)
+                bad_trace(in, "too many blocks");
+            id = num_ids++;
+            if ((id & (id - 1)) == 0 &&
+                (sizes = realloc(sizes, 2 * (id + 1) * sizeof(int32_t))) == NULL)
+                bad_trace(in, "out of memory");
+            in->ops[in->num_ops++] = (mmbt_op_t){ MMBT_ALLOC, id, (int32_t)size };
+        }
+        else {
+            id = old;
+            in->ops[in->num_ops++] = (mmbt_op_t){ MMBT_REALLOC, id, (int32_t)size };
+        }
+        map_put(&map, e->ptr, id);
+        sizes[id] = size;
+        live += size;
+        if (live > peak)
+            peak = live;
+    }
+
+    in->num_ids = num_ids;
+    in->sugg_heapsize = peak > INT32_MAX ? INT32_MAX : peak;
+    in->weight = 1;
+    fprintf(stderr, "%s: %lu events from %u thread%s, %llu ops on %d blocks",
+            in->name, (unsigned long)nev, threads, threads == 1 ? "" : "s",
+            (unsigned long long)in->num_ops, num_ids);
+    if (unknown > 0)
+        fprintf(stderr, ", %lu calls on blocks from before the capture", unknown);
+    if (lost > 0)
+        fprintf(stderr, ", %lu lost frees", lost);
+    fprintf(stderr, "\n");
+    free(ev);
+    free(tids);
+    free(sizes);
+    free(map.ptr);
+    free(map.id);
+    free(pending.ptr);
+    free(pending.id);
+}
+
+/*
+ * cmp_event - order captured events by time, then by place in the capture
+ */
+static int cmp_event(const void *a, const void *b)
+{
+    const cevent_t *x = a, *y = b;
+
+    if (x->ev.time != y->ev.time)
+        return x->ev.time < y->ev.time ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/*
+ * map_slot - the entry of m that holds ptr, or the empty one it would go in
+ */
+static size_t map_slot(blockmap_t *m, uint64_t ptr)
+{
+    size_t i = (size_t)((ptr >> 4) * 0x9e3779b97f4a7c15ULL) & (m->cap - 1);
+
+    while (m->ptr[i] != 0 && m->ptr[i] != ptr)
+        i = (i + 1) & (m->cap - 1);
+    return i;
+}
+
+/*
+ * map_init - start m empty
+ */
+static void map_init(blockmap_t *m)
+{
+    m->cap = 1024;
+    m->used = 0;
+    m->ptr = xmalloc(m->cap * sizeof(uint64_t));
+    m->id = xmalloc(m->cap * sizeof(int32_t));
+    memset(m->ptr, 0, m->cap * sizeof(uint64_t));
+}
+
+/*
+ * map_get - the id of the live block at ptr, or -1
+ */
+static int32_t map_get(blockmap_t *m, uint64_t ptr)
+{
+    size_t i = map_slot(m, ptr);
+
+    return m->ptr[i] == ptr ? m->id[i] : -1;
+}
+
+/*
+ * map_put - note a block handed out at ptr as id, growing m to keep it
+ *     at most half full
+ */
+static void map_put(blockmap_t *m, uint64_t ptr, int32_t id)
+{
+    blockmap_t old = *m;
+    size_t i;
+
+    if (2 * (m->used + 1) > m->cap) {
+        m->cap *= 2;
+        m->used = 0;
+        m->ptr = xmalloc(m->cap * sizeof(uint64_t));
+        m->id = xmalloc(m->cap * sizeof(int32_t));
+        memset(m->ptr, 0, m->cap * sizeof(uint64_t));
+        for (i = 0; i < old.cap; i++)
+            if (old.ptr[i] != 0)
+                map_put(m, old.ptr[i], old.id[i]);
+        free(old.ptr);
+        free(old.id);
+    }
+    i = map_slot(m, ptr);
+    m->ptr[i] = ptr;
+    m->id[i] = id;
+    m->used++;
+}
+
+/*
+ * map_del - drop the block at ptr, moving back the entries after it
+ *     that would no longer be found
+ */
+static void map_del(blockmap_t *m, uint64_t ptr)
+{
+    size_t i = map_slot(m, ptr), j = i, home;
+
+    m->ptr[i] = 0;
+    m->used--;
+    for (;;) {
+        j = (j + 1) & (m->cap - 1);
+        if (m->ptr[j] == 0)
+            return;
+        home = (size_t)((m->ptr[j] >> 4) * 0x9e3779b97f4a7c15ULL) & (m->cap - 1);
+        /* Move j back to i unless its home lies cyclically in (i, j] */
+        if ((i <= j) ? (home <= i || home > j) : (home <= i && home > j)) {
+            m->ptr[i] = m->ptr[j];
+            m->id[i] = m->id[j];
+            m->ptr[j] = 0;
+            i = j;
+        }
+    }
+}
+
+/*
+ * xmalloc - malloc or give up
+ */
+static void *xmalloc(size_t size)
+{
+    void *p;
+
+    if ((p = malloc(size)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ * fill_input - move the undecoded bytes of a streamed trace to the
+ *     front of its buffer and read more after them
+ */
+static void fill_input(input_t *in)
+{
+    memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+    in->len -= in->pos;
+    in->pos = 0;
+    in->len += fread(in->buf + in->len, 1, IOBUF - in->len, in->file);
+}
+
+/*
+ * open_output - create the output trace and write its header, from
+ *     what the input's header says
+ */
+static void open_output(output_t *out, const char *name, int fmt, input_t *in)
+{
+    mmbt_hdr_t bhdr;
+    int32_t i;
+
+    out->name = name;
+    out->fmt = fmt;
+    if ((out->file = fopen(name, "w")) == NULL) {
+        perror(name);
+        exit(1);
+    }
+
+    switch (fmt) {
+    case FMT_REP:
+        if (in->num_ops > INT32_MAX)
+            bad_trace(in, "too many ops for a .rep trace");
+        fprintf(out->file, "%d\n%d\n%d\n%d\n", in->sugg_heapsize, in->num_ids,
+                (int)in->num_ops, in->weight);
+        break;
+
+    case FMT_BIN:
+        if (in->num_ops > INT32_MAX)
+            bad_trace(in, "too many ops for a binary trace");
+        memset(&bhdr, 0, sizeof(bhdr));
+        bhdr.magic = MMBT_MAGIC;
+        bhdr.version = MMBT_VERSION;
+        bhdr.hdr_size = sizeof(bhdr);
+        bhdr.op_size = sizeof(mmbt_op_t);
+        bhdr.sugg_heapsize = in->sugg_heapsize;
+        bhdr.num_ids = in->num_ids;
+        bhdr.num_ops = in->num_ops;
+        bhdr.weight = in->weight;
+        fwrite(&bhdr, sizeof(bhdr), 1, out->file);
+        break;
+
+    case FMT_STREAM:
+        if ((out->slot_of = malloc(in->num_ids * sizeof(int32_t))) == NULL ||
+            (out->free_slots = malloc(in->num_ids * sizeof(int32_t))) == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        for (i = 0; i < in->num_ids; i++)
+            out->slot_of[i] = -1;
+        memset(&out->shdr, 0, sizeof(out->shdr));
+        out->shdr.magic = MMBS_MAGIC;
+        out->shdr.version = MMBS_VERSION;
+        out->shdr.hdr_size = sizeof(out->shdr);
+        out->shdr.num_ops = in->num_ops;
+        out->shdr.sugg_heapsize = in->sugg_heapsize;
+        out->shdr.weight = in->weight;
+        fwrite(&out->shdr, sizeof(out->shdr), 1, out->file); /* num_slots comes later */
+        break;
+    }
+}
+
+/*
+ * write_op - write one op to out. A streamed trace gets the op's id
+ *     renumbered to a slot.
+ */
+static void write_op(output_t *out, input_t *in, mmbt_op_t *op)
+{
+    mmbt_op_t sop;
+    int32_t *slot;
+
+    switch (out->fmt) {
+    case FMT_REP:
+        if (op->type == MMBT_FREE)
+            fprintf(out->file, "f %d\n", op->index);
+        else
+            fprintf(out->file, "%c %d %d\n", op->type == MMBT_ALLOC ? 'a' : 'r',
+                    op->index, op->size);
+        break;
+
+    case FMT_BIN:
+        fwrite(op, sizeof(mmbt_op_t), 1, out->file);
+        break;
+
+    case FMT_STREAM:
+        sop = *op;
+        slot = &out->slot_of[op->index];
+        if (op->type == MMBT_ALLOC) {
+            if (*slot >= 0)
+                bad_trace(in, "id allocated twice");
+            *slot = out->nfree > 0 ? out->free_slots[--out->nfree] : (int32_t)out->shdr.num_slots++;
+        }
+        else if (*slot < 0)
+            bad_trace(in, "id freed or reallocated but not allocated");
+        sop.index = *slot;
+        if (op->type == MMBT_FREE) {
+            out->free_slots[out->nfree++] = *slot;
+            *slot = -1;
+        }
+        if (out->len > IOBUF - MMBS_OP_MAX) {
+            fwrite(out->buf, 1, out->len, out->file);
+            out->len = 0;
+        }
+        out->len += mmbs_encode(out->buf + out->len, &sop, &out->prev);
+        break;
+    }
+}
+
+/*
+ * close_output - flush the output, finish a streamed trace's header
+ *     and close it
+ */
+static void close_output(output_t *out)
+{
+    if (out->fmt == FMT_STREAM) {
+        fwrite(out->buf, 1, out->len, out->file);
+        if (fseek(out->file, 0, SEEK_SET) != 0) {
+            perror(out->name);
+            exit(1);
+        }
+        fwrite(&out->shdr, sizeof(out->shdr), 1, out->file);
+        free(out->slot_of);
+        free(out->free_slots);
+    }
+    if (ferror(out->file) || fclose(out->file) != 0) {
+        perror(out->name);
+        exit(1);
+    }
+}
+
+/*
+ * bad_trace - report why the input is not a valid trace and give up
+ */
+static void bad_trace(input_t *in, const char *why)
+{
+    if (in->fmt == FMT_REP && in->line > 0)
+        fprintf(stderr, "%s:%ld: %s\n", in->name, in->line, why);
+    else if (in->nread > 0)
+        fprintf(stderr, "%s: after %llu ops: %s\n", in->name, (unsigned long long)in->nread, why);
+    else
+        fprintf(stderr, "%s: %s\n", in->name, why);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmconv [-hz] <in> <out>\n");
+    fprintf(stderr, "Converts a .rep trace or an mmcapture.so capture to a binary trace,\n");
+    fprintf(stderr, "or a binary or streamed trace to .rep.\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-z         Write a streamed trace instead.\n");
+}
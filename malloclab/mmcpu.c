@@ -0,0 +1,265 @@
+/*
+ * mmcpu.c - Per-CPU, per-thread and locked allocation under oversubscription
+ *
+ * Starts many more threads than there are CPUs on one private mm heap
+ * (mm_set_threads) and has each of them allocate and free rounds of
+ * small blocks of random sizes, in three modes:
+ *
+ *   lock    mm_malloc and mm_free, every call under the heap lock
+ *   thread  mm_malloc_inline and mm_free_inline, a cache per thread
+ *   cpu     mm_malloc_cpu and mm_free_cpu, a cache per CPU (rseq)
+ *
+ * When its work is done every thread has freed all its blocks, and
+ * stays alive but idle until all threads are done, as the idle
+ * threads of a server would. The footprint is measured then: the
+ * bytes of blocks still allocated, which are the blocks the caches
+ * hold, and the size of the heap. It reports both with the throughput
+ * of each mode. Without rseq the cpu mode falls back to the thread
+ * caches, which it says.
+ *
+ * Usage: mmcpu [-h] [-t <threads>] [-n <ops>] [-w <blocks>] [-s <maxsize>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "mm_inline.h"
+#include "memlib.h"
+
+#define MODE_LOCK   0
+#define MODE_THREAD 1
+#define MODE_CPU    2
+#define NMODES      3
+
+static const char *mode_names[NMODES] = { "lock", "thread", "cpu" };
+
+/* Parameters shared by the worker threads of one run */
+typedef struct {
+    int mode;
+    int ops;                    /* mallocs per thread */
+    int work;                   /* blocks live at once per thread */
+    size_t maxsize;
+    pthread_barrier_t done;     /* all threads have freed their blocks */
+    pthread_barrier_t measured; /* the footprint has been taken */
+} run_t;
+
+typedef struct {
+    run_t *run;
+    unsigned int seed;
+} worker_t;
+
+/* Results for one mode */
+typedef struct {
+    double mops;                /* million mallocs and frees per second */
+    size_t cached;              /* bytes held in caches by the idle threads */
+    size_t heap;                /* heap size */
+} result_t;
+
+static void usage(void);
+static void run_mode(int mode, int nthreads, int ops, int work, size_t maxsize, result_t *out);
+static void *worker(void *arg);
+static double now_ns(void);
+
+int main(int argc, char **argv)
+{
+    int c, m;
+    int nthreads = 256, ops = 20000, work = 64;
+    size_t maxsize = 128;
+    result_t res[NMODES];
+
+    while ((c = getopt(argc, argv, "t:n:w:s:h")) != EOF) {
+        switch (c) {
+        case 't': /* Worker threads */
+            nthreads = atoi(optarg);
+            break;
+        case 'n': /* Mallocs per thread */
+            ops = atoi(optarg);
+            break;
+        case 'w': /* Blocks live at once per thread */
+            work = atoi(optarg);
+            break;
+        case 's': /* Largest block in bytes */
+            maxsize = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (nthreads <= 0 || ops <= 0 || work <= 0 || maxsize == 0) {
+        usage();
+        exit(1);
+    }
+
+    mem_init();
+    mm_set_threads(1);
+    for (m = 0; m < NMODES; m++)
+        run_mode(m, nthreads, ops, work, maxsize, &res[m]);
+
+    printf("%d threads on %ld CPUs, %d mallocs each, %d live blocks of 1..%lu bytes\n",
+           nthreads, sysconf(_SC_NPROCESSORS_ONLN), ops, work, (unsigned long)maxsize);
+    if (!mm_cpu_cache())
+        printf("No rseq: the cpu mode uses the thread caches\n");
+    printf("%-8s %10s %14s %14s\n", "mode", "Mops/s", "idle cached", "heap bytes");
+    for (m = 0; m < NMODES; m++)
+        printf("%-8s %10.2f %14lu %14lu\n", mode_names[m], res[m].mops,
+               (unsigned long)res[m].cached, (unsigned long)res[m].heap);
+    printf("Heap check %s\n", mm_check() == 0 ? "passed" : "FAILED");
+
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * run_mode - run all threads in one mode on a new heap and take its
+ *     footprint while they are idle
+ */
+static void run_mode(int mode, int nthreads, int ops, int work, size_t maxsize, result_t *out)
+{
+    pthread_t *tids;
+    worker_t *w;
+    run_t run;
+    mm_tag_stats_t ts;
+    double start;
+    int i;
+
+    if ((tids = malloc(nthreads * sizeof(pthread_t))) == NULL ||
+        (w = malloc(nthreads * sizeof(worker_t))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    run.mode = mode;
+    run.ops = ops;
+    run.work = work;
+    run.maxsize = maxsize;
+    pthread_barrier_init(&run.done, NULL, nthreads + 1);
+    pthread_barrier_init(&run.measured, NULL, nthreads + 1);
+
+    start = now_ns();
+    for (i = 0; i < nthreads; i++) {
+        w[i].run = &run;
+        w[i].seed = i + 1;
+        if (pthread_create(&tids[i], NULL, worker, &w[i]) != 0) {
+            fprintf(stderr, "Cannot start thread %d\n", i);
+            exit(1);
+        }
+    }
+    pthread_barrier_wait(&run.done);
+    out->mops = 2.0 * nthreads * ops / (now_ns() - start) * 1e3;
+
+    /* Every block the threads allocated is free or in a cache */
+    mm_get_tag_stats(0, &ts);
+    out->cached = ts.live_bytes;
+    out->heap = mem_heapsize();
+
+    pthread_barrier_wait(&run.measured);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    pthread_barrier_destroy(&run.done);
+    pthread_barrier_destroy(&run.measured);
+    free(tids);
+    free(w);
+}
+
+/*
+ * worker - body of one thread: rounds of allocating run->work blocks
+ *     and freeing them in a shuffled order, then idle until measured
+ */
+static void *worker(void *arg)
+{
+    worker_t *w = arg;
+    run_t *run = w->run;
+    void **blocks;
+    size_t *sizes;
+    int i, j, k, done = 0;
+    void *tp;
+    size_t ts;
+
+    if ((blocks = malloc(run->work * sizeof(void *))) == NULL ||
+        (sizes = malloc(run->work * sizeof(size_t))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    while (done < run->ops) {
+        for (i = 0; i < run->work; i++) {
+            sizes[i] = 1 + rand_r(&w->seed) % run->maxsize;
+            switch (run->mode) {
+            case MODE_LOCK:
+                blocks[i] = mm_malloc(sizes[i]);
+                break;
+            case MODE_THREAD:
+                blocks[i] = mm_malloc_inline(sizes[i]);
+                break;
+            default:
+                blocks[i] = mm_malloc_cpu(sizes[i]);
+            }
+            if (blocks[i] == NULL) {
+                fprintf(stderr, "Out of heap\n");
+                exit(1);
+            }
+            *(char *)blocks[i] = i;
+        }
+        for (i = run->work - 1; i > 0; i--) {
+            j = rand_r(&w->seed) % (i + 1);
+            tp = blocks[i], blocks[i] = blocks[j], blocks[j] = tp;
+            ts = sizes[i], sizes[i] = sizes[j], sizes[j] = ts;
+        }
+        for (k = 0; k < run->work; k++) {
+            switch (run->mode) {
+            case MODE_LOCK:
+                mm_free(blocks[k]);
+                break;
+            case MODE_THREAD:
+                mm_free_inline(blocks[k], sizes[k]);
+                break;
+            default:
+                mm_free_cpu(blocks[k], sizes[k]);
+            }
+        }
+        done += run->work;
+    }
+    free(blocks);
+    free(sizes);
+
+    pthread_barrier_wait(&run->done);
+    pthread_barrier_wait(&run->measured);
+    mm_tcache_flush();
+    return NULL;
+}
+
+/*
+ * now_ns - monotonic time in nanoseconds
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmcpu [-h] [-t <threads>] [-n <ops>] [-w <blocks>] [-s <maxsize>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <n>     Mallocs per thread (default 20000).\n");
+    fprintf(stderr, "\t-s <size>  Largest block in bytes (default 128).\n");
+    fprintf(stderr, "\t-t <n>     Worker threads (default 256).\n");
+    fprintf(stderr, "\t-w <n>     Blocks each thread keeps live at once (default 64).\n");
+}
@@ -0,0 +1,226 @@
+/*
+ * mmlocality.c - Locality benchmark for mm_malloc_hint
+ *
+ * Builds the same heap twice, once with plain mm_malloc and once with
+ * hot/cold hints: small "hot" objects allocated interleaved with
+ * larger "cold" blobs, the way a program mixes per-request state with
+ * configuration data. It then touches every hot object in a shuffled
+ * order for a number of rounds and reports, for each layout, how many
+ * cache lines and pages the hot objects span (a lower bound on the
+ * cache and TLB misses of a round once the hot set no longer fits)
+ * and the time per touch.
+ *
+ * Usage: mmlocality [-h] [-n <hot>] [-s <hotsize>] [-c <coldsize>] [-r <rounds>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define LINE_SIZE 64 /* cache line size assumed for the line count */
+
+/* Results for one layout */
+typedef struct {
+    size_t lines;      /* distinct cache lines holding hot payload */
+    size_t pages;      /* distinct pages holding hot payload */
+    double ns_touch;   /* mean time to touch one hot object */
+    mm_stats_t stats;  /* allocator counters after building the heap */
+} layout_t;
+
+static void usage(void);
+static void run(int hinted, int n, size_t hsize, size_t csize, int rounds, layout_t *out);
+static size_t count_spans(char **objs, int n, size_t size, size_t unit);
+static int cmp_ulong(const void *a, const void *b);
+static double now_ns(void);
+
+int main(int argc, char **argv)
+{
+    int c;
+    int n = 16384, rounds = 20;
+    size_t hsize = 64, csize = 1024;
+    layout_t plain, hinted;
+
+    while ((c = getopt(argc, argv, "n:s:c:r:h")) != EOF) {
+        switch (c) {
+        case 'n': /* Number of hot objects (and of cold blobs) */
+            n = atoi(optarg);
+            break;
+        case 's': /* Hot object size */
+            hsize = atoi(optarg);
+            break;
+        case 'c': /* Cold blob size */
+            csize = atoi(optarg);
+            break;
+        case 'r': /* Rounds of touches */
+            rounds = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (n <= 0 || hsize == 0 || csize == 0 || rounds <= 0) {
+        usage();
+        exit(1);
+    }
+
+    mem_init();
+    run(0, n, hsize, csize, rounds, &plain);
+    run(1, n, hsize, csize, rounds, &hinted);
+
+    printf("%d hot objects of %lu bytes interleaved with cold blobs of %lu bytes, %d rounds\n",
+           n, (unsigned long)hsize, (unsigned long)csize, rounds);
+    printf("%-8s %12s %12s %10s\n", "layout", "hot lines", "hot pages", "ns/touch");
+    printf("%-8s %12lu %12lu %10.1f\n", "plain",
+           (unsigned long)plain.lines, (unsigned long)plain.pages, plain.ns_touch);
+    printf("%-8s %12lu %12lu %10.1f\n", "hinted",
+           (unsigned long)hinted.lines, (unsigned long)hinted.pages, hinted.ns_touch);
+    printf("Hinted layout spans %.1fx fewer lines and %.1fx fewer pages, touches %.2fx as fast\n",
+           (double)plain.lines / hinted.lines, (double)plain.pages / hinted.pages,
+           plain.ns_touch / hinted.ns_touch);
+    printf("%lu hinted blocks in %lu arenas, %lu spilled to the main heap\n",
+           hinted.stats.hinted, hinted.stats.arenas, hinted.stats.hint_spills);
+
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * run - build the heap in one layout, measure the hot set's footprint
+ *     and time rounds of touches over it in a shuffled order
+ */
+static void run(int hinted, int n, size_t hsize, size_t csize, int rounds, layout_t *out)
+{
+    char **hot, *cold;
+    int *order;
+    int i, j, r, tmp;
+    volatile unsigned long sink = 0;
+    double start;
+
+    if ((hot = (char **)malloc(n * sizeof(char *))) == NULL ||
+        (order = (int *)malloc(n * sizeof(int))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        hot[i] = hinted ? mm_malloc_hint(hsize, MM_HOT) : mm_malloc(hsize);
+        cold = hinted ? mm_malloc_hint(csize, MM_COLD) : mm_malloc(csize);
+        if (hot[i] == NULL || cold == NULL) {
+            fprintf(stderr, "Out of heap after %d objects\n", i);
+            exit(1);
+        }
+        memset(hot[i], i, hsize);
+        memset(cold, i, csize);
+    }
+    mm_get_stats(&out->stats);
+    out->lines = count_spans(hot, n, hsize, LINE_SIZE);
+    out->pages = count_spans(hot, n, hsize, mem_pagesize());
+
+    /* Same shuffle for both layouts */
+    srand(1);
+    for (i = 0; i < n; i++)
+        order[i] = i;
+    for (i = n - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    start = now_ns();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < n; i++) {
+            char *p = hot[order[i]];
+            size_t k;
+
+            for (k = 0; k + sizeof(long) <= hsize; k += sizeof(long)) {
+                sink += *(long *)(p + k);
+                *(long *)(p + k) += 1;
+            }
+        }
+    }
+    out->ns_touch = (now_ns() - start) / ((double)rounds * n);
+
+    free(hot);
+    free(order);
+}
+
+/*
+ * count_spans - number of distinct unit-sized, unit-aligned pieces of
+ *     memory that the n objects of size bytes at objs[] overlap
+ */
+static size_t count_spans(char **objs, int n, size_t size, size_t unit)
+{
+    unsigned long *ids = NULL;
+    size_t nids = 0, cap = 0, count = 0, k;
+    unsigned long id;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        for (id = (unsigned long)objs[i] / unit;
+             id <= ((unsigned long)objs[i] + size - 1) / unit; id++) {
+            if (nids == cap) {
+                cap = cap ? 2 * cap : 1024;
+                if ((ids = (unsigned long *)realloc(ids, cap * sizeof(unsigned long))) == NULL) {
+                    fprintf(stderr, "Out of memory\n");
+                    exit(1);
+                }
+            }
+            ids[nids++] = id;
+        }
+    }
+    qsort(ids, nids, sizeof(unsigned long), cmp_ulong);
+    for (k = 0; k < nids; k++)
+        if (k == 0 || ids[k] != ids[k - 1])
+            count++;
+    free(ids);
+    return count;
+}
+
+/*
+ * cmp_ulong - qsort comparator for unsigned longs
+ */
+static int cmp_ulong(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * now_ns - monotonic time in nanoseconds
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmlocality [-h] [-n <hot>] [-s <hotsize>] [-c <coldsize>] [-r <rounds>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-c <size>  Cold blob size in bytes (default 1024).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <hot>   Number of hot objects and of cold blobs (default 16384).\n");
+    fprintf(stderr, "\t-r <n>     Rounds of touches over the hot objects (default 20).\n");
+    fprintf(stderr, "\t-s <size>  Hot object size in bytes (default 64).\n");
+}
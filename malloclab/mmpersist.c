@@ -0,0 +1,262 @@
+/*
+ * mmpersist.c - Warm restart of a file-backed mm heap
+ *
+ * Plays a cache process that keeps its data in a heap file. When the
+ * file holds no heap yet, it builds a chain of records in it, hangs
+ * the chain off the root block (mm_set_root) and shuts the heap down
+ * cleanly with mm_shutdown, or just unmaps it with -x, as a crash
+ * would. Then, as a restarted process, it maps the file again, lets
+ * mm_init check and reopen the heap, walks every record from the root
+ * and adds one more. The old address of the heap is kept busy, so the
+ * heap comes back elsewhere, as it would in a new process. It reports the time to build the records against
+ * the time to reopen the heap, and whether mm_init had to rebuild the
+ * free lists. With -k the file is kept, so the next run starts from
+ * the heap this one left.
+ *
+ * Usage: mmpersist [-hkx] [-n <records>] [-s <maxsize>] <file>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define TABLE_MAGIC 0x4c424154 /* "TABL" */
+
+/* The root block. Links are mm_offset values, valid wherever the heap is mapped. */
+typedef struct {
+    uint32_t magic;     /* TABLE_MAGIC */
+    uint32_t count;     /* records on the chain */
+    uint32_t head;      /* first record */
+    uint32_t pad;
+    double build_ns;    /* time the first run took to build the chain */
+} table_t;
+
+typedef struct {
+    uint32_t next;      /* next record, 0 at the end */
+    uint32_t id;
+    uint32_t len;       /* total bytes, header included */
+    uint32_t sum;       /* checksum of data[] */
+    uint64_t data[];
+} record_t;
+
+static void usage(void);
+static double build(int n, size_t maxsize);
+static record_t *new_record(uint32_t id, size_t len);
+static int check(record_t *r);
+static double now_ns(void);
+
+int main(int argc, char **argv)
+{
+    int c, existed;
+    int n = 50000, keep = 0, crash = 0;
+    size_t maxsize = 512;
+    char *path;
+    void *lo_before = NULL;
+    double start, t_build, t_reopen, t_walk;
+    table_t *t;
+    record_t *r;
+    unsigned long walked = 0, bad = 0, count;
+    mm_stats_t st;
+
+    while ((c = getopt(argc, argv, "n:s:kxh")) != EOF) {
+        switch (c) {
+        case 'n': /* Records to build */
+            n = atoi(optarg);
+            break;
+        case 's': /* Largest record in bytes */
+            maxsize = atoi(optarg);
+            break;
+        case 'k': /* Keep the heap file */
+            keep = 1;
+            break;
+        case 'x': /* Skip mm_shutdown, as a crash would */
+            crash = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind != argc - 1 || n <= 0 || maxsize < sizeof(record_t)) {
+        usage();
+        exit(1);
+    }
+    path = argv[optind];
+
+    /* First run: build the records */
+    if ((existed = mem_init_file(path)) < 0) {
+        perror(path);
+        exit(1);
+    }
+    lo_before = mem_heap_lo();
+    if (!existed) {
+        if (mm_init() < 0) {
+            fprintf(stderr, "mm_init failed\n");
+            exit(1);
+        }
+        t_build = build(n, maxsize);
+        printf("Built %d records in %.1f ms, heap of %lu bytes at %p\n", n,
+               t_build / 1e6, (unsigned long)mem_heapsize(), lo_before);
+        if (!crash)
+            mm_shutdown();
+    }
+    else
+        printf("%s already holds a heap\n", path);
+    mem_deinit();
+    mmap(lo_before, mem_pagesize(), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    /* Restart: map the file again and reopen the heap */
+    start = now_ns();
+    if (mem_init_file(path) != 1 || mm_init() < 0) {
+        fprintf(stderr, "%s: cannot reopen the heap\n", path);
+        exit(1);
+    }
+    t_reopen = now_ns() - start;
+    mm_get_stats(&st);
+    printf("Reopened it at %p in %.1f ms, %s\n", mem_heap_lo(), t_reopen / 1e6,
+           st.heap_repairs ? "free lists rebuilt after an unclean shutdown" : "free lists reused");
+
+    /* Walk the records from the root and add one */
+    start = now_ns();
+    t = mm_get_root();
+    if (t == NULL || t->magic != TABLE_MAGIC) {
+        fprintf(stderr, "%s: no record table at the root\n", path);
+        exit(1);
+    }
+    for (r = mm_pointer(t->head); r != NULL; r = mm_pointer(r->next)) {
+        walked++;
+        if (!check(r))
+            bad++;
+    }
+    t_walk = now_ns() - start;
+    if ((r = new_record(t->count, maxsize)) != NULL) {
+        r->next = t->head;
+        t->head = mm_offset(r);
+        t->count++;
+    }
+    count = t->count - (r != NULL);
+    printf("Walked %lu of %lu records in %.1f ms, %lu bad; heap check %s\n", walked,
+           count, t_walk / 1e6, bad, mm_check() == 0 ? "passed" : "FAILED");
+    printf("Reopening took %.1f%% of the time the first run spent building\n",
+           100.0 * t_reopen / t->build_ns);
+
+    mm_shutdown();
+    mem_deinit();
+    if (!keep)
+        unlink(path);
+    exit(bad || walked != count ? 1 : 0);
+}
+
+/*
+ * build - build a chain of n records of up to maxsize bytes, freeing
+ *     every third one along the way so the heap has holes, and make
+ *     it the root. Returns the time taken in ns.
+ */
+static double build(int n, size_t maxsize)
+{
+    double start = now_ns();
+    table_t *t;
+    record_t *r, *hole = NULL;
+    int i;
+
+    srand(1);
+    if ((t = mm_malloc(sizeof(table_t))) == NULL) {
+        fprintf(stderr, "Out of heap\n");
+        exit(1);
+    }
+    memset(t, 0, sizeof(*t));
+    t->magic = TABLE_MAGIC;
+    for (i = 0; i < n; i++) {
+        if ((r = new_record(i, maxsize)) == NULL) {
+            fprintf(stderr, "Out of heap after %d records\n", i);
+            exit(1);
+        }
+        if (i % 3 == 2) {
+            if (hole != NULL)
+                mm_free(hole);
+            hole = r;
+            continue;
+        }
+        r->next = t->head;
+        t->head = mm_offset(r);
+        t->count++;
+    }
+    if (hole != NULL)
+        mm_free(hole);
+    t->build_ns = now_ns() - start;
+    mm_set_root(t);
+    return t->build_ns;
+}
+
+/*
+ * new_record - allocate and fill record id of a random size up to
+ *     maxsize bytes. Returns NULL when the heap is full.
+ */
+static record_t *new_record(uint32_t id, size_t maxsize)
+{
+    size_t k, n = rand() % ((maxsize - sizeof(record_t)) / sizeof(uint64_t) + 1);
+    uint64_t sum = 0;
+    record_t *r;
+
+    if ((r = mm_malloc(sizeof(record_t) + n * sizeof(uint64_t))) == NULL)
+        return NULL;
+    r->next = 0;
+    r->id = id;
+    r->len = sizeof(record_t) + n * sizeof(uint64_t);
+    for (k = 0; k < n; k++) {
+        r->data[k] = (uint64_t)id * 0x9e3779b97f4a7c15ULL + k;
+        sum += r->data[k] ^ k;
+    }
+    r->sum = (uint32_t)(sum ^ (sum >> 32));
+    return r;
+}
+
+/*
+ * check - returns nonzero if the record at r is intact
+ */
+static int check(record_t *r)
+{
+    size_t k, n;
+    uint64_t sum = 0;
+
+    if (r->len < sizeof(record_t))
+        return 0;
+    n = (r->len - sizeof(record_t)) / sizeof(uint64_t);
+    for (k = 0; k < n; k++)
+        sum += r->data[k] ^ k;
+    return (uint32_t)(sum ^ (sum >> 32)) == r->sum;
+}
+
+/*
+ * now_ns - monotonic time in nanoseconds
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmpersist [-hkx] [-n <records>] [-s <maxsize>] <file>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-k         Keep the heap file for the next run.\n");
+    fprintf(stderr, "\t-n <n>     Records to build in a new heap (default 50000).\n");
+    fprintf(stderr, "\t-s <size>  Largest record in bytes (default 512).\n");
+    fprintf(stderr, "\t-x         Don't shut the heap down cleanly after building it.\n");
+}
@@ -0,0 +1,141 @@
+/*
+ * mmrseq.h - per-CPU lists built on Linux restartable sequences
+ *
+ * A restartable sequence is a short critical section that ends in a
+ * single committing store. If the thread is preempted, migrated or
+ * signalled before the commit, the kernel restarts it at an abort
+ * handler instead of resuming it, so code that reads the current CPU
+ * number and updates that CPU's data needs no atomic instructions or
+ * locks. glibc 2.35 and later registers an rseq area for every thread;
+ * __rseq_size is 0 if it could not (or was told not to).
+ *
+ * mmr_pop and mmr_push work on an array of mmr_list_t, one per CPU,
+ * stride bytes apart. Each is a bounded stack of block pointers whose
+ * depth is the committing store. Both return 1 on success, 0 if the
+ * list is empty or full, and -1 if the sequence was aborted, in which
+ * case the caller simply tries again, probably on another CPU.
+ *
+ * Only x86-64 is implemented; MM_RSEQ is 0 elsewhere (including -m32
+ * builds) and with older C libraries, and callers fall back to other
+ * paths.
+ */
+#ifndef __MMRSEQ_H_
+#define __MMRSEQ_H_
+
+#include <stddef.h>
+
+#if defined(__x86_64__) && defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define MM_RSEQ 1
+#include <sys/rseq.h>
+#else
+#define MM_RSEQ 0
+#endif
+
+#define MMR_KEEP 32 /* blocks held per list */
+
+/* One CPU's list. The slot below cur is at (char *)list + 8 * cur, which the asm relies on. */
+typedef struct {
+    unsigned long cur;          /* blocks held, the committing store */
+    void *slot[MMR_KEEP];
+} mmr_list_t;
+
+#if MM_RSEQ
+/*
+ * Critical section descriptor (struct rseq_cs) for the section from
+ * label 1 to label 2, and the abort handler at label 4, preceded by
+ * RSEQ_SIG as the kernel requires. Label 3 names the descriptor.
+ */
+#define MMR_SECTION(abort)                                   \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                     \
+    ".balign 32\n\t"                                         \
+    "3:\n\t"                                                 \
+    ".long 0x0, 0x0\n\t"                                     \
+    ".quad 1f, (2f - 1f), 4f\n\t"                            \
+    ".popsection\n\t"                                        \
+    ".pushsection __rseq_failure, \"ax\"\n\t"                \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                             \
+    ".long 0x53053053\n\t"                                   \
+    "4:\n\t"                                                 \
+    "jmp %l[" abort "]\n\t"                                  \
+    ".popsection\n\t"                                        \
+    "leaq 3b(%%rip), %%rax\n\t"                              \
+    "movq %%rax, %[cs]\n\t"
+
+/* This thread's rseq area */
+static inline struct rseq *mmr_area(void)
+{
+    return (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+}
+
+/* Returns the CPU this thread runs on, or -1 if it has no rseq area */
+static inline int mmr_cpu(void)
+{
+    if (__rseq_size == 0)
+        return -1;
+    return (int)mmr_area()->cpu_id;
+}
+
+/* Pops the newest pointer off the current CPU's list (lists[cpu], stride bytes apart) into *out */
+static inline int mmr_pop(mmr_list_t *lists, size_t stride, void **out)
+{
+    struct rseq *rs = mmr_area();
+
+    __asm__ __volatile__ goto(
+        MMR_SECTION("aborted")
+        "1:\n\t"
+        "movl %[cpu], %%eax\n\t"
+        "imulq %[stride], %%rax\n\t"
+        "addq %[lists], %%rax\n\t"
+        "movq (%%rax), %%rcx\n\t"
+        "testq %%rcx, %%rcx\n\t"
+        "jz %l[empty]\n\t"
+        "movq (%%rax,%%rcx,8), %%rdx\n\t"
+        "movq %%rdx, %[out]\n\t"
+        "decq %%rcx\n\t"
+        "movq %%rcx, (%%rax)\n\t"
+        "2:\n\t"
+        :
+        : [cs] "m" (rs->rseq_cs), [cpu] "m" (rs->cpu_id), [stride] "r" (stride),
+          [lists] "r" (lists), [out] "m" (*out)
+        : "memory", "cc", "rax", "rcx", "rdx"
+        : empty, aborted);
+    return 1;
+empty:
+    return 0;
+aborted:
+    return -1;
+}
+
+/* Pushes p onto the current CPU's list unless it holds MMR_KEEP pointers */
+static inline int mmr_push(mmr_list_t *lists, size_t stride, void *p)
+{
+    struct rseq *rs = mmr_area();
+
+    __asm__ __volatile__ goto(
+        MMR_SECTION("aborted")
+        "1:\n\t"
+        "movl %[cpu], %%eax\n\t"
+        "imulq %[stride], %%rax\n\t"
+        "addq %[lists], %%rax\n\t"
+        "movq (%%rax), %%rcx\n\t"
+        "cmpq %[keep], %%rcx\n\t"
+        "jae %l[full]\n\t"
+        "movq %[p], 8(%%rax,%%rcx,8)\n\t"
+        "incq %%rcx\n\t"
+        "movq %%rcx, (%%rax)\n\t"
+        "2:\n\t"
+        :
+        : [cs] "m" (rs->rseq_cs), [cpu] "m" (rs->cpu_id), [stride] "r" (stride),
+          [lists] "r" (lists), [p] "r" (p), [keep] "i" (MMR_KEEP)
+        : "memory", "cc", "rax", "rcx"
+        : full, aborted);
+    return 1;
+full:
+    return 0;
+aborted:
+    return -1;
+}
+#endif /* MM_RSEQ */
+
+#endif /* __MMRSEQ_H_ */
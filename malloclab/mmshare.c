@@ -0,0 +1,340 @@
+/*
+ * mmshare.c - Zero-copy message passing through a shared mm heap
+ *
+ * Forks producer processes that share one mm heap (mem_init_shared)
+ * with the parent. Each producer builds its messages directly in the
+ * heap and sends only their offsets (mm_offset) down a pipe; the
+ * parent reads every message in place through mm_pointer, checks it
+ * and frees it. For comparison the same messages are then sent the
+ * way serialized data travels: built in private memory and copied
+ * through the pipe. It reports the message rate of both and checks
+ * the shared heap afterwards.
+ *
+ * Usage: mmshare [-h] [-p <producers>] [-n <messages>] [-s <maxsize>]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define MAX_PRODUCERS 64
+#define PIPE_CHUNK    (1<<16) /* bytes read from a pipe at a time */
+#define OFF_BATCH     16      /* offsets a producer sends per write */
+#define OFF_PIPE_SIZE 4096    /* pipe capacity when sending offsets */
+
+/* Message layout, in the shared heap or in the pipe */
+typedef struct {
+    uint32_t producer;  /* index of the producer */
+    uint32_t seq;       /* message number within the producer */
+    uint32_t len;       /* total bytes, header included */
+    uint32_t sum;       /* checksum of data[] */
+    uint64_t data[];
+} msg_t;
+
+/* Bytes received from one producer that do not yet form a whole unit */
+typedef struct {
+    int fd;
+    unsigned char *buf;
+    size_t have;
+} inbox_t;
+
+static void usage(void);
+static double run(int shared, int np, int n, size_t maxsize, unsigned long *bad);
+static void produce(int shared, int id, int n, size_t maxsize, int fd);
+static size_t consume(int shared, unsigned char *buf, size_t have, unsigned long *bad);
+static void fill(msg_t *m, int id, int seq, size_t len);
+static int check(msg_t *m);
+static void write_all(int fd, const void *buf, size_t len);
+static double now_ns(void);
+
+int main(int argc, char **argv)
+{
+    int c;
+    int np = 1, n = 20000;
+    size_t maxsize = 65536;
+    unsigned long bad_shared = 0, bad_copy = 0;
+    double t_shared, t_copy, msgs, bytes;
+    mm_stats_t st;
+
+    while ((c = getopt(argc, argv, "p:n:s:h")) != EOF) {
+        switch (c) {
+        case 'p': /* Number of producer processes */
+            np = atoi(optarg);
+            break;
+        case 'n': /* Messages per producer */
+            n = atoi(optarg);
+            break;
+        case 's': /* Largest message in bytes */
+            maxsize = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (np <= 0 || np > MAX_PRODUCERS || n <= 0 || maxsize < sizeof(msg_t)) {
+        usage();
+        exit(1);
+    }
+
+    if (mem_init_shared(NULL) < 0) {
+        perror("mem_init_shared");
+        exit(1);
+    }
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+
+    t_shared = run(1, np, n, maxsize, &bad_shared);
+    t_copy = run(0, np, n, maxsize, &bad_copy);
+
+    msgs = (double)np * n;
+    bytes = msgs * (sizeof(msg_t) + maxsize) / 2;
+    printf("%d producers x %d messages of %lu..%lu bytes\n", np, n,
+           (unsigned long)sizeof(msg_t), (unsigned long)maxsize);
+    printf("%-12s %12s %10s %8s\n", "mode", "msgs/s", "MB/s", "bad");
+    printf("%-12s %12.0f %10.1f %8lu\n", "shared heap", msgs / t_shared * 1e9,
+           bytes / t_shared * 1e3, bad_shared);
+    printf("%-12s %12.0f %10.1f %8lu\n", "pipe copy", msgs / t_copy * 1e9,
+           bytes / t_copy * 1e3, bad_copy);
+    printf("Shared heap passes messages %.2fx as fast\n", t_copy / t_shared);
+
+    mm_get_stats(&st);
+    printf("Heap check %s, %lu lock repairs\n", mm_check() == 0 ? "passed" : "FAILED", st.heap_repairs);
+
+    mem_deinit();
+    exit(bad_shared || bad_copy ? 1 : 0);
+}
+
+/*
+ * run - fork np producers sending n messages each over a pipe of
+ *     their own and consume them all in this process. Returns the
+ *     elapsed time in ns and counts malformed messages in *bad.
+ */
+static double run(int shared, int np, int n, size_t maxsize, unsigned long *bad)
+{
+    inbox_t in[MAX_PRODUCERS];
+    struct pollfd pfd[MAX_PRODUCERS];
+    int fds[2];
+    int i, open_fds = np;
+    size_t used;
+    ssize_t got;
+    double start = now_ns();
+
+    for (i = 0; i < np; i++) {
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            exit(1);
+        }
+        /* A pipe of offsets holds thousands of messages; keep fewer in flight in the heap */
+        if (shared)
+            fcntl(fds[1], F_SETPIPE_SZ, OFF_PIPE_SIZE);
+        switch (fork()) {
+        case -1:
+            perror("fork");
+            exit(1);
+        case 0:
+            close(fds[0]);
+            produce(shared, i, n, maxsize, fds[1]);
+            _exit(0);
+        }
+        close(fds[1]);
+        in[i].fd = fds[0];
+        in[i].have = 0;
+        if ((in[i].buf = malloc(PIPE_CHUNK + maxsize)) == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    while (open_fds > 0) {
+        for (i = 0; i < np; i++) {
+            pfd[i].fd = in[i].fd;
+            pfd[i].events = POLLIN;
+        }
+        if (poll(pfd, np, -1) < 0) {
+            perror("poll");
+            exit(1);
+        }
+        for (i = 0; i < np; i++) {
+            if (in[i].fd < 0 || !(pfd[i].revents & (POLLIN | POLLHUP)))
+                continue;
+            got = read(in[i].fd, in[i].buf + in[i].have, PIPE_CHUNK);
+            if (got <= 0) {
+                close(in[i].fd);
+                in[i].fd = -1;
+                open_fds--;
+                continue;
+            }
+            in[i].have += got;
+            used = consume(shared, in[i].buf, in[i].have, bad);
+            memmove(in[i].buf, in[i].buf + used, in[i].have - used);
+            in[i].have -= used;
+        }
+    }
+
+    for (i = 0; i < np; i++) {
+        if (in[i].have != 0)
+            (*bad)++;
+        free(in[i].buf);
+        wait(NULL);
+    }
+    return now_ns() - start;
+}
+
+/*
+ * produce - body of producer id: build n messages and send them, as
+ *     heap offsets (shared) or as bytes (!shared), down fd
+ */
+static void produce(int shared, int id, int n, size_t maxsize, int fd)
+{
+    uint32_t off[OFF_BATCH];
+    int i, k = 0;
+    size_t len;
+    msg_t *m, *scratch = NULL;
+
+    srand(id + 1);
+    if (!shared && (scratch = malloc(maxsize)) == NULL)
+        _exit(1);
+    for (i = 0; i < n; i++) {
+        len = sizeof(msg_t) + sizeof(uint64_t) * (rand() % ((maxsize - sizeof(msg_t)) / sizeof(uint64_t) + 1));
+        if (!shared) {
+            fill(scratch, id, i, len);
+            write_all(fd, scratch, len);
+            continue;
+        }
+
+        /* The consumer frees as it goes; wait for it if the heap is full */
+        while ((m = mm_malloc(len)) == NULL)
+            usleep(100);
+        fill(m, id, i, len);
+        off[k++] = mm_offset(m);
+        if (k == OFF_BATCH) {
+            write_all(fd, off, sizeof(off));
+            k = 0;
+        }
+    }
+    write_all(fd, off, k * sizeof(off[0]));
+    free(scratch);
+    close(fd);
+}
+
+/*
+ * consume - check and release every whole unit in buf[0..have):
+ *     offsets of messages in the heap (shared) or copied messages.
+ *     Returns the bytes used.
+ */
+static size_t consume(int shared, unsigned char *buf, size_t have, unsigned long *bad)
+{
+    size_t used = 0;
+    msg_t *m;
+
+    if (shared) {
+        for (; used + sizeof(uint32_t) <= have; used += sizeof(uint32_t)) {
+            m = mm_pointer(*(uint32_t *)(buf + used));
+            if (!check(m))
+                (*bad)++;
+            mm_free(m);
+        }
+        return used;
+    }
+
+    while (used + sizeof(msg_t) <= have) {
+        m = (msg_t *)(buf + used);
+        if (used + m->len > have)
+            break;
+        if (!check(m))
+            (*bad)++;
+        used += m->len;
+    }
+    return used;
+}
+
+/*
+ * fill - write message seq of producer id, len bytes in all, at m
+ */
+static void fill(msg_t *m, int id, int seq, size_t len)
+{
+    size_t k, n = (len - sizeof(msg_t)) / sizeof(uint64_t);
+    uint64_t sum = 0;
+
+    m->producer = id;
+    m->seq = seq;
+    m->len = len;
+    for (k = 0; k < n; k++) {
+        m->data[k] = (uint64_t)seq * 0x9e3779b97f4a7c15ULL + k;
+        sum += m->data[k] ^ k;
+    }
+    m->sum = (uint32_t)(sum ^ (sum >> 32));
+}
+
+/*
+ * check - returns nonzero if the message at m is intact
+ */
+static int check(msg_t *m)
+{
+    size_t k, n;
+    uint64_t sum = 0;
+
+    if (m == NULL || m->len < sizeof(msg_t))
+        return 0;
+    n = (m->len - sizeof(msg_t)) / sizeof(uint64_t);
+    for (k = 0; k < n; k++)
+        sum += m->data[k] ^ k;
+    return (uint32_t)(sum ^ (sum >> 32)) == m->sum;
+}
+
+/*
+ * write_all - write len bytes to fd, exiting on error
+ */
+static void write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, p, len)) <= 0) {
+            perror("write");
+            _exit(1);
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+/*
+ * now_ns - monotonic time in nanoseconds
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmshare [-h] [-p <producers>] [-n <messages>] [-s <maxsize>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <n>     Messages per producer (default 20000).\n");
+    fprintf(stderr, "\t-p <n>     Producer processes (default 1, at most %d).\n", MAX_PRODUCERS);
+    fprintf(stderr, "\t-s <size>  Largest message in bytes (default 65536).\n");
+}
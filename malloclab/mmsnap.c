@@ -0,0 +1,235 @@
+/*
+ * mmsnap.c - Offline fragmentation analyzer for mm_snapshot files
+ *
+ * Maps a snapshot written by mm_snapshot (see mmsnap.h) and makes a
+ * single pass over its block words to report:
+ *   - heap totals and external fragmentation,
+ *   - a histogram of free block sizes in power-of-2 buckets,
+ *   - a hole map showing how free space is spread across the heap,
+ *   - where the bytes that hold no payload went (boundary tags per
+ *     allocation tag, holes by size, the trailing wilderness block).
+ * The file is mmap'd rather than read, so multi-GB snapshots are
+ * scanned at memory speed without copying.
+ *
+ * Usage: mmsnap [-hq] [-w <cols>] [-r <rows>] <snapshot>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mmsnap.h"
+
+#define NBUCKETS 32  /* free block histogram buckets: [2^k, 2^(k+1)) bytes */
+#define NTAGS    (1 << (32 - MMSNAP_TAG_SHIFT))
+
+static void usage(void);
+static int log2_floor(uint32_t x);
+
+int main(int argc, char **argv)
+{
+    int fd, c, b, t;
+    struct stat st;
+    char *map;
+    mmsnap_hdr_t *hdr;
+    uint32_t *words;
+    uint64_t nblocks, i;
+    uint64_t off, cell, cell_bytes, ncells;
+    int cols = 64, rows = 16, show_map = 1;
+
+    /* Totals */
+    uint64_t nalloc = 0, alloc_bytes = 0, nfree = 0, free_bytes = 0;
+    uint64_t largest_free = 0, wilderness = 0, block_bytes = 0;
+    uint64_t hist_count[NBUCKETS] = {0}, hist_bytes[NBUCKETS] = {0};
+    uint64_t tag_blocks[NTAGS] = {0}, tag_bytes[NTAGS] = {0};
+    uint64_t *cell_free;
+
+    while ((c = getopt(argc, argv, "w:r:qh")) != EOF) {
+        switch (c) {
+        case 'w': /* Hole map width in cells */
+            cols = atoi(optarg);
+            break;
+        case 'r': /* Hole map height in rows */
+            rows = atoi(optarg);
+            break;
+        case 'q': /* No hole map */
+            show_map = 0;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind != argc - 1 || cols <= 0 || rows <= 0) {
+        usage();
+        exit(1);
+    }
+
+    /* Map the snapshot */
+    if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    if ((size_t)st.st_size < sizeof(mmsnap_hdr_t)) {
+        fprintf(stderr, "%s: too short to be a heap snapshot\n", argv[optind]);
+        exit(1);
+    }
+    if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    hdr = (mmsnap_hdr_t *)map;
+    words = (uint32_t *)(map + sizeof(mmsnap_hdr_t));
+    if (hdr->magic != MMSNAP_MAGIC || hdr->version != MMSNAP_VERSION) {
+        fprintf(stderr, "%s: not a version %d heap snapshot\n", argv[optind], MMSNAP_VERSION);
+        exit(1);
+    }
+    nblocks = hdr->nblocks;
+    if (nblocks > (st.st_size - sizeof(mmsnap_hdr_t)) / sizeof(uint32_t)) {
+        fprintf(stderr, "%s: truncated, using the blocks present\n", argv[optind]);
+        nblocks = (st.st_size - sizeof(mmsnap_hdr_t)) / sizeof(uint32_t);
+    }
+
+    /* Hole map cells, each covering cell_bytes of the heap */
+    ncells = (uint64_t)cols * rows;
+    cell_bytes = (hdr->heap_size + ncells - 1) / ncells;
+    if (cell_bytes == 0)
+        cell_bytes = 1;
+    if ((cell_free = (uint64_t *)calloc(ncells, sizeof(uint64_t))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    /* One pass over the blocks */
+    off = hdr->first_offset;
+    for (i = 0; i < nblocks; i++) {
+        uint32_t w = words[i];
+        uint64_t size = MMSNAP_SIZE(w);
+
+        block_bytes += size;
+        if (MMSNAP_ALLOC(w)) {
+            nalloc++;
+            alloc_bytes += size;
+            tag_blocks[MMSNAP_TAG(w)]++;
+            tag_bytes[MMSNAP_TAG(w)] += size;
+        }
+        else {
+            nfree++;
+            free_bytes += size;
+            if (size > largest_free)
+                largest_free = size;
+            b = log2_floor((uint32_t)size);
+            hist_count[b]++;
+            hist_bytes[b] += size;
+            if (i == nblocks - 1)
+                wilderness = size;
+
+            /* Spread the hole over the cells it covers */
+            for (cell = off / cell_bytes; cell < ncells && cell * cell_bytes < off + size; cell++) {
+                uint64_t lo = (off > cell * cell_bytes) ? off : cell * cell_bytes;
+                uint64_t hi = (off + size < (cell + 1) * cell_bytes) ? off + size : (cell + 1) * cell_bytes;
+                cell_free[cell] += hi - lo;
+            }
+        }
+        off += size;
+    }
+    if (off > hdr->heap_size)
+        fprintf(stderr, "Warning: blocks extend %llu bytes past the recorded heap size\n",
+                (unsigned long long)(off - hdr->heap_size));
+
+    /* Totals */
+    printf("Heap: %llu bytes at 0x%llx, %llu blocks\n", (unsigned long long)hdr->heap_size,
+           (unsigned long long)hdr->heap_lo, (unsigned long long)nblocks);
+    printf("  allocated %10llu blocks %14llu bytes\n",
+           (unsigned long long)nalloc, (unsigned long long)alloc_bytes);
+    printf("  free      %10llu blocks %14llu bytes (largest %llu)\n",
+           (unsigned long long)nfree, (unsigned long long)free_bytes,
+           (unsigned long long)largest_free);
+    printf("  external fragmentation %.1f%% (1 - largest free / free bytes)\n",
+           free_bytes ? 100.0 * (1.0 - (double)largest_free / free_bytes) : 0.0);
+
+    /* Free block histogram */
+    printf("\nFree block sizes\n%22s %10s %14s\n", "bucket (bytes)", "blocks", "bytes");
+    for (b = 0; b < NBUCKETS; b++)
+        if (hist_count[b])
+            printf("  [%8llu, %8llu) %10llu %14llu\n", 1ULL << b, 1ULL << (b + 1),
+                   (unsigned long long)hist_count[b], (unsigned long long)hist_bytes[b]);
+
+    /* Hole map: ' ' all allocated, '.' under a quarter free, ':' under half,
+       '+' under three quarters, '#' mostly free */
+    if (show_map) {
+        printf("\nHole map (%llu bytes per cell; ' ' allocated ... '#' free)\n",
+               (unsigned long long)cell_bytes);
+        for (cell = 0; cell < ncells; cell++) {
+            double f = (double)cell_free[cell] / cell_bytes;
+            if (cell % cols == 0)
+                printf("  %10llu |", (unsigned long long)(cell * cell_bytes));
+            putchar(cell * cell_bytes >= hdr->heap_size ? '~' :
+                    f == 0 ? ' ' : f < 0.25 ? '.' : f < 0.5 ? ':' : f < 0.75 ? '+' : '#');
+            if (cell % cols == (uint64_t)cols - 1)
+                printf("|\n");
+        }
+    }
+
+    /* Where the non-payload bytes went */
+    printf("\nWasted bytes (no payload)%21s %7s\n", "bytes", "heap%");
+#define WASTE(label, n) printf("  %-34s %9llu %6.2f%%\n", label, (unsigned long long)(n), \
+                               hdr->heap_size ? 100.0 * (n) / hdr->heap_size : 0.0)
+    WASTE("prologue/epilogue/padding", hdr->heap_size - block_bytes);
+    for (t = 0; t < NTAGS; t++) {
+        if (tag_blocks[t]) {
+            char label[64];
+            sprintf(label, "boundary tags, tag %d", t);
+            WASTE(label, tag_blocks[t] * hdr->overhead);
+        }
+    }
+    for (b = 0; b < NBUCKETS; b++) {
+        uint64_t holes = hist_bytes[b];
+        if (b == log2_floor((uint32_t)(wilderness ? wilderness : 1)) && wilderness)
+            holes -= wilderness;
+        if (holes) {
+            char label[64];
+            sprintf(label, "holes of [%llu, %llu) bytes", 1ULL << b, 1ULL << (b + 1));
+            WASTE(label, holes);
+        }
+    }
+    WASTE("wilderness (trailing free)", wilderness);
+#undef WASTE
+
+    free(cell_free);
+    munmap(map, st.st_size);
+    close(fd);
+    exit(0);
+}
+
+/*
+ * log2_floor - index of the highest set bit of x (0 for x = 0)
+ */
+static int log2_floor(uint32_t x)
+{
+    int b = 0;
+
+    while (x >>= 1)
+        b++;
+    return b;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmsnap [-hq] [-w <cols>] [-r <rows>] <snapshot>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-q         Don't print the hole map.\n");
+    fprintf(stderr, "\t-r <rows>  Hole map height (default 16).\n");
+    fprintf(stderr, "\t-w <cols>  Hole map width (default 64).\n");
+}
@@ -0,0 +1,34 @@
+/*
+ * mmsnap.h - binary heap snapshot format written by mm_snapshot
+ *
+ * A snapshot is an mmsnap_hdr_t followed by one 32-bit word per heap
+ * block, in address order from the first block after the prologue up
+ * to (not including) the epilogue. Each word is the block's header as
+ * mm.c stores it: the size in the middle bits, the allocated bit in
+ * bit 0 and the allocation tag in the top MMSNAP_TAG_BITS bits. Block
+ * offsets are implied by summing the sizes from first_offset.
+ */
+#ifndef __MMSNAP_H_
+#define __MMSNAP_H_
+
+#include <stdint.h>
+
+#define MMSNAP_MAGIC   0x4e534d4d  /* "MMSN" */
+#define MMSNAP_VERSION 1
+
+#define MMSNAP_TAG_SHIFT 28
+#define MMSNAP_SIZE(w)   ((w) & ~0x7u & ((1u << MMSNAP_TAG_SHIFT) - 1))
+#define MMSNAP_ALLOC(w)  ((w) & 0x1)
+#define MMSNAP_TAG(w)    ((w) >> MMSNAP_TAG_SHIFT)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t heap_lo;       /* address of the first heap byte when taken */
+    uint64_t heap_size;     /* bytes between mem_heap_lo and the brk */
+    uint64_t nblocks;       /* number of block words that follow */
+    uint32_t first_offset;  /* offset of the first block's header from heap_lo */
+    uint32_t overhead;      /* per-block boundary-tag bytes (header + footer) */
+} mmsnap_hdr_t;
+
+#endif /* __MMSNAP_H_ */
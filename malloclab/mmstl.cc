@@ -0,0 +1,273 @@
+/*
+ * mmstl.cc - Container benchmark for mm_allocator
+ *
+ * Runs the same node-heavy workload on std::map, std::list and
+ * std::unordered_map, once with std::allocator (the C library
+ * malloc) and once with mm_allocator (the mm heap, through the size
+ * class of each container's node type): insert n keys in a shuffled
+ * order, look every key up, erase every other key, insert those keys
+ * again and clear the container. It reports the mean time per
+ * operation of each phase, checks the results and the mm heap, and
+ * prints the share of node allocations mm_malloc_class served from
+ * its class lists.
+ *
+ * Usage: mmstl [-h] [-n <keys>] [-r <rounds>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mm_allocator.h"
+extern "C" {
+#include "memlib.h"
+}
+
+#define NPHASES 5
+
+static const char *phase_names[NPHASES] = {
+    "insert", "lookup", "erase", "reinsert", "clear"
+};
+
+/* Mean ns per operation of each phase, and whether the results were right */
+struct result_t {
+    double ns[NPHASES];
+    bool ok;
+};
+
+typedef std::map<long, long, std::less<long>, mm_allocator<std::pair<const long, long> > > mm_map;
+typedef std::list<long, mm_allocator<long> > mm_list;
+typedef std::unordered_map<long, long, std::hash<long>, std::equal_to<long>,
+                           mm_allocator<std::pair<const long, long> > > mm_umap;
+
+static void usage(void);
+template <class Map> static void run_map(const std::vector<long> &keys, int rounds, result_t *out);
+template <class List> static void run_list(const std::vector<long> &keys, int rounds, result_t *out);
+static void print_row(const char *name, const char *alloc, const result_t &r);
+static double now_ns(void);
+
+int main(int argc, char **argv)
+{
+    int c;
+    int n = 200000, rounds = 3;
+    bool ok = true;
+    std::vector<long> keys;
+    result_t std_map, mm_map_r, std_list, mm_list_r, std_umap, mm_umap_r;
+    mm_stats_t st;
+
+    while ((c = getopt(argc, argv, "n:r:h")) != EOF) {
+        switch (c) {
+        case 'n': /* Keys per container */
+            n = atoi(optarg);
+            break;
+        case 'r': /* Rounds of each workload */
+            rounds = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (n <= 0 || rounds <= 0) {
+        usage();
+        exit(1);
+    }
+
+    mem_init();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+
+    /* Same shuffled keys for every run */
+    srand(1);
+    for (long k = 0; k < n; k++)
+        keys.push_back(k * 7919);
+    for (int i = n - 1; i > 0; i--)
+        std::swap(keys[i], keys[rand() % (i + 1)]);
+
+    run_map<std::map<long, long> >(keys, rounds, &std_map);
+    run_map<mm_map>(keys, rounds, &mm_map_r);
+    run_list<std::list<long> >(keys, rounds, &std_list);
+    run_list<mm_list>(keys, rounds, &mm_list_r);
+    run_map<std::unordered_map<long, long> >(keys, rounds, &std_umap);
+    run_map<mm_umap>(keys, rounds, &mm_umap_r);
+
+    printf("%d keys, %d rounds, ns per operation\n", n, rounds);
+    printf("%-14s %-6s", "container", "alloc");
+    for (int p = 0; p < NPHASES; p++)
+        printf(" %9s", phase_names[p]);
+    printf("\n");
+    print_row("map", "std", std_map);
+    print_row("map", "mm", mm_map_r);
+    print_row("list", "std", std_list);
+    print_row("list", "mm", mm_list_r);
+    print_row("unordered_map", "std", std_umap);
+    print_row("unordered_map", "mm", mm_umap_r);
+
+    ok = std_map.ok && mm_map_r.ok && std_list.ok && mm_list_r.ok && std_umap.ok && mm_umap_r.ok;
+    mm_get_stats(&st);
+    printf("%lu of %lu node allocations (%.1f%%) served from class lists\n",
+           st.class_hits, st.class_hits + st.class_carves,
+           st.class_hits ? 100.0 * st.class_hits / (st.class_hits + st.class_carves) : 0.0);
+    printf("Results %s, heap check %s\n", ok ? "correct" : "WRONG",
+           mm_check() == 0 ? "passed" : "FAILED");
+
+    mem_deinit();
+    exit(ok ? 0 : 1);
+}
+
+/*
+ * run_map - time the phases of the workload on an associative
+ *     container of type Map, keeping the fastest of rounds runs
+ */
+template <class Map>
+static void run_map(const std::vector<long> &keys, int rounds, result_t *out)
+{
+    size_t n = keys.size();
+    double start, t[NPHASES];
+    long sum, want = 0;
+
+    for (size_t i = 0; i < n; i++)
+        want += keys[i];
+    out->ok = true;
+    for (int p = 0; p < NPHASES; p++)
+        out->ns[p] = 1e30;
+
+    for (int r = 0; r < rounds; r++) {
+        Map m;
+
+        start = now_ns();
+        for (size_t i = 0; i < n; i++)
+            m.insert(std::make_pair(keys[i], keys[i]));
+        t[0] = now_ns() - start;
+
+        start = now_ns();
+        sum = 0;
+        for (size_t i = 0; i < n; i++)
+            sum += m.find(keys[i])->second;
+        t[1] = now_ns() - start;
+        out->ok = out->ok && sum == want;
+
+        start = now_ns();
+        for (size_t i = 0; i < n; i += 2)
+            m.erase(keys[i]);
+        t[2] = now_ns() - start;
+        out->ok = out->ok && m.size() == n / 2;
+
+        start = now_ns();
+        for (size_t i = 0; i < n; i += 2)
+            m.insert(std::make_pair(keys[i], keys[i]));
+        t[3] = now_ns() - start;
+        out->ok = out->ok && m.size() == n;
+
+        start = now_ns();
+        m.clear();
+        t[4] = now_ns() - start;
+
+        for (int p = 0; p < NPHASES; p++)
+            out->ns[p] = std::min(out->ns[p], t[p] / (p == 2 || p == 3 ? (n + 1) / 2 : n));
+    }
+}
+
+/*
+ * run_list - the same workload on a sequence container of type List:
+ *     push every key, walk the list, erase every other node and push
+ *     those keys again
+ */
+template <class List>
+static void run_list(const std::vector<long> &keys, int rounds, result_t *out)
+{
+    size_t n = keys.size();
+    double start, t[NPHASES];
+    long sum, want = 0;
+
+    for (size_t i = 0; i < n; i++)
+        want += keys[i];
+    out->ok = true;
+    for (int p = 0; p < NPHASES; p++)
+        out->ns[p] = 1e30;
+
+    for (int r = 0; r < rounds; r++) {
+        List l;
+        typename List::iterator it;
+        size_t i;
+
+        start = now_ns();
+        for (i = 0; i < n; i++)
+            l.push_back(keys[i]);
+        t[0] = now_ns() - start;
+
+        start = now_ns();
+        sum = 0;
+        for (it = l.begin(); it != l.end(); ++it)
+            sum += *it;
+        t[1] = now_ns() - start;
+        out->ok = out->ok && sum == want;
+
+        start = now_ns();
+        for (it = l.begin(), i = 0; it != l.end(); i++)
+            it = (i % 2 == 0) ? l.erase(it) : ++it;
+        t[2] = now_ns() - start;
+        out->ok = out->ok && l.size() == n / 2;
+
+        start = now_ns();
+        for (i = 0; i < n; i += 2)
+            l.push_back(keys[i]);
+        t[3] = now_ns() - start;
+        out->ok = out->ok && l.size() == n;
+
+        start = now_ns();
+        l.clear();
+        t[4] = now_ns() - start;
+
+        for (int p = 0; p < NPHASES; p++)
+            out->ns[p] = std::min(out->ns[p], t[p] / (p == 2 || p == 3 ? (n + 1) / 2 : n));
+    }
+}
+
+/*
+ * print_row - print the per-phase times of one container and allocator
+ */
+static void print_row(const char *name, const char *alloc, const result_t &r)
+{
+    printf("%-14s %-6s", name, alloc);
+    for (int p = 0; p < NPHASES; p++)
+        printf(" %9.1f", r.ns[p]);
+    printf("%s\n", r.ok ? "" : "  WRONG");
+}
+
+/*
+ * now_ns - monotonic time in nanoseconds
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmstl [-h] [-n <keys>] [-r <rounds>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <n>     Keys per container (default 200000).\n");
+    fprintf(stderr, "\t-r <n>     Rounds of each workload; the fastest is reported (default 3).\n");
+}
@@ -0,0 +1,204 @@
+/*
+ * mmtimeline.c - Turn an mm_trace_dump file into a readable timeline
+ *
+ * Merges the per-thread event rings written by an MM_TRACE=1 build of
+ * mm.c into one timeline ordered by cycle counter and prints a summary
+ * of the events: how often the heap was extended, how each coalesce
+ * case was hit, how deep find_fit searched and which realloc paths
+ * were taken.
+ *
+ * Usage: mmtimeline [-s] <dumpfile>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmtrace.h"
+
+/* An event tagged with the thread that recorded it */
+typedef struct {
+    mmt_event_t ev;
+    uint32_t tid;
+} tevent_t;
+
+static const char *type_names[MMT_NTYPES] = {
+    "?", "extend", "split", "coalesce", "fit", "realloc"
+};
+static const char *realloc_names[MMT_RA_NPATHS] = {
+    "free", "malloc", "move", "shrink", "grow", "slide"
+};
+
+static void usage(void);
+static int cmp_tsc(const void *a, const void *b);
+static void print_event(tevent_t *t, uint64_t t0);
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    mmt_file_hdr_t fh;
+    mmt_ring_hdr_t rh;
+    tevent_t *events = NULL;
+    size_t nevents = 0;
+    uint32_t i, j;
+    int c;
+    int summary_only = 0;
+
+    /* Summary counters */
+    unsigned long count[MMT_NTYPES] = {0};
+    unsigned long coalesce_case[5] = {0};
+    unsigned long realloc_path[MMT_RA_NPATHS] = {0};
+    unsigned long fit_misses = 0, fit_depth_sum = 0, fit_depth_max = 0;
+    unsigned long long extend_bytes = 0;
+
+    while ((c = getopt(argc, argv, "sh")) != EOF) {
+        switch (c) {
+        case 's': /* Print the summary only */
+            summary_only = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        exit(1);
+    }
+
+    if ((fp = fopen(argv[optind], "rb")) == NULL) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    if (fread(&fh, sizeof(fh), 1, fp) != 1 || fh.magic != MMT_MAGIC ||
+        fh.version != MMT_VERSION || fh.event_size != sizeof(mmt_event_t)) {
+        fprintf(stderr, "%s: not an mm trace dump (version %d)\n", argv[optind], MMT_VERSION);
+        exit(1);
+    }
+
+    /* Load every thread's section */
+    for (i = 0; i < fh.nrings; i++) {
+        if (fread(&rh, sizeof(rh), 1, fp) != 1) {
+            fprintf(stderr, "Truncated dump\n");
+            exit(1);
+        }
+        printf("thread %u: %u events, %llu older events dropped\n",
+               rh.tid, rh.nevents, (unsigned long long)rh.dropped);
+        if ((events = (tevent_t *)realloc(events, (nevents + rh.nevents) * sizeof(tevent_t))) == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        for (j = 0; j < rh.nevents; j++) {
+            if (fread(&events[nevents].ev, sizeof(mmt_event_t), 1, fp) != 1) {
+                fprintf(stderr, "Truncated dump\n");
+                exit(1);
+            }
+            events[nevents++].tid = rh.tid;
+        }
+    }
+    fclose(fp);
+
+    qsort(events, nevents, sizeof(tevent_t), cmp_tsc);
+
+    /* Print the timeline and accumulate the summary */
+    if (!summary_only && nevents > 0)
+        printf("\n%14s %8s %-9s %10s %10s  %s\n", "cycles", "tid", "event", "offset", "size", "detail");
+    for (j = 0; j < nevents; j++) {
+        mmt_event_t *e = &events[j].ev;
+
+        if (!summary_only)
+            print_event(&events[j], events[0].ev.tsc);
+        if (e->type >= MMT_NTYPES)
+            continue;
+        count[e->type]++;
+        switch (e->type) {
+        case MMT_EXTEND:
+            extend_bytes += e->size;
+            break;
+        case MMT_COALESCE:
+            if (e->arg >= 1 && e->arg <= 4)
+                coalesce_case[e->arg]++;
+            break;
+        case MMT_FIT:
+            fit_depth_sum += e->arg;
+            if (e->arg > fit_depth_max)
+                fit_depth_max = e->arg;
+            if (e->addr == 0)
+                fit_misses++;
+            break;
+        case MMT_REALLOC:
+            if (e->arg < MMT_RA_NPATHS)
+                realloc_path[e->arg]++;
+            break;
+        }
+    }
+
+    printf("\nSummary of %lu events\n", (unsigned long)nevents);
+    printf("  extend    %8lu  (%llu bytes)\n", count[MMT_EXTEND], extend_bytes);
+    printf("  split     %8lu\n", count[MMT_SPLIT]);
+    printf("  coalesce  %8lu  (case 1: %lu, 2: %lu, 3: %lu, 4: %lu)\n", count[MMT_COALESCE],
+           coalesce_case[1], coalesce_case[2], coalesce_case[3], coalesce_case[4]);
+    printf("  fit       %8lu  (misses: %lu, mean depth: %.1f, max depth: %lu)\n", count[MMT_FIT],
+           fit_misses, count[MMT_FIT] ? (double)fit_depth_sum / count[MMT_FIT] : 0.0,
+           fit_depth_max);
+    printf("  realloc   %8lu  (free: %lu, malloc: %lu, move: %lu, shrink: %lu, grow: %lu, slide: %lu)\n",
+           count[MMT_REALLOC], realloc_path[MMT_RA_FREE], realloc_path[MMT_RA_MALLOC],
+           realloc_path[MMT_RA_MOVE], realloc_path[MMT_RA_SHRINK], realloc_path[MMT_RA_GROW],
+           realloc_path[MMT_RA_SLIDE]);
+
+    free(events);
+    exit(0);
+}
+
+/*
+ * print_event - print one timeline line, with the time relative to t0
+ */
+static void print_event(tevent_t *t, uint64_t t0)
+{
+    mmt_event_t *e = &t->ev;
+    const char *name = (e->type < MMT_NTYPES) ? type_names[e->type] : "?";
+
+    printf("%14llu %8u %-9s %10u %10u  ", (unsigned long long)(e->tsc - t0),
+           t->tid, name, e->addr, e->size);
+    switch (e->type) {
+    case MMT_SPLIT:
+        printf("remainder %u\n", e->arg);
+        break;
+    case MMT_COALESCE:
+        printf("case %u\n", e->arg);
+        break;
+    case MMT_FIT:
+        printf("%s after %u blocks\n", e->addr ? "hit" : "miss", e->arg);
+        break;
+    case MMT_REALLOC:
+        printf("%s\n", (e->arg < MMT_RA_NPATHS) ? realloc_names[e->arg] : "?");
+        break;
+    default:
+        printf("\n");
+    }
+}
+
+/*
+ * cmp_tsc - qsort comparator ordering events by timestamp
+ */
+static int cmp_tsc(const void *a, const void *b)
+{
+    uint64_t ta = ((const tevent_t *)a)->ev.tsc;
+    uint64_t tb = ((const tevent_t *)b)->ev.tsc;
+
+    return (ta > tb) - (ta < tb);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmtimeline [-hs] <dumpfile>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-s         Print the summary only, not every event.\n");
+}
@@ -0,0 +1,100 @@
+/*
+ * mmtrace.c - per-thread event rings for the MM_TRACE build of mm.c
+ *
+ * Each thread lazily allocates its own ring the first time it records
+ * an event and pushes it onto a global registry with a compare-and-swap,
+ * so neither recording nor registration ever takes a lock. Rings live
+ * until the process exits. mm_trace_dump may run on any thread: it
+ * copies each ring and then discards the copied events that the owner
+ * overwrote while the copy was in progress.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "mmtrace.h"
+
+#if MM_TRACE
+__thread mmt_ring_t *mmt_ring = NULL; /* calling thread's ring */
+static mmt_ring_t *mmt_rings = NULL;  /* registry of all rings */
+
+/*
+ * mmt_attach - allocate and register the calling thread's ring
+ */
+mmt_ring_t *mmt_attach(void)
+{
+    mmt_ring_t *r;
+
+    if ((r = (mmt_ring_t *)calloc(1, sizeof(mmt_ring_t))) == NULL)
+        return NULL;
+    r->tid = (uint32_t)syscall(SYS_gettid);
+    r->next = __atomic_load_n(&mmt_rings, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&mmt_rings, &r->next, r, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        ;
+    mmt_ring = r;
+    return r;
+}
+#endif
+
+/*
+ * mm_trace_dump - write the events of every thread to path
+ */
+int mm_trace_dump(const char *path)
+{
+    FILE *fp;
+    mmt_file_hdr_t fh;
+
+    if ((fp = fopen(path, "wb")) == NULL)
+        return -1;
+
+    fh.magic = MMT_MAGIC;
+    fh.version = MMT_VERSION;
+    fh.nrings = 0;
+    fh.event_size = sizeof(mmt_event_t);
+#if MM_TRACE
+    {
+        mmt_ring_t *r;
+        mmt_ring_hdr_t rh;
+        mmt_event_t *copy;
+        unsigned long head, after, first, lost, skip, n, i;
+
+        for (r = __atomic_load_n(&mmt_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+            fh.nrings++;
+        fwrite(&fh, sizeof(fh), 1, fp);
+
+        if ((copy = (mmt_event_t *)malloc(sizeof(r->ev))) == NULL) {
+            fclose(fp);
+            return -1;
+        }
+        for (r = __atomic_load_n(&mmt_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+            head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+            first = (head > MMT_RING_EVENTS) ? head - MMT_RING_EVENTS : 0;
+            n = head - first;
+            for (i = 0; i < n; i++)
+                copy[i] = r->ev[(first + i) & (MMT_RING_EVENTS - 1)];
+
+            /* Events the writer lapped during the copy are no longer trustworthy */
+            after = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+            lost = (after > MMT_RING_EVENTS) ? after - MMT_RING_EVENTS : 0;
+            skip = (lost > first) ? lost - first : 0;
+            if (skip > n)
+                skip = n;
+
+            rh.tid = r->tid;
+            rh.nevents = (uint32_t)(n - skip);
+            rh.dropped = first + skip;
+            fwrite(&rh, sizeof(rh), 1, fp);
+            fwrite(copy + skip, sizeof(mmt_event_t), rh.nevents, fp);
+        }
+        free(copy);
+    }
+#else
+    fwrite(&fh, sizeof(fh), 1, fp);
+#endif
+    if (fclose(fp) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * mmtrace.h - optional event tracing of the allocator internals in mm.c
+ *
+ * When mm.c is built with MM_TRACE=1 (make MM_TRACE=1), every heap
+ * extension, split, coalesce, fit search and realloc decision is
+ * recorded with a cycle-counter timestamp into a per-thread ring
+ * buffer. The newest MMT_RING_EVENTS events of each thread are kept.
+ * mm_trace_dump writes all rings to a binary file that mmtimeline
+ * turns into a readable timeline.
+ *
+ * With MM_TRACE=0 (the default) the hooks expand to nothing, so the
+ * allocator is compiled exactly as if they were not there.
+ */
+#ifndef __MMTRACE_H_
+#define __MMTRACE_H_
+
+#include <stdint.h>
+
+#ifndef MM_TRACE
+#define MM_TRACE 0
+#endif
+
+/* Event types */
+#define MMT_EXTEND    1  /* extend_heap: addr/size of the new free block */
+#define MMT_SPLIT     2  /* place split a block: addr/size of the allocated part, arg = remainder */
+#define MMT_COALESCE  3  /* coalesce: addr/size of the result, arg = case 1-4 */
+#define MMT_FIT       4  /* find_fit: addr of the fit (0 = miss), size = asize, arg = blocks scanned */
+#define MMT_REALLOC   5  /* mm_realloc: addr/size of the result, arg = MMT_RA_xxx path */
+#define MMT_NTYPES    6
+
+/* Realloc paths recorded in the arg field of MMT_REALLOC */
+#define MMT_RA_FREE   0  /* size 0: block freed */
+#define MMT_RA_MALLOC 1  /* NULL pointer: plain malloc */
+#define MMT_RA_MOVE   2  /* new block allocated, data copied, old block freed */
+#define MMT_RA_SHRINK 3  /* shrunk in place */
+#define MMT_RA_GROW   4  /* grown in place into the next block or the wilderness */
+#define MMT_RA_SLIDE  5  /* slid down into the free block before it */
+#define MMT_RA_NPATHS 6
+
+#define MMT_RING_EVENTS (1 << 16) /* events kept per thread (power of 2) */
+
+/* One recorded event (24 bytes, written as-is to the dump) */
+typedef struct {
+    uint64_t tsc;   /* cycle counter at the time of the event */
+    uint32_t type;  /* MMT_xxx */
+    uint32_t arg;   /* event-specific argument */
+    uint32_t addr;  /* block pointer as an offset from mem_heap_lo(), 0 if none */
+    uint32_t size;  /* block size in bytes */
+} mmt_event_t;
+
+/*
+ * Dump file layout: an mmt_file_hdr_t, then for each thread an
+ * mmt_ring_hdr_t followed by its events from oldest to newest.
+ */
+#define MMT_MAGIC   0x52544d4d  /* "MMTR" */
+#define MMT_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nrings;     /* number of per-thread sections that follow */
+    uint32_t event_size; /* sizeof(mmt_event_t) */
+} mmt_file_hdr_t;
+
+typedef struct {
+    uint32_t tid;        /* kernel thread id of the writer */
+    uint32_t nevents;    /* events in this section */
+    uint64_t dropped;    /* older events overwritten before the dump */
+} mmt_ring_hdr_t;
+
+/* Write every thread's ring to path. Returns 0 on success, -1 on error. */
+int mm_trace_dump(const char *path);
+
+#if MM_TRACE
+/* Per-thread ring buffer. Only its owner thread writes; head is published with release order. */
+typedef struct mmt_ring {
+    unsigned long head;       /* total events ever written (word sized so stores are atomic) */
+    uint32_t tid;
+    struct mmt_ring *next;    /* registry of all rings (push-only) */
+    mmt_event_t ev[MMT_RING_EVENTS];
+} mmt_ring_t;
+
+extern __thread mmt_ring_t *mmt_ring;
+mmt_ring_t *mmt_attach(void);
+
+static inline uint64_t mmt_tsc(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
+static inline void mmt_record(uint32_t type, uint32_t arg, uint32_t addr, uint32_t size)
+{
+    mmt_ring_t *r = mmt_ring ? mmt_ring : mmt_attach();
+    mmt_event_t *e;
+
+    if (r == NULL)
+        return;
+    e = &r->ev[r->head & (MMT_RING_EVENTS - 1)];
+    e->tsc = mmt_tsc();
+    e->type = type;
+    e->arg = arg;
+    e->addr = addr;
+    e->size = size;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+#define MMT_EVENT(type, arg, bp, size) \
+    mmt_record((type), (arg), \
+               (bp) ? (uint32_t)((char *)(bp) - (char *)mem_heap_lo()) : 0, (size))
+#define MMT_ONLY(stmt) stmt
+#else
+#define MMT_EVENT(type, arg, bp, size) ((void)0)
+#define MMT_ONLY(stmt)
+#endif
+
+#endif /* __MMTRACE_H_ */
@@ -0,0 +1,229 @@
+/*
+ * pattern.c - Fill and check payloads with mdriver's patterns
+ *
+ * Word k of the payload of id index is seed(index) ^ k * STEP, where
+ * seed is a 64-bit mix of the id, so no two words of live payloads are
+ * likely to be equal. The k * STEP terms of successive words differ by
+ * an add of STEP, which SSE2 and AVX2 do on 2 and 4 words at a time
+ * (neither has a 64-bit multiply). pattern_init picks the widest
+ * kernels the CPU supports; other targets get the scalar ones.
+ * Payloads start ALIGNMENT (8) bytes aligned, but the kernels use
+ * unaligned loads and stores anyway.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "pattern.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#define PATTERN_X86 1
+#include <immintrin.h>
+#else
+#define PATTERN_X86 0
+#endif
+
+#define STEP 0x9e3779b97f4a7c15ULL   /* 2^64 / golden ratio */
+
+/* Kernels: fill or check n words starting at word k of the payload at w */
+typedef void (*fill_fn)(unsigned char *w, uint64_t seed, size_t k, size_t n);
+typedef long (*check_fn)(const unsigned char *w, uint64_t seed, size_t k, size_t n);
+
+static void fill_scalar(unsigned char *w, uint64_t seed, size_t k, size_t n);
+static long check_scalar(const unsigned char *w, uint64_t seed, size_t k, size_t n);
+
+static fill_fn fill_words = fill_scalar;
+static check_fn check_words = check_scalar;
+static const char *kernel_name = "scalar";
+
+/*
+ * seed - the pattern's first word for id index (the splitmix64 finalizer)
+ */
+static uint64_t seed(int index)
+{
+    uint64_t z = (uint64_t)(unsigned int)index + STEP;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void fill_scalar(unsigned char *w, uint64_t seed, size_t k, size_t n)
+{
+    uint64_t v;
+    size_t i;
+
+    for (i = 0; i < n; i++, k++) {
+        v = seed ^ k * STEP;
+        memcpy(w + 8 * i, &v, 8);
+    }
+}
+
+static long check_scalar(const unsigned char *w, uint64_t seed, size_t k, size_t n)
+{
+    uint64_t v;
+    size_t i;
+
+    for (i = 0; i < n; i++, k++) {
+        memcpy(&v, w + 8 * i, 8);
+        if (v != (seed ^ k * STEP))
+            return i;
+    }
+    return -1;
+}
+
+#if PATTERN_X86
+/*
+ * The vector kernels keep the words' k * STEP terms in a register and
+ * add lanes * STEP to them each step; the last n % lanes words are
+ * left to the scalar kernels.
+ */
+__attribute__((target("sse2")))
+static void fill_sse2(unsigned char *w, uint64_t seed, size_t k, size_t n)
+{
+    __m128i s = _mm_set1_epi64x(seed);
+    __m128i ks = _mm_set_epi64x((k + 1) * STEP, k * STEP);
+    __m128i step = _mm_set1_epi64x(2 * STEP);
+    size_t i;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        _mm_storeu_si128((__m128i *)(w + 8 * i), _mm_xor_si128(s, ks));
+        ks = _mm_add_epi64(ks, step);
+    }
+    fill_scalar(w + 8 * i, seed, k + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static long check_sse2(const unsigned char *w, uint64_t seed, size_t k, size_t n)
+{
+    __m128i s = _mm_set1_epi64x(seed);
+    __m128i ks = _mm_set_epi64x((k + 1) * STEP, k * STEP);
+    __m128i step = _mm_set1_epi64x(2 * STEP);
+    __m128i v;
+    size_t i;
+    long bad;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        v = _mm_loadu_si128((const __m128i *)(w + 8 * i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_xor_si128(s, ks))) != 0xffff)
+            break;
+        ks = _mm_add_epi64(ks, step);
+    }
+    bad = check_scalar(w + 8 * i, seed, k + i, n - i);
+    return bad < 0 ? -1 : (long)i + bad;
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(unsigned char *w, uint64_t seed, size_t k, size_t n)
+{
+    __m256i s = _mm256_set1_epi64x(seed);
+    __m256i ks = _mm256_set_epi64x((k + 3) * STEP, (k + 2) * STEP, (k + 1) * STEP, k * STEP);
+    __m256i step = _mm256_set1_epi64x(4 * STEP);
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_si256((__m256i *)(w + 8 * i), _mm256_xor_si256(s, ks));
+        ks = _mm256_add_epi64(ks, step);
+    }
+    fill_scalar(w + 8 * i, seed, k + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static long check_avx2(const unsigned char *w, uint64_t seed, size_t k, size_t n)
+{
+    __m256i s = _mm256_set1_epi64x(seed);
+    __m256i ks = _mm256_set_epi64x((k + 3) * STEP, (k + 2) * STEP, (k + 1) * STEP, k * STEP);
+    __m256i step = _mm256_set1_epi64x(4 * STEP);
+    __m256i v;
+    size_t i;
+    long bad;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        v = _mm256_loadu_si256((const __m256i *)(w + 8 * i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_xor_si256(s, ks))) != -1)
+            break;
+        ks = _mm256_add_epi64(ks, step);
+    }
+    bad = check_scalar(w + 8 * i, seed, k + i, n - i);
+    return bad < 0 ? -1 : (long)i + bad;
+}
+#endif /* PATTERN_X86 */
+
+/*
+ * pattern_init - Pick the fastest fill and check kernels this CPU runs
+ */
+void pattern_init(void)
+{
+#if PATTERN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        fill_words = fill_avx2;
+        check_words = check_avx2;
+        kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        fill_words = fill_sse2;
+        check_words = check_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+/*
+ * pattern_kernel - Name of the kernels pattern_init picked
+ */
+const char *pattern_kernel(void)
+{
+    return kernel_name;
+}
+
+/*
+ * pattern_fill - Write the pattern of id index into bytes [from, to)
+ *     of payload p: the partial words at either end byte by byte, the
+ *     whole words between with the kernel
+ */
+void pattern_fill(char *p, int index, size_t from, size_t to)
+{
+    uint64_t s = seed(index), v;
+    size_t k;
+
+    if (from >= to)
+        return;
+    if (from % 8 != 0) {
+        k = from / 8;
+        v = s ^ k * STEP;
+        while (from % 8 != 0 && from < to) {
+            p[from] = ((unsigned char *)&v)[from % 8];
+            from++;
+        }
+    }
+    fill_words((unsigned char *)p + from, s, from / 8, (to - from) / 8);
+    for (from += (to - from) & ~(size_t)7; from < to; from++) {
+        v = s ^ (from / 8) * STEP;
+        p[from] = ((unsigned char *)&v)[from % 8];
+    }
+}
+
+/*
+ * pattern_check - Return the offset of the first of the len bytes of
+ *     payload p that differs from the pattern of id index, or -1
+ */
+long pattern_check(const char *p, int index, size_t len)
+{
+    uint64_t s = seed(index), v;
+    size_t whole = len & ~(size_t)7, j;
+    long bad;
+
+    if ((bad = check_words((const unsigned char *)p, s, 0, whole / 8)) >= 0) {
+        for (j = 8 * bad; ; j++) {
+            v = s ^ (j / 8) * STEP;
+            if (p[j] != ((char *)&v)[j % 8])
+                return j;
+        }
+    }
+    for (j = whole; j < len; j++) {
+        v = s ^ (j / 8) * STEP;
+        if (p[j] != ((char *)&v)[j % 8])
+            return j;
+    }
+    return -1;
+}
@@ -0,0 +1,27 @@
+/*
+ * pattern.h - Payload fill patterns for mdriver's correctness checks
+ *
+ * The payload of the block with trace id index is filled with 8-byte
+ * words that depend on both the id and the word's offset in the
+ * payload, so a realloc that copies the wrong block, or the right
+ * block to the wrong place, leaves words that fail pattern_check.
+ */
+#ifndef __PATTERN_H_
+#define __PATTERN_H_
+
+#include <stddef.h>
+
+/* Pick the fastest fill and check kernels this CPU runs */
+void pattern_init(void);
+
+/* Name of the kernels pattern_init picked */
+const char *pattern_kernel(void);
+
+/* Write the pattern of id index into bytes [from, to) of payload p */
+void pattern_fill(char *p, int index, size_t from, size_t to);
+
+/* Return the offset of the first of the len bytes of payload p that
+   differs from the pattern of id index, or -1 if none does */
+long pattern_check(const char *p, int index, size_t len);
+
+#endif /* __PATTERN_H_ */
@@ -0,0 +1,185 @@
+/*
+ * perfctr.c - Hardware event counts around a replay (mdriver -E)
+ *
+ * The events are opened in two groups, the core events and the cache
+ * and TLB misses, so that each group fits in the PMU's counters and
+ * its events are counted over the same cycles. If the kernel has to
+ * multiplex the groups, the counts are scaled by the time each group
+ * was enabled over the time it ran. Counters are per thread and not
+ * inherited, so mdriver's decoder and maintenance threads are not
+ * counted.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define NGROUPS 2
+
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    int group;
+    uint32_t type;
+    uint64_t config;
+} events[PC_NEVENTS] = {
+    [PC_CYCLES]        = { 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PC_INSTRUCTIONS]  = { 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PC_BRANCH_MISSES] = { 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PC_L1D_MISSES]    = { 1, PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    [PC_LLC_MISSES]    = { 1, PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL) },
+    [PC_DTLB_MISSES]   = { 1, PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+};
+
+static int fds[PC_NEVENTS];      /* counter of each event, or -1 */
+static int slot[PC_NEVENTS];     /* its place in its group's reads */
+static int leader[NGROUPS];      /* first counter opened in each group, or -1 */
+static int nmembers[NGROUPS];
+static char error[128] = "perfctr_open not called";
+
+/*
+ * open_event - Open a user-mode counter of event e on this thread,
+ *     stopped if it leads its group
+ */
+static int open_event(int e, int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[e].type;
+    attr.config = events[e].config;
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+	PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/*
+ * perfctr_open - Open as many of the events as this CPU and kernel
+ *     will count; return how many that is
+ */
+int perfctr_open(void)
+{
+    int e, g, n = 0, err = 0;
+
+    for (g = 0; g < NGROUPS; g++) {
+	leader[g] = -1;
+	nmembers[g] = 0;
+    }
+    for (e = 0; e < PC_NEVENTS; e++) {
+	g = events[e].group;
+	if ((fds[e] = open_event(e, leader[g])) < 0) {
+	    if (err == 0)
+		err = errno;
+	    continue;
+	}
+	if (leader[g] < 0)
+	    leader[g] = fds[e];
+	slot[e] = nmembers[g]++;
+	n++;
+    }
+    if (n == 0)
+	snprintf(error, sizeof(error), "perf_event_open: %s", strerror(err));
+    return n;
+}
+
+const char *perfctr_error(void)
+{
+    return error;
+}
+
+/*
+ * perfctr_start - Zero and start the counters
+ */
+void perfctr_start(void)
+{
+    int g;
+
+    for (g = 0; g < NGROUPS; g++)
+	if (leader[g] >= 0) {
+	    ioctl(leader[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	    ioctl(leader[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+}
+
+/*
+ * perfctr_stop - Stop the counters and read them into counts
+ */
+void perfctr_stop(double counts[PC_NEVENTS])
+{
+    uint64_t buf[NGROUPS][3 + PC_NEVENTS]; /* nr, time enabled, time running, values */
+    int ok[NGROUPS];
+    int e, g;
+
+    for (g = 0; g < NGROUPS; g++) {
+	ok[g] = 0;
+	if (leader[g] < 0)
+	    continue;
+	ioctl(leader[g], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	ok[g] = read(leader[g], buf[g], sizeof(buf[g])) >= (ssize_t)(3 * sizeof(uint64_t))
+	    && buf[g][2] > 0;
+    }
+    for (e = 0; e < PC_NEVENTS; e++) {
+	g = events[e].group;
+	if (fds[e] < 0 || !ok[g])
+	    counts[e] = -1;
+	else
+	    counts[e] = (double)buf[g][3 + slot[e]] * buf[g][1] / buf[g][2];
+    }
+}
+
+void perfctr_close(void)
+{
+    int e;
+
+    for (e = 0; e < PC_NEVENTS; e++)
+	if (fds[e] >= 0) {
+	    close(fds[e]);
+	    fds[e] = -1;
+	}
+    leader[0] = leader[1] = -1;
+}
+
+#else /* !__linux__ */
+
+static const char *error = "no perf_event_open on this system";
+
+int perfctr_open(void)
+{
+    return 0;
+}
+
+const char *perfctr_error(void)
+{
+    return error;
+}
+
+void perfctr_start(void)
+{
+}
+
+void perfctr_stop(double counts[PC_NEVENTS])
+{
+    int e;
+
+    for (e = 0; e < PC_NEVENTS; e++)
+	counts[e] = -1;
+}
+
+void perfctr_close(void)
+{
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,38 @@
+/*
+ * perfctr.h - Hardware event counts around a replay (mdriver -E)
+ *
+ * perfctr_open opens the events as perf_event counter groups on the
+ * calling thread, user mode only. Events this CPU or kernel cannot
+ * count are left out, and where perf_event_open is refused altogether
+ * (no PMU, a container, perf_event_paranoid) none are counted and
+ * perfctr_error says why.
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+enum {
+    PC_CYCLES,
+    PC_INSTRUCTIONS,
+    PC_BRANCH_MISSES,
+    PC_L1D_MISSES,
+    PC_LLC_MISSES,
+    PC_DTLB_MISSES,
+    PC_NEVENTS
+};
+
+/* Open the counters; return how many events can be counted */
+int perfctr_open(void);
+
+/* Why perfctr_open counts no events */
+const char *perfctr_error(void);
+
+/* Zero and start the counters */
+void perfctr_start(void);
+
+/* Stop the counters and store each event's count, scaled up if it was
+   multiplexed, in counts, or -1 for events that were not counted */
+void perfctr_stop(double counts[PC_NEVENTS]);
+
+void perfctr_close(void);
+
+#endif /* __PERFCTR_H_ */